@@ -57,3 +57,17 @@ function(STREAM_LINK_LIBRARY libname)
    
    target_include_directories(${libname} PRIVATE ${CMAKE_SOURCE_DIR}/include)
 endfunction()
+
+#---STREAM_EXECUTABLE(exename
+#                     SOURCES src1 src2          :
+#                     LIBRARIES lib1 lib2        : direct linked libraries
+#)
+function(STREAM_EXECUTABLE exename)
+   cmake_parse_arguments(ARG "" "" "SOURCES;LIBRARIES" ${ARGN})
+
+   add_executable(${exename} ${ARG_SOURCES})
+
+   target_link_libraries(${exename} ${ARG_LIBRARIES})
+
+   target_include_directories(${exename} PRIVATE ${CMAKE_SOURCE_DIR}/include)
+endfunction()
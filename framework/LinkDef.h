@@ -12,6 +12,7 @@
 #pragma link C++ class base::SubEvent+;
 #pragma link C++ class base::LocalStampConverter+;
 #pragma link C++ class base::Event+;
+#pragma link C++ class base::MergedMsg+;
 #pragma link C++ class base::Message+;
 #pragma link C++ class base::Iterator+;
 #pragma link C++ class base::Processor+;
@@ -23,6 +24,10 @@
 #pragma link C++ class base::SyncMarker+;
 #pragma link C++ class base::LocalTimeMarker+;
 #pragma link C++ class base::GlobalMarker+;
+#pragma link C++ class base::CoincidenceHit+;
+#pragma link C++ class base::TriggerRule+;
+#pragma link C++ class base::HistSnapshot+;
+#pragma link C++ class base::ShmHistRegistry+;
 
 // here is dabc classes
 #pragma link C++ namespace dabc;
@@ -59,6 +64,8 @@
 #pragma link C++ class hadaqs::RawSubevent+;
 #pragma link C++ namespace hadaq;
 #pragma link C++ class hadaq::HldFile+;
+#pragma link C++ class hadaq::HldGenerator;
+#pragma link C++ class hadaq::CalibrDb;
 #pragma link C++ class hadaq::TrbIterator+;
 #pragma link C++ class hadaq::TdcMessage+;
 #pragma link C++ class base::MessageExt<hadaq::TdcMessage>+;
@@ -91,6 +98,7 @@
 #pragma link C++ namespace mbs;
 #pragma link C++ class mbs::SubEvent+;
 #pragma link C++ class mbs::Processor+;
+#pragma link C++ class mbs::LmdFile;
 
 // ROOT classes
 #pragma link C++ class THookProc+;
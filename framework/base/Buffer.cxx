@@ -3,16 +3,33 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <atomic>
+
+namespace {
+   std::atomic<unsigned long> gNumBufferAllocs{0};   ///< number of allocated buffer records
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Returns number of memory allocations done by all buffers, used to measure allocations in benchmarks
+
+unsigned long base::Buffer::NumAllocations()
+{
+   return gNumBufferAllocs.load(std::memory_order_relaxed);
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// reset buffer
 
 void base::Buffer::reset()
 {
-   if (fRec!=0) {
-      if (--fRec->refcnt == 0)
-         free(fRec);
-      fRec = 0;
+   RawDataRec* rec = fRec;
+   fRec = 0;
+
+   // record which references data of other record also releases that record
+   while ((rec!=0) && (--rec->refcnt == 0)) {
+      RawDataRec* parent = rec->parent;
+      free(rec);
+      rec = parent;
    }
 }
 
@@ -46,6 +63,8 @@ void base::Buffer::makenew(unsigned datalen)
       return;
    }
 
+   gNumBufferAllocs.fetch_add(1, std::memory_order_relaxed);
+
    fRec->reset();
 
    fRec->refcnt = 1;
@@ -65,13 +84,13 @@ void base::Buffer::makecopyof(void* buf, unsigned datalen)
    if ((buf==0) || (datalen==0)) return;
 
    fRec = (RawDataRec*) malloc(sizeof(RawDataRec) + datalen);
-
-   fRec = (RawDataRec*) malloc(sizeof(RawDataRec));
    if (!fRec) {
       printf("Buffer allocation error makecopyof sz %ld\n", (long) (sizeof(RawDataRec) + datalen));
       return;
    }
 
+   gNumBufferAllocs.fetch_add(1, std::memory_order_relaxed);
+
    fRec->reset();
 
    fRec->refcnt = 1;
@@ -97,6 +116,8 @@ void base::Buffer::makereferenceof(void* buf, unsigned datalen)
       return;
    }
 
+   gNumBufferAllocs.fetch_add(1, std::memory_order_relaxed);
+
    fRec->reset();
 
    fRec->refcnt = 1;
@@ -105,3 +126,32 @@ void base::Buffer::makereferenceof(void* buf, unsigned datalen)
 
    fRec->datalen = datalen;
 }
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// create reference on data of other buffer with own record
+
+void base::Buffer::makereferenceof(const Buffer& src)
+{
+   RawDataRec* parent = src.fRec;
+   if (parent) parent->refcnt++;
+
+   reset();
+
+   if (!parent) return;
+
+   fRec = (RawDataRec*) malloc(sizeof(RawDataRec));
+   if (!fRec) {
+      printf("Buffer allocation error makereference of sz %ld\n", (long) sizeof(RawDataRec));
+      Buffer tmp;
+      tmp.fRec = parent; // release reference on source record
+      return;
+   }
+
+   gNumBufferAllocs.fetch_add(1, std::memory_order_relaxed);
+
+   *fRec = *parent;
+
+   fRec->refcnt = 1;
+
+   fRec->parent = parent;
+}
@@ -3,6 +3,10 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <queue>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Return subevent by name with index
 
 base::SubEvent* base::Event::GetSubEvent(const std::string& name, unsigned subindx) const
 {
@@ -17,3 +21,56 @@ base::SubEvent* base::Event::GetSubEvent(const std::string& name, unsigned subin
 
    return GetSubEvent(sbuf);
 }
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Produce single time-ordered list of messages from all subevents
+///
+/// Only subevents which provide global time of messages are used,
+/// messages themselves remain in the subevents. Each subevent is time-sorted
+/// before (when dosort specified) and all together are merged with k-way merge.
+/// Returns number of messages in the list
+
+unsigned base::Event::MergeTimeSorted(std::vector<MergedMsg> &res, bool dosort)
+{
+   res.clear();
+
+   /** current position in one of subevents */
+   struct Cursor {
+      GlobalTime_t tm;
+      unsigned     src;
+      unsigned     indx;
+      bool operator>(const Cursor &c) const { return tm > c.tm; }
+   };
+
+   std::vector<base::SubEvent*> subs;
+   std::vector<unsigned> sizes;
+   std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> heap;
+
+   unsigned total = 0;
+
+   for (auto &entry : fMap) {
+      base::SubEvent *sub = entry.second;
+      if (!sub || !sub->HasGlobalTime() || (sub->Multiplicity() == 0)) continue;
+      if (dosort) sub->Sort();
+      heap.push({ sub->GetMsgGlobalTime(0), (unsigned) subs.size(), 0 });
+      subs.emplace_back(sub);
+      sizes.emplace_back(sub->Multiplicity());
+      total += sub->Multiplicity();
+   }
+
+   res.reserve(total);
+
+   while (!heap.empty()) {
+      Cursor cur = heap.top();
+      heap.pop();
+
+      res.emplace_back(cur.tm, subs[cur.src], cur.indx);
+
+      if (++cur.indx < sizes[cur.src]) {
+         cur.tm = subs[cur.src]->GetMsgGlobalTime(cur.indx);
+         heap.push(cur);
+      }
+   }
+
+   return res.size();
+}
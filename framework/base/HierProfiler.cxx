@@ -0,0 +1,277 @@
+#include "base/HierProfiler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <typeinfo>
+#include <cxxabi.h>
+
+#include "base/Processor.h"
+
+std::atomic<bool> base::HierProfiler::gEnabled{false};
+
+namespace {
+
+   std::mutex gProfMutex;                                    ///< protects list of threads data
+   std::vector<base::HierProfiler::ThreadData*> gProfThreads; ///< data of all threads
+   thread_local base::HierProfiler::ThreadData *gProfData = nullptr; ///< data of current thread
+
+   std::chrono::steady_clock::time_point gProfStartTm;      ///< time when statistic was reset
+   base::HierProfiler::ticks_t gProfStartTicks = 0;         ///< ticks when statistic was reset
+
+   /** merged statistic of scope from all threads */
+   struct MergedNode {
+      std::string name;                  ///< scope name
+      std::string procname;              ///< processor name
+      std::string classname;             ///< processor class name
+      base::HierProfiler::ticks_t sum{0}; ///< accumulated ticks
+      uint64_t cnt{0};                   ///< number of calls
+      std::vector<MergedNode> childs;    ///< child scopes
+
+      /** find or create child */
+      MergedNode &child(const std::string &_name, const std::string &_procname, const std::string &_classname)
+      {
+         for (auto &ch : childs)
+            if ((ch.name == _name) && (ch.procname == _procname))
+               return ch;
+         childs.emplace_back();
+         childs.back().name = _name;
+         childs.back().procname = _procname;
+         childs.back().classname = _classname;
+         return childs.back();
+      }
+   };
+
+   /** escape string for JSON */
+   std::string JsonStr(const std::string &s)
+   {
+      std::string res = "\"";
+      for (char c : s) {
+         if ((c == '"') || (c == '\\')) res.append(1, '\\');
+         res.append(1, c);
+      }
+      res.append("\"");
+      return res;
+   }
+
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns statistic of current thread, created when thread enters first scope
+
+base::HierProfiler::ThreadData *base::HierProfiler::GetThreadData()
+{
+   if (!gProfData) {
+      gProfData = new ThreadData;
+      gProfData->nodes.emplace_back(); // root node
+
+      std::lock_guard<std::mutex> lock(gProfMutex);
+      gProfData->id = gProfThreads.size();
+      gProfThreads.emplace_back(gProfData);
+   }
+   return gProfData;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Find node for the scope in current parent, create new when necessary
+
+unsigned base::HierProfiler::FindNode(ThreadData *data, const char *name, const Processor *proc)
+{
+   Key key{name, proc, data->current};
+
+   auto iter = data->map.find(key);
+   if (iter != data->map.end())
+      return iter->second;
+
+   unsigned indx = data->nodes.size();
+   data->nodes.emplace_back();
+   Node &node = data->nodes.back();
+   node.name = name;
+   node.proc = proc;
+   node.parent = data->current;
+   if (proc) {
+      node.procname = proc->GetName();
+      const char *mangled = typeid(*proc).name();
+      int status = 0;
+      char *demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+      node.classname = (status == 0) && demangled ? demangled : mangled;
+      free(demangled);
+   }
+
+   data->map[key] = indx;
+   return indx;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Enable or disable profiling, statistic is reset when profiling enabled
+
+void base::HierProfiler::SetEnabled(bool on)
+{
+   if (on && !IsEnabled()) Reset();
+   gEnabled.store(on);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Reset accumulated statistic
+///
+/// Should be called when no other threads are measuring, normally at the event boundary
+
+void base::HierProfiler::Reset()
+{
+   std::lock_guard<std::mutex> lock(gProfMutex);
+
+   for (auto data : gProfThreads)
+      for (auto &node : data->nodes) {
+         node.sum = 0;
+         node.cnt = 0;
+      }
+
+   gProfStartTm = std::chrono::steady_clock::now();
+   gProfStartTicks = GetTicks();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns time in seconds since statistic was reset
+
+double base::HierProfiler::GetMeasuredTime()
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - gProfStartTm).count();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Produce report with accumulated statistic
+///
+/// Statistic of all threads is merged, scopes with same name and processor
+/// on the same path are summed up. Also totals per processor class are provided.
+/// When json is true, report is produced in JSON format.
+/// Should be called when no other threads are measuring, normally at the event boundary
+
+std::string base::HierProfiler::Report(bool json)
+{
+   std::lock_guard<std::mutex> lock(gProfMutex);
+
+   double tm = GetMeasuredTime();
+   ticks_t ticks = GetTicks() - gProfStartTicks;
+   double tick_tm = (ticks > 0) && (tm > 0) ? tm / ticks : 0.;
+
+   MergedNode root;
+   std::vector<double> thrd_tm;
+
+   for (auto data : gProfThreads) {
+      ticks_t thrd_sum = 0;
+      // pointers are not stored while vector of childs may be extended
+      for (unsigned n = 1; n < data->nodes.size(); n++) {
+         Node &node = data->nodes[n];
+         std::vector<unsigned> path;
+         for (unsigned p = n; p != 0; p = data->nodes[p].parent)
+            path.emplace_back(p);
+         MergedNode *tgt = &root;
+         for (auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+            Node &pn = data->nodes[*iter];
+            tgt = &tgt->child(pn.name, pn.procname, pn.classname);
+         }
+         tgt->sum += node.sum;
+         tgt->cnt += node.cnt;
+         if (node.parent == 0) thrd_sum += node.sum;
+      }
+      thrd_tm.emplace_back(thrd_sum * tick_tm);
+   }
+
+   // totals per processor class and scope name
+   std::map<std::string, std::pair<ticks_t, uint64_t>> classes;
+
+   std::vector<const MergedNode*> stack{&root};
+   while (!stack.empty()) {
+      const MergedNode *node = stack.back();
+      stack.pop_back();
+      if (!node->classname.empty()) {
+         auto &entry = classes[node->classname + "::" + node->name];
+         entry.first += node->sum;
+         entry.second += node->cnt;
+      }
+      for (auto &ch : node->childs)
+         stack.emplace_back(&ch);
+   }
+
+   std::string res;
+   char sbuf[1000];
+
+   if (json) {
+      snprintf(sbuf, sizeof(sbuf), "{\"time\":%g,\"threads\":[", tm);
+      res.append(sbuf);
+      for (unsigned n = 0; n < thrd_tm.size(); n++) {
+         snprintf(sbuf, sizeof(sbuf), "%s%g", n > 0 ? "," : "", thrd_tm[n]);
+         res.append(sbuf);
+      }
+      res.append("],\"scopes\":");
+
+      std::function<void(const MergedNode &)> dump = [&](const MergedNode &node) {
+         res.append("[");
+         for (unsigned n = 0; n < node.childs.size(); n++) {
+            const MergedNode &ch = node.childs[n];
+            if (n > 0) res.append(",");
+            res.append("{\"name\":" + JsonStr(ch.name));
+            if (!ch.procname.empty())
+               res.append(",\"proc\":" + JsonStr(ch.procname) + ",\"class\":" + JsonStr(ch.classname));
+            snprintf(sbuf, sizeof(sbuf), ",\"calls\":%lu,\"time\":%g", (long unsigned) ch.cnt, ch.sum * tick_tm);
+            res.append(sbuf);
+            if (!ch.childs.empty()) {
+               res.append(",\"childs\":");
+               dump(ch);
+            }
+            res.append("}");
+         }
+         res.append("]");
+      };
+      dump(root);
+
+      res.append(",\"classes\":[");
+      bool first = true;
+      for (auto &entry : classes) {
+         if (!first) res.append(",");
+         first = false;
+         snprintf(sbuf, sizeof(sbuf), ",\"calls\":%lu,\"time\":%g}", (long unsigned) entry.second.second, entry.second.first * tick_tm);
+         res.append("{\"name\":" + JsonStr(entry.first) + sbuf);
+      }
+      res.append("]}");
+      return res;
+   }
+
+   snprintf(sbuf, sizeof(sbuf), "Profiler statistic for %.3f s, threads:", tm);
+   res.append(sbuf);
+   for (auto thtm : thrd_tm) {
+      snprintf(sbuf, sizeof(sbuf), " %.1f%%", tm > 0 ? thtm / tm * 100. : 0.);
+      res.append(sbuf);
+   }
+   res.append("\n");
+
+   std::function<void(const MergedNode &, int)> dump = [&](const MergedNode &node, int lvl) {
+      for (auto &ch : node.childs) {
+         std::string name = std::string(lvl * 2, ' ') + ch.name;
+         if (!ch.procname.empty()) name += " " + ch.procname;
+         snprintf(sbuf, sizeof(sbuf), "%-50s calls %10lu time %10.3f ms %5.1f%% avg %8.3f us\n",
+                  name.c_str(), (long unsigned) ch.cnt, ch.sum * tick_tm * 1e3,
+                  tm > 0 ? ch.sum * tick_tm / tm * 100. : 0.,
+                  ch.cnt > 0 ? ch.sum * tick_tm / ch.cnt * 1e6 : 0.);
+         res.append(sbuf);
+         dump(ch, lvl + 1);
+      }
+   };
+   dump(root, 1);
+
+   if (!classes.empty()) {
+      res.append("Per processor class:\n");
+      for (auto &entry : classes) {
+         snprintf(sbuf, sizeof(sbuf), "  %-48s calls %10lu time %10.3f ms %5.1f%%\n",
+                  entry.first.c_str(), (long unsigned) entry.second.second, entry.second.first * tick_tm * 1e3,
+                  tm > 0 ? entry.second.first * tick_tm / tm * 100. : 0.);
+         res.append(sbuf);
+      }
+   }
+
+   return res;
+}
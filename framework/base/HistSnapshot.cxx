@@ -0,0 +1,105 @@
+#include "base/HistSnapshot.h"
+
+#include <cstring>
+
+///////////////////////////////////////////////////////////////////////////
+/// Add 1D histogram to the snapshot, returns false when snapshot is pending
+
+bool base::HistSnapshot::AddH1(H1handle h1)
+{
+   if (!h1 || IsPending()) return false;
+
+   Entry entry;
+   entry.hist = h1;
+   fHists.emplace_back(entry);
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Add 2D histogram to the snapshot, returns false when snapshot is pending
+
+bool base::HistSnapshot::AddH2(H2handle h2)
+{
+   if (!h2 || IsPending()) return false;
+
+   Entry entry;
+   entry.hist = h2;
+   entry.is2d = true;
+   fHists.emplace_back(entry);
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Remove all histograms and produced copies, ignored when snapshot is pending
+
+void base::HistSnapshot::Clear()
+{
+   if (IsPending()) return;
+
+   fHists.clear();
+   for (int k = 0; k < 2; k++) {
+      fBuf[k].clear();
+      fOffsets[k].clear();
+   }
+   fVersion.store(0, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns size of histogram array in internal format, including header
+
+unsigned base::HistSnapshot::HistSize(const Entry &entry)
+{
+   double *arr = (double *) entry.hist;
+
+   if (entry.is2d)
+      return ((int) arr[0] + 2) * ((int) arr[3] + 2) + 6;
+
+   return (int) arr[0] + 5;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Copy all histograms into back buffer and publish it as front buffer
+///
+/// Called by base::ProcMgr in the event loop thread at the event boundary
+
+void base::HistSnapshot::Produce()
+{
+   unsigned back = 1 - fFront.load(std::memory_order_relaxed);
+
+   std::vector<double> &buf = fBuf[back];
+   std::vector<unsigned> &offsets = fOffsets[back];
+
+   offsets.resize(fHists.size());
+
+   unsigned total = 0;
+   for (unsigned n = 0; n < fHists.size(); n++) {
+      offsets[n] = total;
+      total += HistSize(fHists[n]);
+   }
+
+   buf.resize(total);
+
+   for (unsigned n = 0; n < fHists.size(); n++)
+      memcpy(buf.data() + offsets[n], fHists[n].hist, HistSize(fHists[n]) * sizeof(double));
+
+   fFront.store(back, std::memory_order_release);
+   fVersion.fetch_add(1, std::memory_order_release);
+   fPending.store(false, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns copy of n-th histogram in internal format from the last produced snapshot
+///
+/// Returns nullptr when snapshot was never produced.
+/// Pointer remains valid until next snapshot is requested
+
+const double *base::HistSnapshot::GetHist(unsigned n) const
+{
+   if (GetVersion() == 0) return nullptr;
+
+   unsigned front = fFront.load(std::memory_order_acquire);
+
+   if (n >= fOffsets[front].size()) return nullptr;
+
+   return fBuf[front].data() + fOffsets[front][n];
+}
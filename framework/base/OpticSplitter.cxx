@@ -33,55 +33,77 @@ base::OpticSplitter::~OpticSplitter()
 void base::OpticSplitter::AddSub(SysCoreProc* proc, unsigned id)
 {
    fMap[id] = proc;
+
+   if (fLookup.empty()) fLookup.resize(0x10000, nullptr);
+   fLookup[id & 0xffff] = proc;
 }
 
 ///////////////////////////////////////////////////////////////////////////
-/// Scan all messages, find reference signals
+/// Split buffer data between sub-processors
+///
+/// In first pass number of messages for every board is counted,
+/// than buffers of exact size are allocated and in second pass
+/// sequences of messages from same board are copied at once.
+/// If all messages belong to single board, buffer delivered as is.
 
 bool base::OpticSplitter::FirstBufferScan(const base::Buffer& buf)
 {
-   // TODO: one can treat special case when buffer data only from single board
-   // in this case one could deliver buffer as is to the SysCoreProc
+   if (buf.null() || fLookup.empty()) return true;
 
    uint64_t* ptr = (uint64_t*) buf.ptr();
 
-   unsigned len = buf.datalen();
+   unsigned nmsg = buf.datalen() / 8;
 
-   while(len>0) {
-      unsigned brdid = (*ptr & 0xffff);
+   fActive.clear();
 
-      SysCoreMap::iterator iter = fMap.find(brdid);
+   for (unsigned n = 0; n < nmsg; n++) {
+      SysCoreProc* proc = fLookup[ptr[n] & 0xffff];
+      if (proc && (proc->fSplitCnt++ == 0))
+         fActive.emplace_back(proc);
+   }
 
-      if (iter != fMap.end()) {
-         SysCoreProc* proc = iter->second;
+   if (fActive.empty()) return true;
+
+   if ((fActive.size() == 1) && (fActive[0]->fSplitCnt == nmsg) && (nmsg*8 == buf.datalen())) {
+      // special case - all data from single board, deliver data without copy
+      // own record is used - input buffer may be used by others and must not be changed
+      SysCoreProc* proc = fActive[0];
+      proc->fSplitCnt = 0;
+      proc->fSplitBuf.makereferenceof(buf);
+      proc->fSplitBuf.rec().boardid = proc->GetID();
+      proc->AddNextBuffer(proc->fSplitBuf);
+      proc->fSplitBuf.reset();
+      return true;
+   }
 
-         if (proc->fSplitPtr == 0) {
-            proc->fSplitBuf.makenew(buf.datalen());
-            proc->fSplitPtr = (uint64_t*) proc->fSplitBuf.ptr();
-         }
+   for (auto proc : fActive) {
+      proc->fSplitBuf.makenew(proc->fSplitCnt*8);
+      proc->fSplitPtr = (uint64_t*) proc->fSplitBuf.ptr();
+   }
 
-         memcpy(proc->fSplitPtr, ptr, 8);
-         proc->fSplitPtr++;
-      }
+   unsigned n = 0;
+   while (n < nmsg) {
+      unsigned brdid = ptr[n] & 0xffff, first = n++;
 
-      len-=8;
-      ptr++;
-   }
+      while ((n < nmsg) && ((ptr[n] & 0xffff) == brdid)) n++;
+
+      SysCoreProc* proc = fLookup[brdid];
+      if (!proc) continue;
 
-   for (SysCoreMap::iterator iter = fMap.begin(); iter!=fMap.end(); iter++) {
-      SysCoreProc* proc = iter->second;
-      if (proc->fSplitPtr != 0) {
-         proc->fSplitBuf.setdatalen((proc->fSplitPtr - (uint64_t*) proc->fSplitBuf.ptr())*8);
+      memcpy(proc->fSplitPtr, ptr + first, (n - first)*8);
+      proc->fSplitPtr += (n - first);
+   }
 
-         proc->fSplitBuf.rec().kind = buf.rec().kind;
-         proc->fSplitBuf.rec().format = buf.rec().format;
-         proc->fSplitBuf.rec().boardid = iter->first;
+   for (auto proc : fActive) {
+      proc->fSplitBuf.rec().kind = buf.rec().kind;
+      proc->fSplitBuf.rec().format = buf.rec().format;
+      proc->fSplitBuf.rec().boardid = proc->GetID();
 
-         proc->AddNextBuffer(proc->fSplitBuf);
+      proc->AddNextBuffer(proc->fSplitBuf);
 
-         proc->fSplitPtr = 0;
-         proc->fSplitBuf.reset();
-      }
+      proc->fSplitPtr = 0;
+      proc->fSplitCnt = 0;
+      proc->fSplitBuf.reset();
    }
 
    return true;
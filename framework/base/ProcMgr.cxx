@@ -2,13 +2,201 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
 #include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "base/StreamProc.h"
 #include "base/EventProc.h"
+#include "base/TriggerRule.h"
+#include "base/HistSnapshot.h"
+#include "base/ShmHistRegistry.h"
+#include "base/HierProfiler.h"
 
 base::ProcMgr* base::ProcMgr::fInstance = 0;
 
+/** Pool of threads, used to scan data of several processors in parallel.
+  * Threads are started once and wait for next portion of work.
+  * Processors only fill their own queues (sync and trigger markers, coincidence hits),
+  * which are accessed by the manager after all threads finished - no locking is required */
+
+class base::ProcMgr::ScanThreads {
+   protected:
+      std::vector<std::thread>  fThreads;        ///< worker threads
+      std::mutex                fMutex;          ///< mutex for start/stop of the work
+      std::condition_variable   fStartCond;      ///< signals start of new work
+      std::condition_variable   fDoneCond;       ///< signals that all threads finished work
+      std::vector<StreamProc*> *fProcs{nullptr}; ///< processors to scan
+      std::atomic<unsigned>     fNext{0};        ///< next processor to scan
+      unsigned                  fGeneration{0};  ///< counter of works
+      unsigned                  fRunning{0};     ///< number of threads still running
+      bool                      fStop{false};    ///< stop threads
+
+      /** Scan processors until all are done */
+      void ProcessWork()
+      {
+         unsigned n;
+         while ((n = fNext++) < fProcs->size())
+            (*fProcs)[n]->ScanNewBuffers();
+      }
+
+      /** Main function of worker thread */
+      void ThreadFunc()
+      {
+         unsigned generation = 0;
+         while (true) {
+            {
+               std::unique_lock<std::mutex> lock(fMutex);
+               fStartCond.wait(lock, [this, generation] { return fStop || (fGeneration != generation); });
+               if (fStop) return;
+               generation = fGeneration;
+            }
+
+            ProcessWork();
+
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (--fRunning == 0) fDoneCond.notify_one();
+         }
+      }
+
+   public:
+      /** constructor, starts nthreads-1 threads - main thread also performs scanning */
+      ScanThreads(unsigned nthreads)
+      {
+         for (unsigned n = 1; n < nthreads; n++)
+            fThreads.emplace_back(&ScanThreads::ThreadFunc, this);
+      }
+
+      /** destructor, stops all threads */
+      ~ScanThreads()
+      {
+         {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fStop = true;
+         }
+         fStartCond.notify_all();
+         for (auto &thrd : fThreads)
+            thrd.join();
+      }
+
+      /** Scan data of all processors, returns when all processors are done */
+      void Scan(std::vector<StreamProc*> &procs)
+      {
+         {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fProcs = &procs;
+            fNext = 0;
+            fRunning = fThreads.size();
+            fGeneration++;
+         }
+         fStartCond.notify_all();
+
+         ProcessWork();
+
+         std::unique_lock<std::mutex> lock(fMutex);
+         fDoneCond.wait(lock, [this] { return fRunning == 0; });
+         fProcs = nullptr;
+      }
+};
+
+/** Memory for large histograms in internal format.
+  * Memory is reserved with anonymous mapping - pages are provided by the system only when
+  * they are written first time. Every histogram starts on the page boundary, therefore
+  * histogram which was never filled occupies only single page with the header.
+  * Memory is already zeroed, no clearing of bins is required */
+
+class base::ProcMgr::HistArena {
+   protected:
+      std::vector<std::pair<char*, size_t>> fChunks; ///< reserved memory chunks
+      char     *fCurr{nullptr};                     ///< current position in last chunk
+      size_t    fFree{0};                           ///< free space in last chunk
+      size_t    fPageSize{4096};                    ///< system page size
+
+   public:
+      enum { ChunkSize = 0x4000000 }; ///< 64 MB reserved at once
+
+      /** constructor */
+      HistArena()
+      {
+         long sz = sysconf(_SC_PAGESIZE);
+         if (sz > 0) fPageSize = sz;
+      }
+
+      /** destructor, release all memory */
+      ~HistArena()
+      {
+         for (auto &chunk : fChunks)
+            munmap(chunk.first, chunk.second);
+      }
+
+      /** Returns system page size */
+      size_t PageSize() const { return fPageSize; }
+
+      /** Returns true if array allocated in the arena */
+      bool Contains(const double *arr) const
+      {
+         for (auto &chunk : fChunks)
+            if (((const char *) arr >= chunk.first) && ((const char *) arr < chunk.first + chunk.second))
+               return true;
+         return false;
+      }
+
+      /** Clear part of array, allocated in the arena. Complete pages are returned to the system */
+      void Clear(double *first, size_t len)
+      {
+         char *beg = (char *) first, *end = (char *) (first + len),
+              *pbeg = (char *) (((uintptr_t) beg + fPageSize - 1) / fPageSize * fPageSize),
+              *pend = (char *) (((uintptr_t) end + fPageSize - 1) / fPageSize * fPageSize); // allocation always ends at page boundary
+
+         if (pbeg >= end) {
+            memset(beg, 0, end - beg);
+            return;
+         }
+
+         memset(beg, 0, pbeg - beg);
+         if (madvise(pbeg, pend - pbeg, MADV_DONTNEED) != 0)
+            memset(pbeg, 0, end - pbeg);
+      }
+
+      /** Allocate zeroed array, returns nullptr if system does not provide memory */
+      double *Allocate(size_t len)
+      {
+         size_t nbytes = (len * sizeof(double) + fPageSize - 1) / fPageSize * fPageSize;
+
+         if (nbytes > fFree) {
+            size_t chunksize = nbytes > ChunkSize ? nbytes : (size_t) ChunkSize;
+            void *mem = mmap(nullptr, chunksize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mem == MAP_FAILED) return nullptr;
+            fChunks.emplace_back((char *) mem, chunksize);
+            fCurr = (char *) mem;
+            fFree = chunksize;
+         }
+
+         double *res = (double *) fCurr;
+         fCurr += nbytes;
+         fFree -= nbytes;
+         return res;
+      }
+};
+
+/** Queue of histograms snapshots requests.
+  * Consumers add requests from any thread, event loop only tries to lock the queue
+  * and postpones processing when it is locked - it never waits for the consumer */
+
+class base::ProcMgr::SnapshotQueue {
+   public:
+      std::mutex                  fMutex;         ///< protects list of requests
+      std::vector<HistSnapshot*>  fRequests;      ///< pending requests
+      std::atomic<unsigned>       fNumRequests{0}; ///< number of pending requests, checked without locking
+};
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 /// constructor
 
@@ -16,7 +204,7 @@ base::ProcMgr::ProcMgr() :
    fProc(),
    fMap(),
    fEvProc(),
-   fTriggers(10000),                // FIXME: size should be configurable
+   fTriggers(StreamProc::fMarksQueueCapacity),  // queue will be expanded when necessary
    fTimeMasterIndex(DummyIndex),
    fAnalysisKind(kind_Stream),
    fTree(0),
@@ -26,6 +214,8 @@ base::ProcMgr::ProcMgr() :
 {
    if (!fInstance) fInstance = this;
 
+   fSnapshots = new SnapshotQueue;
+
    fSecondName = "second.C";
 }
 
@@ -37,6 +227,23 @@ base::ProcMgr::~ProcMgr()
    DeleteAllProcessors();
    // printf("Delete processors done\n");
 
+   for (auto rule : fTrigRules)
+      delete rule;
+   fTrigRules.clear();
+
+   delete fScanThreads;
+   fScanThreads = nullptr;
+
+   delete fSnapshots;
+   fSnapshots = nullptr;
+
+   delete fShmHists;
+   fShmHists = nullptr;
+
+   // histograms are not used after processors are deleted
+   delete fHistArena;
+   fHistArena = nullptr;
+
    ClearInstancePointer(this);
 }
 
@@ -143,14 +350,77 @@ base::H1handle base::ProcMgr::MakeH1(const char* name, const char* title, int nb
 {
    if (!InternalHistFormat()) return nullptr;
 
-   double* arr = new double[nbins+5];
+   bool iszero = false;
+   double* arr = AllocateHist(1, name, title, xtitle, nbins+5, iszero);
    arr[0] = nbins;
    arr[1] = left;
    arr[2] = right;
-   for (int n=0;n<nbins+2;n++) arr[n+3] = 0.;
+   if (!iszero)
+      for (int n=0;n<nbins+2;n++) arr[n+3] = 0.;
    return arr;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Allocate array for histogram in internal format
+///
+/// When shared memory is configured, array allocated there. Large and sparse histograms are
+/// allocated in lazy memory, which is provided by system only when histogram is filled.
+/// Parameter iszero returns true when array is already cleared
+
+double *base::ProcMgr::AllocateHist(unsigned kind, const char *name, const char *title, const char *options, unsigned long size, bool &iszero, bool sparse)
+{
+   double *arr = fShmHists ? fShmHists->Allocate(kind, name, title, options, size) : nullptr;
+
+   if (!arr && (fLazyHists || sparse)) {
+      if (!fHistArena) fHistArena = new HistArena;
+      if (sparse || (size * sizeof(double) >= 2 * fHistArena->PageSize()))
+         arr = fHistArena->Allocate(size);
+   }
+
+   iszero = (arr != nullptr);
+
+   if (!arr) arr = new double[size];
+
+   return arr;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Clear bins of histogram array in internal format
+///
+/// For histograms in lazy memory complete pages are returned to the system,
+/// therefore sparse histogram remains sparse after clear
+
+void base::ProcMgr::ClearHistBins(double *bins, unsigned long len)
+{
+   if (fHistArena && fHistArena->Contains(bins))
+      fHistArena->Clear(bins, len);
+   else
+      for (unsigned long n = 0; n < len; n++) bins[n] = 0.;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Allocate all new histograms in named shared memory segment
+///
+/// External processes can attach segment with base::ShmHistRegistry::Attach() and read
+/// histograms without any interaction with analysis. Only internal histogram format is supported.
+/// When segment is full, histograms are allocated in normal memory.
+/// When isfile specified, normal file is used - it will contain all histograms when analysis is finished.
+/// Should be called before histograms are created, typically in first.C
+
+bool base::ProcMgr::SetSharedHistograms(const char *name, unsigned long size, unsigned maxhists, bool isfile)
+{
+   if (!InternalHistFormat() || fShmHists) return false;
+
+   fShmHists = new ShmHistRegistry;
+   if (!fShmHists->Create(name, size, maxhists, isfile)) {
+      delete fShmHists;
+      fShmHists = nullptr;
+      return false;
+   }
+
+   return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 /// get number of histogram bins
 
@@ -217,7 +487,7 @@ void base::ProcMgr::ClearH1(base::H1handle h1)
    if (!InternalHistFormat() || !h1) return;
 
    double* arr = (double*) h1;
-   for (int n=0;n<arr[0]+2;n++) arr[n+3] = 0.;
+   ClearHistBins(arr + 3, (int) arr[0] + 2);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -248,19 +518,38 @@ void base::ProcMgr::CopyH1(H1handle tgt, H1handle src)
 /// Parameter options can also be used to deliver different optional arguments.
 /// Syntax will be like: arg_name:arg_value;arg2_name:arg2_value;
 /// For instance, labels for each x bin: "xbin:EPOCH,HIT,SYNC,AUX,,,SYS;"
+///
+/// Option "sparse" selects sparse storage for mostly empty histograms in internal format:
+/// bins are organized in page-size tiles, which are provided by system only when first bin
+/// in the tile is filled. Layout of bins remains the same as for normal histogram.
 
 base::H2handle base::ProcMgr::MakeH2(const char* name, const char* title, int nbins1, double left1, double right1, int nbins2, double left2, double right2, const char* options)
 {
    if (!InternalHistFormat()) return 0;
 
-   double* bins = new double[(nbins1+2)*(nbins2+2)+6];
+   bool sparse = false;
+   if (options) {
+      const char *pos = options;
+      while ((pos = strstr(pos, "sparse")) != nullptr) {
+         // only complete token is accepted
+         if (((pos == options) || (pos[-1] == ';')) && ((pos[6] == 0) || (pos[6] == ';'))) {
+            sparse = true;
+            break;
+         }
+         pos += 6;
+      }
+   }
+
+   bool iszero = false;
+   double* bins = AllocateHist(2, name, title, options, (nbins1+2)*(nbins2+2)+6, iszero, sparse);
    bins[0] = nbins1;
    bins[1] = left1;
    bins[2] = right1;
    bins[3] = nbins2;
    bins[4] = left2;
    bins[5] = right2;
-   for (int n=0;n<nbins1*nbins2;n++) bins[n+6] = 0.;
+   if (!iszero)
+      for (int n=0;n<(nbins1+2)*(nbins2+2);n++) bins[n+6] = 0.;
 
    return (base::H2handle) bins;
 }
@@ -342,7 +631,7 @@ void base::ProcMgr::ClearH2(base::H2handle h2)
 
    int nbin1 = (int) arr[0];
    int nbin2 = (int) arr[3];
-   for (int n=0;n<(nbin1+2)*(nbin2+2);n++) arr[6+n] = 0.;
+   ClearHistBins(arr + 6, (nbin1+2)*(nbin2+2));
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -411,6 +700,11 @@ void base::ProcMgr::UserPreLoop(Processor* only_proc, bool call_when_running)
       if (!call_when_running)
          fEvProc[n]->UserPreLoop();
    }
+
+   // processors may be created after the rules
+   for (auto rule : fTrigRules)
+      if (!rule->ResolveInputs(this))
+         printf("Not all processors found for trigger rule %s\n", rule->GetName());
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -428,6 +722,13 @@ void base::ProcMgr::UserPostLoop(Processor* only_proc)
       if (fEvProc[n]) fEvProc[n]->UserPostLoop();
    }
 
+   if (only_proc==0)
+      for (auto rule : fTrigRules)
+         rule->Print();
+
+   if ((only_proc==0) && (fDebug > 0))
+      PrintQueuesStatistic();
+
    // close store file already here
    if (only_proc==0) CloseStore();
 }
@@ -489,10 +790,13 @@ void base::ProcMgr::SetTimeSorting(bool on)
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 /// Method to provide raw data on base of data kind to the processor
+///
+/// Returns false when there is no processor for the buffer kind and board id.
+/// Buffer is never dropped by processor, but input should be paused while IsBackpressure() is true
 
-void base::ProcMgr::ProvideRawData(const Buffer& buf)
+bool base::ProcMgr::ProvideRawData(const Buffer& buf)
 {
-   if (buf.null()) return;
+   if (buf.null()) return false;
 
    if (buf().boardid >= MaxBrdId) {
       printf("Board id %u is too high - failure\n", buf().boardid);
@@ -503,11 +807,96 @@ void base::ProcMgr::ProvideRawData(const Buffer& buf)
 
    StreamProcMap::iterator it = fMap.find(index);
 
-   if (it == fMap.end()) return;
+   if (it == fMap.end()) return false;
 
    // printf("Provide new data kind %d  board %u\n", buf().kind, buf().boardid);
 
-   it->second->AddNextBuffer(buf);
+   return it->second->AddNextBuffer(buf);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Returns true when any processor signals backpressure
+///
+/// Input should be paused and ProduceNextEvent() called until backpressure is released
+/// or no more events can be produced. Buffers are never dropped, queues just grow further
+
+bool base::ProcMgr::IsBackpressure() const
+{
+   for (auto proc : fProc)
+      if (proc->IsBackpressure()) return true;
+   return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Print queues high-water marks for all processors
+
+void base::ProcMgr::PrintQueuesStatistic()
+{
+   for (auto proc : fProc) {
+      if (proc->IsRawScanOnly() && (proc->GetQueueHighWater() <= 1)) continue;
+      printf("%s queue high-water %u bufs %lu bytes, markers %u, memory %lu bytes, over limit %lu\n",
+             proc->GetName(), proc->GetQueueHighWater(), proc->GetQueueBytesHighWater(),
+             proc->GetMarksHighWater(), proc->GetQueuesMemory(), proc->GetNumOverLimitBuffers());
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Add software trigger rule, ownership is taken by manager
+///
+/// Rules are only evaluated in stream analysis. If several rules are configured,
+/// triggers produced by any of them are used
+
+void base::ProcMgr::AddTriggerRule(TriggerRule *rule)
+{
+   if (!rule) return;
+
+   fTrigRules.emplace_back(rule);
+
+   rule->ResolveInputs(this);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Deliver coincidence hits to trigger rules and evaluate them
+///
+/// New triggers are appended to the triggers queue.
+/// Returns time until which all rules were evaluated
+
+base::GlobalTime_t base::ProcMgr::ProcessTriggerRules()
+{
+   std::vector<CoincidenceHit> hits;
+   std::vector<GlobalTime_t> trigs;
+
+   for (auto proc : fProc) {
+      if (!proc->HasCoincidenceChannels()) continue;
+      hits.clear();
+      proc->CollectCoincidenceHits(hits);
+      if (hits.size() > 0)
+         for (auto rule : fTrigRules)
+            rule->AddHits(proc, hits);
+   }
+
+   GlobalTime_t scanned = 0.;
+
+   for (unsigned n = 0; n < fTrigRules.size(); n++) {
+      fTrigRules[n]->Evaluate(trigs);
+      if ((n == 0) || (fTrigRules[n]->fScannedTm < scanned))
+         scanned = fTrigRules[n]->fScannedTm;
+   }
+
+   if (trigs.size() > 1)
+      std::sort(trigs.begin(), trigs.end());
+
+   for (auto tm : trigs) {
+      // triggers must be time-ordered
+      if ((fTriggers.size() > 0) && (tm <= fTriggers.back().globaltm)) {
+         if (fDebug) printf("Ignore trigger %12.9f while older than last trigger %12.9f\n", tm, fTriggers.back().globaltm);
+         continue;
+      }
+
+      fTriggers.push(GlobalMarker(tm));
+   }
+
+   return scanned;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -541,6 +930,7 @@ int base::ProcMgr::SyncIdDiff(unsigned id1, unsigned id2) const
 
 bool base::ProcMgr::AnalyzeSyncMarkers()
 {
+   STREAM_PROFILE("AnalyzeSyncMarkers", nullptr);
 
    // in raw analysis we should not call this function
    if (IsRawAnalysis()) return false;
@@ -692,6 +1082,7 @@ skip_sync_scanning:
 
 bool base::ProcMgr::CollectNewTriggers()
 {
+   STREAM_PROFILE("CollectNewTriggers", nullptr);
 
    if (IsRawAnalysis()) return false;
 
@@ -699,6 +1090,9 @@ bool base::ProcMgr::CollectNewTriggers()
    for (unsigned n=0;n<fProc.size();n++)
       fProc[n]->CollectTriggers(fTriggers);
 
+   // evaluate software trigger rules
+   GlobalTime_t rules_tm = fTrigRules.empty() ? 0. : ProcessTriggerRules();
+
 //   printf("CollectNewTriggers\n");
 
    if (IsTriggeredAnalysis()) {
@@ -726,6 +1120,9 @@ bool base::ProcMgr::CollectNewTriggers()
          for (unsigned n=0;n<fProc.size();n++)
             if (!fProc[n]->VerifyFlushTime(flush_time)) { flush_time = 0.; break; }
 
+      // flush trigger should not be placed before potential triggers from the rules
+      if (!fTrigRules.empty() && (flush_time >= rules_tm)) flush_time = 0.;
+
       //printf("after verify %12.9f\n", flush_time*1e-9);
 
 //      flush_time = 0.;
@@ -755,12 +1152,167 @@ bool base::ProcMgr::CollectNewTriggers()
 
 bool base::ProcMgr::ScanDataForNewTriggers()
 {
+   STREAM_PROFILE("ScanDataForNewTriggers", nullptr);
+
    for (unsigned n=0;n<fProc.size();n++)
       fProc[n]->ScanDataForNewTriggers();
 
    return true;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Configure number of threads for parallel scan of processors data
+///
+/// Only processors which support it (like nXYTER or GET4 of SysCore boards) will be scanned
+/// in parallel, all other processors are scanned before in main thread.
+/// 0 or 1 disables parallel scan
+
+void base::ProcMgr::SetParallelScan(unsigned nthreads)
+{
+   if (fParallelScan == nthreads) return;
+
+   delete fScanThreads;
+   fScanThreads = nullptr;
+
+   fParallelScan = nthreads;
+
+   if (fParallelScan > 1)
+      fScanThreads = new ScanThreads(fParallelScan);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Enable/disable profiling of data processing, see base::HierProfiler
+///
+/// \param on enables profiling
+/// \param interval period in seconds to produce report, 0 - no periodic reports
+/// \param jsonfile when specified, report in JSON format written into the file
+///
+/// Text report is printed with PrintLog()
+
+void base::ProcMgr::SetProfiling(bool on, double interval, const char *jsonfile)
+{
+   fProfInterval = interval;
+   fProfJsonFile = jsonfile ? jsonfile : "";
+   HierProfiler::SetEnabled(on);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Produce profiler report, optionally reset statistic
+
+void base::ProcMgr::ProduceProfilerReport(bool reset)
+{
+   std::string rep = HierProfiler::Report();
+   PrintLog(rep.c_str());
+
+   if (!fProfJsonFile.empty()) {
+      FILE *f = fopen(fProfJsonFile.c_str(), "w");
+      if (f) {
+         std::string json = HierProfiler::Report(true);
+         fwrite(json.c_str(), 1, json.length(), f);
+         fclose(f);
+      } else {
+         printf("Fail to write profiler report to %s\n", fProfJsonFile.c_str());
+      }
+   }
+
+   if (reset)
+      HierProfiler::Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Scan new data in all processors
+///
+/// When parallel scan is enabled, first all processors which cannot be scanned in parallel
+/// (like OpticSplitter) are handled, than all others are distributed between threads
+
+void base::ProcMgr::ScanNewBuffers()
+{
+   STREAM_PROFILE("ScanNewBuffers", nullptr);
+
+   if (!fScanThreads) {
+      for (unsigned n=0;n<fProc.size();n++)
+         fProc[n]->ScanNewBuffers();
+      return;
+   }
+
+   fParallelProcs.clear();
+
+   for (unsigned n=0;n<fProc.size();n++)
+      if (!fProc[n]->CanParallelScan())
+         fProc[n]->ScanNewBuffers();
+      else if (fProc[n]->HasNewBuffers())
+         fParallelProcs.emplace_back(fProc[n]);
+      else
+         fProc[n]->ScanNewBuffers();
+
+   if (fParallelProcs.size() > 1)
+      fScanThreads->Scan(fParallelProcs);
+   else if (fParallelProcs.size() == 1)
+      fParallelProcs[0]->ScanNewBuffers();
+
+   for (auto proc : fParallelProcs)
+      proc->AfterParallelScan();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Request snapshot of histograms, can be called from any thread
+///
+/// Copy will be produced by the event loop at the next event boundary,
+/// see base::HistSnapshot::IsReady(). Only internal histogram format is supported.
+/// Returns false when snapshot is already pending or cannot be produced
+
+bool base::ProcMgr::RequestSnapshot(HistSnapshot *snap)
+{
+   if (!snap || !InternalHistFormat() || snap->IsPending()) return false;
+
+   std::lock_guard<std::mutex> lock(fSnapshots->fMutex);
+   snap->fPending.store(true, std::memory_order_release);
+   fSnapshots->fRequests.emplace_back(snap);
+   fSnapshots->fNumRequests.store(fSnapshots->fRequests.size(), std::memory_order_release);
+   return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Cancel pending snapshot request
+///
+/// After method returns, event loop will not access snapshot any longer and it can be destroyed
+
+void base::ProcMgr::CancelSnapshot(HistSnapshot *snap)
+{
+   if (!snap) return;
+
+   std::lock_guard<std::mutex> lock(fSnapshots->fMutex);
+   auto &reqs = fSnapshots->fRequests;
+   auto iter = std::find(reqs.begin(), reqs.end(), snap);
+   if (iter != reqs.end()) {
+      reqs.erase(iter);
+      snap->fPending.store(false, std::memory_order_release);
+   }
+   fSnapshots->fNumRequests.store(reqs.size(), std::memory_order_release);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+/// Produce requested histograms snapshots
+///
+/// Called at the event boundary - when previous event is completely processed and
+/// histograms are not modified. Invoked automatically from AnalyzeNewData() and ProduceNextEvent(),
+/// but can be used in other event loops. When requests queue is locked by consumer,
+/// snapshots will be produced at the next call.
+
+void base::ProcMgr::ProcessSnapshots()
+{
+   if (fSnapshots->fNumRequests.load(std::memory_order_acquire) == 0) return;
+
+   std::unique_lock<std::mutex> lock(fSnapshots->fMutex, std::try_to_lock);
+   if (!lock.owns_lock()) return;
+
+   for (auto snap : fSnapshots->fRequests)
+      snap->Produce();
+
+   fSnapshots->fRequests.clear();
+   fSnapshots->fNumRequests.store(0, std::memory_order_release);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 /// Analyze new data, if triggered analysis configured - immediately produce new event
 
@@ -769,6 +1321,14 @@ bool base::ProcMgr::AnalyzeNewData(base::Event* &evt)
    // scan raw data
    // if triggered analysis configured, fill event at the same time
 
+   // previous event is processed, histograms are consistent
+   ProcessSnapshots();
+
+   if (fShmHists) fShmHists->MarkUpdate();
+
+   if ((fProfInterval > 0) && HierProfiler::IsEnabled() && (HierProfiler::GetMeasuredTime() >= fProfInterval))
+      ProduceProfilerReport(true);
+
    if (IsTriggeredAnalysis()) {
       if (evt==0)
          evt = new base::Event;
@@ -779,8 +1339,7 @@ bool base::ProcMgr::AnalyzeNewData(base::Event* &evt)
    }
 
    // scan new data in the processors
-   for (unsigned n=0;n<fProc.size();n++)
-      fProc[n]->ScanNewBuffers();
+   ScanNewBuffers();
 
    if (IsRawAnalysis()) return false;
 
@@ -828,8 +1387,12 @@ bool base::ProcMgr::AddToTrigEvent(const std::string& name, base::SubEvent* sub)
 
 bool base::ProcMgr::ProduceNextEvent(base::Event* &evt)
 {
+   ProcessSnapshots();
+
    if (!IsStreamAnalysis()) return false;
 
+   STREAM_PROFILE("ProduceNextEvent", nullptr);
+
    unsigned numready = fTriggers.size();
 
    for (unsigned n=0;n<fProc.size();n++) {
@@ -880,20 +1443,28 @@ bool base::ProcMgr::ProcessEvent(base::Event* evt)
 {
    if (!evt) return false;
 
+   STREAM_PROFILE("ProcessEvent", nullptr);
+
    // call event processors one after another until event is discarded
-   for (unsigned n=0;n<fEvProc.size();n++)
+   for (unsigned n=0;n<fEvProc.size();n++) {
+      STREAM_PROFILE("Process", fEvProc[n]);
       if (!fEvProc[n]->Process(evt))
          return false;
+   }
 
    bool isanystore = false;
 
    for (unsigned n=0;n<fProc.size();n++)
       if (fProc[n]->IsStoreEnabled()) {
+         STREAM_PROFILE("Store", fProc[n]);
          fProc[n]->Store(evt);
          isanystore = true;
       }
 
-   StoreEvent();
+   {
+      STREAM_PROFILE("StoreEvent", nullptr);
+      StoreEvent();
+   }
 
    if (isanystore) {
       for (unsigned n=0;n<fProc.size();n++)
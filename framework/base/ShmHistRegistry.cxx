@@ -0,0 +1,196 @@
+#include "base/ShmHistRegistry.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+///////////////////////////////////////////////////////////////////////////
+/// destructor
+
+base::ShmHistRegistry::~ShmHistRegistry()
+{
+   Close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Create shared memory segment of specified size
+///
+/// Segment with the same name will be replaced.
+/// Directory for maxhists histograms is reserved at the segment begin.
+/// When isfile specified, normal file with such name is created
+
+bool base::ShmHistRegistry::Create(const char *name, uint64_t size, unsigned maxhists, bool isfile)
+{
+   Close();
+
+   if (!name || !*name) return false;
+
+   uint64_t dirsize = sizeof(Header) + maxhists * sizeof(Entry);
+   if (size <= dirsize) {
+      printf("ShmHistRegistry: segment size %lu too small for %u histograms\n", (long unsigned) size, maxhists);
+      return false;
+   }
+
+   if (!isfile) shm_unlink(name);
+
+   int fd = isfile ? open(name, O_CREAT | O_RDWR | O_TRUNC, 0644) : shm_open(name, O_CREAT | O_RDWR | O_EXCL, 0644);
+   if (fd < 0) {
+      printf("ShmHistRegistry: fail to create %s\n", name);
+      return false;
+   }
+
+   if (ftruncate(fd, size) != 0) {
+      printf("ShmHistRegistry: fail to resize %s to %lu bytes\n", name, (long unsigned) size);
+      close(fd);
+      if (isfile) unlink(name); else shm_unlink(name);
+      return false;
+   }
+
+   void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+
+   if (mem == MAP_FAILED) {
+      printf("ShmHistRegistry: fail to map %s\n", name);
+      if (isfile) unlink(name); else shm_unlink(name);
+      return false;
+   }
+
+   fName = name;
+   fMem = (char *) mem;
+   fSize = size;
+   fOwner = true;
+   fIsFile = isfile;
+
+   Header *h = new (fMem) Header;
+   h->format = 1;
+   h->maxhists = maxhists;
+   h->segsize = size;
+   // data area aligned to 64 bytes
+   h->used = (dirsize + 63) & ~((uint64_t) 63);
+   h->numhists.store(0);
+   h->updatecnt.store(0);
+   memcpy(h->magic, "STRMHIST", 8); // magic set last, reader checks it
+
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Attach existing shared memory segment or file read-only
+
+bool base::ShmHistRegistry::Attach(const char *name, bool isfile)
+{
+   Close();
+
+   if (!name || !*name) return false;
+
+   int fd = isfile ? open(name, O_RDONLY) : shm_open(name, O_RDONLY, 0);
+   if (fd < 0) return false;
+
+   struct stat st;
+   if ((fstat(fd, &st) != 0) || ((uint64_t) st.st_size < sizeof(Header))) {
+      close(fd);
+      return false;
+   }
+
+   void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+
+   if (mem == MAP_FAILED) return false;
+
+   fName = name;
+   fMem = (char *) mem;
+   fSize = st.st_size;
+   fOwner = false;
+   fIsFile = isfile;
+
+   if ((memcmp(hdr()->magic, "STRMHIST", 8) != 0) || (hdr()->format != 1) || (hdr()->segsize != fSize)) {
+      printf("ShmHistRegistry: %s is not histograms segment\n", name);
+      Close();
+      return false;
+   }
+
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Unmap segment, owner also removes segment name
+///
+/// File is truncated to the used size and never removed
+
+void base::ShmHistRegistry::Close()
+{
+   uint64_t used = 0;
+
+   if (fMem && fOwner && fIsFile) {
+      used = hdr()->used;
+      hdr()->segsize = used;
+   }
+
+   if (fMem)
+      munmap(fMem, fSize);
+
+   if (fOwner && fIsFile) {
+      if (truncate(fName.c_str(), used) != 0)
+         printf("ShmHistRegistry: fail to truncate %s\n", fName.c_str());
+   } else if (fOwner && fUnlink && !fName.empty()) {
+      shm_unlink(fName.c_str());
+   }
+
+   fMem = nullptr;
+   fSize = 0;
+   fOwner = false;
+   fIsFile = false;
+   fName.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Allocate histogram array of specified size (in doubles) and publish it in directory
+///
+/// Returns nullptr when segment or directory is full
+
+double *base::ShmHistRegistry::Allocate(unsigned kind, const char *name, const char *title, const char *options, uint64_t size)
+{
+   if (!fMem || !fOwner) return nullptr;
+
+   Header *h = hdr();
+
+   unsigned n = h->numhists.load(std::memory_order_relaxed);
+   uint64_t nbytes = (size * sizeof(double) + 63) & ~((uint64_t) 63);
+
+   if ((n >= h->maxhists) || (h->used + nbytes > fSize)) return nullptr;
+
+   Entry *e = entry(n);
+   memset(e, 0, sizeof(Entry));
+   if (name) strncpy(e->name, name, NameLength - 1);
+   if (title) strncpy(e->title, title, NameLength - 1);
+   if (options) strncpy(e->options, options, NameLength - 1);
+   e->kind = kind;
+   e->offset = h->used;
+   e->size = size;
+
+   h->used += nbytes;
+
+   // entry becomes visible for readers only after it is completely filled
+   h->numhists.store(n + 1, std::memory_order_release);
+
+   return (double *) (fMem + e->offset);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Find histogram by name, returns -1 when not found
+
+int base::ShmHistRegistry::FindHist(const char *name) const
+{
+   if (!name) return -1;
+
+   unsigned num = NumHists();
+   for (unsigned n = 0; n < num; n++)
+      if (strncmp(entry(n)->name, name, NameLength) == 0)
+         return n;
+
+   return -1;
+}
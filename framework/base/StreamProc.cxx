@@ -6,9 +6,12 @@
 
 #include "base/ProcMgr.h"
 #include "base/Event.h"
+#include "base/HierProfiler.h"
 
 unsigned base::StreamProc::fMarksQueueCapacity = 10000;
 unsigned base::StreamProc::fBufsQueueCapacity = 100;
+unsigned base::StreamProc::fMarksQueueLimit = 1000000;
+unsigned long base::StreamProc::fQueueMemoryLimit = 512*1024*1024;
 
 ////////////////////////////////////////////////////////////////////////////////////////////
 /// constructor
@@ -31,7 +34,10 @@ base::StreamProc::StreamProc(const char* name, unsigned brdid, bool basehist) :
    fTimeSorting(false),
    fTriggerTm(0),
    fMultipl(0),
-   fTriggerWindow(0)
+   fTriggerWindow(0),
+   fCoincChannels(),
+   fCoincHits(1000),
+   fCoincReadyTm(0.)
 {
    fMgr = base::ProcMgr::AddProc(this);
 
@@ -46,6 +52,7 @@ base::StreamProc::~StreamProc()
    fSyncs.clear();
    fQueue.clear();
    fLocalMarks.clear();
+   fCoincHits.clear();
    // TODO: cleanup of event data
    fGlobalMarks.clear();
 }
@@ -186,13 +193,66 @@ bool base::StreamProc::AddNextBuffer(const Buffer& buf)
 {
    // printf("%4s Add buffer queue size %u\n", GetName(), fQueue.size());
 
-   if (fQueue.full()) printf("%s queue if full size %u\n", GetName(), fQueue.size());
-
+   // buffer is never dropped - queue is expanded and backpressure signals that input should be paused
    fQueue.push(buf);
+   fQueueBytes += buf.datalen();
+
+   if (fQueueBytes > fQueueMemoryLimit) {
+      if (fNumOverLimitBufs++ == 0)
+         printf("%s queue exceeds memory limit %lu with %u buffers - input is not paused or events cannot be produced\n", GetName(), fQueueMemoryLimit, fQueue.size());
+   }
+
+   UpdateQueueStat();
 
    return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////
+/// Update high-water marks and backpressure flag
+///
+/// Backpressure is signaled when buffers queue takes more than 75% of memory limit
+/// or markers queue reach 75% of its limit. It is released when both are below 50%
+
+void base::StreamProc::UpdateQueueStat()
+{
+   if (fQueue.size() > fQueueHighWater) fQueueHighWater = fQueue.size();
+   if (fQueueBytes > fQueueBytesHighWater) fQueueBytesHighWater = fQueueBytes;
+
+   unsigned nmarks = fSyncs.size();
+   if (fLocalMarks.size() > nmarks) nmarks = fLocalMarks.size();
+   if (fGlobalMarks.size() > nmarks) nmarks = fGlobalMarks.size();
+   if (nmarks > fMarksHighWater) fMarksHighWater = nmarks;
+
+   if (fBackpressure)
+      fBackpressure = (fQueueBytes > fQueueMemoryLimit/2) || (nmarks > fMarksQueueLimit/2);
+   else
+      fBackpressure = (fQueueBytes > fQueueMemoryLimit/4*3) || (nmarks > fMarksQueueLimit/4*3);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+/// Returns memory used by all queues of processor
+
+unsigned long base::StreamProc::GetQueuesMemory() const
+{
+   return fQueueBytes + fQueue.capacity()*sizeof(base::Buffer) +
+          fSyncs.capacity()*sizeof(base::SyncMarker) +
+          fLocalMarks.capacity()*sizeof(base::LocalTimeMarker) +
+          fGlobalMarks.capacity()*sizeof(base::GlobalMarker) +
+          fCoincHits.capacity()*sizeof(base::LocalTimeMarker);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+/// Reset high-water marks of the queues
+
+void base::StreamProc::ResetHighWaterMarks()
+{
+   fQueueHighWater = fQueue.size();
+   fQueueBytesHighWater = fQueueBytes;
+   fMarksHighWater = 0;
+   fNumOverLimitBufs = 0;
+   UpdateQueueStat();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 /// scan new buffers
 
@@ -202,11 +262,13 @@ bool base::StreamProc::ScanNewBuffers()
 
    while (fQueueScanIndex < fQueue.size()) {
       base::Buffer& buf = fQueue.item(fQueueScanIndex);
+      STREAM_PROFILE("FirstBufferScan", this);
       // if first scan failed, release buffer
       // TODO: probably, one could remove buffer immediately
-      if (!FirstBufferScan(buf))
+      if (!FirstBufferScan(buf)) {
+         fQueueBytes = (fQueueBytes > buf.datalen()) ? fQueueBytes - buf.datalen() : 0;
          buf.reset();
-      else
+      } else
          isany = true;
       fQueueScanIndex++;
    }
@@ -315,6 +377,8 @@ void base::StreamProc::AddSyncMarker(base::SyncMarker& marker)
    marker.globaltm = 0.;
    marker.bufid = fQueueScanIndex;
    fSyncs.push(marker);
+
+   UpdateQueueStat();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -341,13 +405,10 @@ bool base::StreamProc::AddTriggerMarker(LocalTimeMarker& marker, double tm_range
       }
    }
 
-   if (fLocalMarks.full()) {
-      printf("Local markers queue is full in processor %s\n", GetName());
-      exit(7);
-   }
-
    fLocalMarks.push(marker);
 
+   UpdateQueueStat();
+
 //   printf("Add trigger %12.9f\n", marker.localtm);
 
    // keep time of last trigger
@@ -356,6 +417,72 @@ bool base::StreamProc::AddTriggerMarker(LocalTimeMarker& marker, double tm_range
    return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////
+/// enable channel as input for trigger rules
+
+void base::StreamProc::EnableCoincidenceChannel(unsigned chid)
+{
+   if (chid >= fCoincChannels.size())
+      fCoincChannels.resize(chid+1, false);
+   fCoincChannels[chid] = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+/// add hit of coincidence channel
+///
+/// Hits should be provided in first buffer scan in local time,
+/// they will be converted to global time and delivered to trigger rules
+
+void base::StreamProc::AddCoincidenceHit(unsigned chid, GlobalTime_t localtm)
+{
+   // trigger rules used only in stream analysis
+   if (!IsStreamAnalysis()) return;
+
+   LocalTimeMarker marker;
+   marker.localid = chid;
+   marker.localtm = localtm;
+
+   if (fCoincHits.full()) fCoincHits.Expand();
+
+   fCoincHits.push(marker);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+/// collect coincidence hits
+///
+/// Converts hits to global time where it is possible.
+/// Also defines time until which processor delivered all hits
+
+bool base::StreamProc::CollectCoincidenceHits(std::vector<CoincidenceHit> &hits)
+{
+   unsigned syncindx(0); // index used to help convert global to local time
+
+   while (fCoincHits.size() > 0) {
+
+      GlobalTime_t globaltm = LocalToGlobalTime(fCoincHits.front().localtm, &syncindx);
+
+      // same rules as for normal trigger markers
+      if ((fSynchronisationKind == sync_Inter) && (syncindx == numReadySyncs())) break;
+
+      if ((fSynchronisationKind == sync_Left) && (syncindx == numReadySyncs()-1)) break;
+
+      hits.emplace_back(globaltm, fCoincHits.front().localid);
+
+      fCoincHits.pop();
+   }
+
+   // last buffer with assigned time defines ready time, all hits before are delivered
+   for (unsigned n = fQueueScanIndexTm; n > 0; n--) {
+      base::Buffer& buf = fQueue.item(n-1);
+      if (buf.null()) continue;
+      GlobalTime_t tm = buf().global_tm - MaximumDisorderTm();
+      if (tm > fCoincReadyTm) fCoincReadyTm = tm;
+      break;
+   }
+
+   return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 /// find sync marker
 
@@ -404,6 +531,13 @@ bool base::StreamProc::SkipBuffers(unsigned num_skip)
 
    if (num_skip==0) return false;
 
+   if (num_skip == fQueue.size()) {
+      fQueueBytes = 0;
+   } else {
+      for (unsigned n = 0; n < num_skip; n++)
+         fQueueBytes = (fQueueBytes > fQueue.item(n).datalen()) ? fQueueBytes - fQueue.item(n).datalen() : 0;
+   }
+
    fQueue.pop_items(num_skip);
 
    // erase all syncs wich are reference to skipped buffers except one
@@ -449,6 +583,8 @@ bool base::StreamProc::SkipBuffers(unsigned num_skip)
       }
    }
 
+   UpdateQueueStat();
+
    return true;
 }
 
@@ -463,9 +599,12 @@ void base::StreamProc::SkipAllData()
 
    fLocalMarks.clear();
    fGlobalMarks.clear();
+   fCoincHits.clear();
 
    fSyncs.clear();
    fSyncScanIndex = 0;
+
+   UpdateQueueStat();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -538,6 +677,8 @@ bool base::StreamProc::DistributeTriggers(const base::GlobalMarksQueue& queue)
 //         printf("%s trigger %12.9f %12.9f\n", GetName(), fGlobalMarks.back().lefttm, fGlobalTrig.back().righttm);
    }
 
+   UpdateQueueStat();
+
 //   printf("%s triggers after append new items\n", GetName());
 //   for (unsigned n=0;n<fGlobalMarks.size();n++)
 //      printf("TRIG %u %12.9f\n", n, fGlobalMarks.item(n).globaltm*1e-9);
@@ -784,8 +925,10 @@ bool base::StreamProc::ScanDataForNewTriggers()
 
       Buffer& buf = fQueue.item(nbuf);
 
-      if (!buf.null())
+      if (!buf.null()) {
+         STREAM_PROFILE("SecondBufferScan", this);
          SecondBufferScan(buf);
+      }
    }
 
    // at the end all these buffer can be skipped from the queue
@@ -20,7 +20,8 @@ base::SysCoreProc::SysCoreProc(const char* name, unsigned brdid, OpticSplitter*
    fPrintRight(-1.),
    fAnyPrinted(false),
    fSplitBuf(),
-   fSplitPtr(0)
+   fSplitPtr(0),
+   fSplitCnt(0)
 {
    if (spl!=0) spl->AddSub(this, brdid);
 
@@ -56,6 +57,29 @@ void base::SysCoreProc::CreateBasicHistograms()
    fSYNCt[1] = MakeH1("SYNC1_t", "Time distribution of SYNC1 signal", 10000, 0., 1000., "s");
 }
 
+///////////////////////////////////////////////////////////////////////////
+/// fill messages counter into common histogram
+/// during parallel scan only counter is incremented, histogram filled afterwards
+
+void base::SysCoreProc::FillMsgPerBrdHist(unsigned cnt)
+{
+   if (mgr()->GetParallelScan() > 1)
+      fMsgPerBrdCnt += cnt;
+   else
+      FillH1(fMsgPerBrd, GetID(), cnt);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// fill common histograms, which cannot be filled during parallel scan
+
+void base::SysCoreProc::AfterParallelScan()
+{
+   if (fMsgPerBrdCnt > 0) {
+      FillH1(fMsgPerBrd, GetID(), fMsgPerBrdCnt);
+      fMsgPerBrdCnt = 0;
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 /// check print
 
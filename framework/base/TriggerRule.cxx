@@ -0,0 +1,202 @@
+#include "base/TriggerRule.h"
+
+#include <cstdio>
+#include <algorithm>
+
+#include "base/ProcMgr.h"
+#include "base/StreamProc.h"
+
+///////////////////////////////////////////////////////////////////////////
+/// constructor
+
+base::TriggerRule::TriggerRule(const char *name, GlobalTime_t window) :
+   fName(name ? name : "Trigger"),
+   fWindow(window)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Add input channel of specified processor, returns index of the input
+
+unsigned base::TriggerRule::AddInput(const char *procname, unsigned chid)
+{
+   Input inp;
+   inp.procname = procname ? procname : "";
+   inp.chid = chid;
+   fInputs.emplace_back(inp);
+   fCounts.resize(fInputs.size(), 0);
+   return fInputs.size() - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Add veto channel of specified processor, returns index of the input
+
+unsigned base::TriggerRule::AddVeto(const char *procname, unsigned chid)
+{
+   unsigned indx = AddInput(procname, chid);
+   fInputs[indx].isveto = true;
+   return indx;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns number of configured inputs (without vetoes)
+
+unsigned base::TriggerRule::NumInputs() const
+{
+   unsigned cnt = 0;
+   for (auto &inp : fInputs)
+      if (!inp.isveto) cnt++;
+   return cnt;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Find processors for all inputs and enable coincidence channels there
+/// Returns true when all inputs are resolved
+
+bool base::TriggerRule::ResolveInputs(ProcMgr *mgr)
+{
+   bool res = true;
+
+   for (auto &inp : fInputs) {
+      if (inp.proc) continue;
+      inp.proc = mgr ? mgr->FindProc(inp.procname.c_str()) : nullptr;
+      if (inp.proc)
+         inp.proc->EnableCoincidenceChannel(inp.chid);
+      else
+         res = false;
+   }
+
+   return res;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Add hits, delivered by processor
+/// Hits from single processor are expected to be (almost) time-sorted
+
+void base::TriggerRule::AddHits(StreamProc *proc, const std::vector<CoincidenceHit> &hits)
+{
+   unsigned oldsize = fHits.size(), oldveto = fVetoHits.size();
+
+   for (unsigned n = 0; n < fInputs.size(); n++) {
+      Input &inp = fInputs[n];
+      if (inp.proc != proc) continue;
+
+      for (auto &hit : hits) {
+         // hits which come too late can not be evaluated any longer
+         if ((hit.localid != inp.chid) || (hit.globaltm < fScannedTm)) continue;
+
+         if (inp.isveto)
+            fVetoHits.emplace_back(hit.globaltm);
+         else
+            fHits.emplace_back(hit.globaltm, n);
+      }
+   }
+
+   if (fHits.size() > oldsize) {
+      std::sort(fHits.begin() + oldsize, fHits.end());
+      std::inplace_merge(fHits.begin(), fHits.begin() + oldsize, fHits.end());
+   }
+
+   if (fVetoHits.size() > oldveto) {
+      std::sort(fVetoHits.begin() + oldveto, fVetoHits.end());
+      std::inplace_merge(fVetoHits.begin(), fVetoHits.begin() + oldveto, fVetoHits.end());
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns time until which all involved processors delivered their hits
+
+base::GlobalTime_t base::TriggerRule::ReadyTime() const
+{
+   GlobalTime_t res = 0.;
+   bool first = true;
+
+   for (auto &inp : fInputs) {
+      if (!inp.proc) return 0.;
+      GlobalTime_t tm = inp.proc->GetCoincidenceReadyTime();
+      if (first || (tm < res)) res = tm;
+      first = false;
+   }
+
+   return res;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns true when any veto hit exists in specified interval
+
+bool base::TriggerRule::IsVetoed(GlobalTime_t left, GlobalTime_t right) const
+{
+   auto iter = std::lower_bound(fVetoHits.begin(), fVetoHits.end(), left);
+   return (iter != fVetoHits.end()) && (*iter <= right);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Evaluate rule with sliding window over time-sorted hits
+///
+/// Window is opened by each hit and includes all hits up to fWindow later.
+/// Only windows, which are completely covered by delivered data, are evaluated.
+/// Times of new triggers are appended to the vector, returns number of new triggers
+
+unsigned base::TriggerRule::Evaluate(std::vector<GlobalTime_t> &triggers)
+{
+   GlobalTime_t ready = ReadyTime();
+
+   if (ready <= 0.) return 0;
+
+   GlobalTime_t limit = ready - fWindow - fVetoMargin,
+                deadtime = (fDeadTime < 0.) ? fWindow : fDeadTime;
+
+   unsigned mininputs = fMinInputs > 0 ? fMinInputs : 1,
+            head = 0, tail = 0, nactive = 0, multipl = 0, cnt = 0;
+
+   std::fill(fCounts.begin(), fCounts.end(), 0);
+
+   while ((head < fHits.size()) && (fHits[head].tm < limit)) {
+      GlobalTime_t start = fHits[head].tm;
+
+      // extend window to the right
+      while ((tail < fHits.size()) && (fHits[tail].tm <= start + fWindow)) {
+         if (fCounts[fHits[tail].indx]++ == 0) nactive++;
+         multipl++;
+         tail++;
+      }
+
+      if ((nactive >= mininputs) && (multipl >= fMinMultipl) &&
+          ((fNumTriggers == 0) || (start - fLastTriggerTm > deadtime))) {
+         if (IsVetoed(start - fVetoMargin, start + fWindow + fVetoMargin)) {
+            fNumVetoed++;
+         } else {
+            triggers.emplace_back(start);
+            fLastTriggerTm = start;
+            fNumTriggers++;
+            cnt++;
+         }
+      }
+
+      // remove first hit from the window
+      if (--fCounts[fHits[head].indx] == 0) nactive--;
+      multipl--;
+      head++;
+   }
+
+   if (head > 0)
+      fHits.erase(fHits.begin(), fHits.begin() + head);
+
+   if (limit > fScannedTm) fScannedTm = limit;
+
+   // veto hits are not required any longer
+   auto iter = std::lower_bound(fVetoHits.begin(), fVetoHits.end(), fScannedTm - fVetoMargin);
+   fVetoHits.erase(fVetoHits.begin(), iter);
+
+   return cnt;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Print rule configuration and statistic
+
+void base::TriggerRule::Print() const
+{
+   printf("TriggerRule %s window %g inputs %u of %u multipl %u vetoes %u triggers %lu vetoed %lu\n",
+          GetName(), fWindow, fMinInputs, NumInputs(), fMinMultipl, (unsigned) fInputs.size() - NumInputs(),
+          fNumTriggers, fNumVetoed);
+}
@@ -5,6 +5,7 @@
 #include <cmath>
 
 #include "base/ProcMgr.h"
+#include "base/HierProfiler.h"
 
 
 get4::MbsProcessor::MbsProcessor(unsigned get4mask, bool is32bit, unsigned totmult) :
@@ -106,20 +107,20 @@ bool get4::MbsProcessor::AddRef(unsigned g2, unsigned ch2, bool r2,
 }
 
 
-bool get4::MbsProcessor::FirstBufferScan(const base::Buffer& buf)
-{
-   if (buf.null()) return false;
+/** Batched decoding of buffer.
+  * Hits are collected into per-channel arrays with epoch-extended stamps,
+  * only errors statistic is filled immediately */
 
+bool get4::MbsProcessor::DecodeBuffer(const base::Buffer& buf)
+{
    uint32_t* arr = (uint32_t*) buf.ptr();
 
    unsigned arrlen = buf.datalen() / 4;
    unsigned get4id = 0xffff;
-   unsigned epoch(0);
-
-   // printf("analyze buffer %u\n", arrlen);
+   uint64_t epoch(0);
 
    for (unsigned n=0;n<GET4.size();n++)
-      GET4[n].clearTimes();
+      GET4[n].clearHits();
 
    for (unsigned cnt=0; cnt < arrlen; cnt++) {
 
@@ -145,36 +146,21 @@ bool get4::MbsProcessor::FirstBufferScan(const base::Buffer& buf)
          return false;
       }
 
-      FillH1(fMsgPerGet4, get4id);
-
       Get4MbsRec& rec = GET4[get4id];
+      rec.nmsgs++;
       if (!rec.used) continue;
 
-      // printf("analyze message 0x%08x\n", msg);
-
-
       unsigned msgid = fIs32mode ? ((msg >> 30) & 0x3) | 0x10 : (msg >> 22) & 0x3;
 
       switch (msgid) {
-         case 0x0: { // epoch 24 bit
-            epoch = (msg >> 1) & 0x1fffff;  // 21 bit
-            //printf("epoch: %u\n", epoch);
+         case 0x0:   // epoch 24 bit, 21 bit value
+            epoch = (msg >> 1) & 0x1fffff;
             break;
-         }
-         case 0x10: { // epoch 32 bit
-            epoch = (msg >> 1) & 0xffffff;  // 24 bit
-            //printf("epoch: %u\n", epoch);
+         case 0x10:  // epoch 32 bit, 24 bit value
+            epoch = (msg >> 1) & 0xffffff;
             break;
-         }
-         case 0x11: {  // slow control 32 bit mode
-
-            //unsigned chid  = (msg >> 27) & 0x3;
-            //unsigned edge  = (msg >> 26) & 0x1; // 0 - rising, 1 - falling
-            //unsigned typ   = (msg >> 24) & 0x3;
-            //unsigned data  = msg  & 0xffffff;
-
+         case 0x11:  // slow control 32 bit mode
             break;
-         }
          case 0x02:   // error 24 bit
          case 0x12: { // error 32 bit
             FillH1(fErrPerGet4, get4id);
@@ -183,106 +169,134 @@ bool get4::MbsProcessor::FirstBufferScan(const base::Buffer& buf)
             FillH1(rec.fErrors, errid);
             break;
          }
-         case 0x03: { // hit  24 bit
-            unsigned chid = (msg >> 20) & 0x3;
-            unsigned edge = (msg >> 19) & 0x1; // 0 - rising, 1 - falling
-            unsigned fine = msg & 0x7f;
-            unsigned stamp = msg & 0x7ffff;
+         case 0x03:  // hit  24 bit, edge bit 0 - rising, 1 - falling
+            rec.CH[(msg >> 20) & 0x3].hits.emplace_back(epoch ? (epoch << 19) | (msg & 0x7ffff) : 0,
+                                                        msg & 0x7f, 0, ((msg >> 19) & 0x1) == 0);
+            break;
+         case 0x13:  // hit  32 bit
+            rec.CH[(msg >> 27) & 0x3].hits.emplace_back(epoch ? (epoch << 19) | ((msg >> 8) & 0x7ffff) : 0,
+                                                        (msg >> 8) & 0x7f, msg & 0xff, true);
+            break;
+         default:
+            printf("get wrong get4 message type 0x%02x - abort\n", msgid);
+            return false;
+      }
+   }
 
-            bool rising = (edge==0);
+   return true;
+}
 
-            Get4MbsChRec& chrec = rec.CH[chid];
+/** Account fine counters statistic and calculate hits times */
 
-            //printf("ch: %u %s stamp %5u\n", chid, (rising ? "R" : "F"), stamp);
+void get4::MbsProcessor::CalibrateHits()
+{
+   for (auto &rec : GET4) {
+      if (!rec.used) continue;
+      for (unsigned ch=0;ch<NumGet4Channels;ch++) {
+         Get4MbsChRec& chrec = rec.CH[ch];
 
-            FillH1(rec.fChannels, chid*2+edge);
-            FillH1(rising ? chrec.fRisFineTm : chrec.fFalFineTm, fine);
+         if (fIs32mode) {
+            for (auto &hit : chrec.hits) {
+               chrec.rising_stat[hit.fine]++;
+               chrec.falling_stat[(hit.fine + hit.tot*fTotMult) % FineCounterBins]++;
+            }
+         } else {
+            for (auto &hit : chrec.hits)
+               (hit.rising ? chrec.rising_stat : chrec.falling_stat)[hit.fine]++;
+         }
 
-            if (rising) chrec.rising_stat[fine]++;
-                   else chrec.falling_stat[fine]++;
+         if (fUseCalibr) {
+            for (auto &hit : chrec.hits)
+               hit.tm = 1.*BinWidthPs*(hit.stamp & 0xffffffffffff80LLU) +
+                        ((hit.rising || fIs32mode) ? chrec.rising_calibr : chrec.falling_calibr)[hit.fine];
+         } else {
+            for (auto &hit : chrec.hits)
+               hit.tm = 1.*BinWidthPs*hit.stamp;
+         }
+      }
+   }
+}
 
-            // ignore hits without epoch
-            if (epoch==0) continue;
+/** Fill histograms for decoded hits, find first and last hits times */
 
-            uint64_t fullstamp = (((uint64_t) epoch) << 19) | stamp;
+void get4::MbsProcessor::FillHitsHistograms()
+{
+   for (unsigned get4id=0;get4id<GET4.size();get4id++) {
+      Get4MbsRec& rec = GET4[get4id];
 
-            double fulltm = 1.*BinWidthPs*fullstamp;
+      if (rec.nmsgs > 0) FillH1(fMsgPerGet4, get4id, rec.nmsgs);
 
-            if (fUseCalibr) {
-               fulltm = 1.*BinWidthPs*(fullstamp & 0xffffffffffff80LLU);
-               if (rising) fulltm += chrec.rising_calibr[fine];
-                      else fulltm += chrec.falling_calibr[fine];
-            }
+      rec.clearTimes();
+
+      if (!rec.used) continue;
+
+      for (unsigned ch=0;ch<NumGet4Channels;ch++) {
+         Get4MbsChRec& chrec = rec.CH[ch];
 
-            if (rising) {
-               chrec.lastr = fulltm;
-               if (chrec.firstr==0) chrec.firstr = fulltm;
+         for (auto &hit : chrec.hits) {
+            if (fIs32mode) {
+               FillH1(rec.fChannels, ch);
+               FillH1(chrec.fRisFineTm, hit.fine);
+               FillH1(chrec.fFalFineTm, (hit.fine + hit.tot*fTotMult) % FineCounterBins);
             } else {
-               chrec.lastf = fulltm;
-               if (chrec.firstf==0) chrec.firstf = fulltm;
+               FillH1(rec.fChannels, ch*2 + (hit.rising ? 0 : 1));
+               FillH1(hit.rising ? chrec.fRisFineTm : chrec.fFalFineTm, hit.fine);
+            }
 
+            // ignore hits without epoch
+            if (hit.stamp == 0) continue;
+
+            if (fIs32mode) {
+               chrec.lastr = hit.tm;
+               chrec.lastf = chrec.lastr + 1.*BinWidthPs*hit.tot*fTotMult;
+               if (chrec.firstr==0) chrec.firstr = chrec.lastr;
+               if (chrec.firstf==0) chrec.firstf = chrec.lastf;
+               FillH1(chrec.fTotTm, chrec.lastf - chrec.lastr);
+            } else if (hit.rising) {
+               chrec.lastr = hit.tm;
+               if (chrec.firstr==0) chrec.firstr = hit.tm;
+            } else {
+               chrec.lastf = hit.tm;
+               if (chrec.firstf==0) chrec.firstf = hit.tm;
                if (chrec.lastr!=0)
                   FillH1(chrec.fTotTm, chrec.lastf - chrec.lastr);
-
-               // printf("ch%u f:%8lu r:%8lu diff:%8f\n", chid, rec.lastf[chid], rec.lastr[chid], 0. + rec.lastf[chid] - rec.lastr[chid]);
             }
-
-            break;
          }
-         case 0x13: { // hit  32 bit
-            unsigned chid = (msg >> 27) & 0x3;
-            // unsigned dll = (msg >> 29) & 0x1; // is dll locked
-            unsigned fine = (msg >> 8) & 0x7f;
-            unsigned stamp = (msg >> 8) & 0x7ffff;
-            unsigned tot = msg & 0xff;
-
-            //printf("ch: %u %s stamp %5u\n", chid, (rising ? "R" : "F"), stamp);
-
-            FillH1(rec.fChannels, chid);
-
-            Get4MbsChRec& chrec = rec.CH[chid];
-
-            FillH1(chrec.fRisFineTm, fine);
-            FillH1(chrec.fFalFineTm, (fine + tot*fTotMult) % FineCounterBins);
-
-            chrec.rising_stat[fine]++;
-            chrec.falling_stat[(fine + tot*fTotMult) % FineCounterBins]++;
-
-            // ignore hits without epoch
-            if (epoch==0) continue;
-
-            uint64_t fulltm = (((uint64_t) epoch) << 19) | stamp;
-
-            chrec.lastr = 1.*BinWidthPs*fulltm;
-
-            //static int mmm = 0;
-            //if (++mmm<1000) printf("fine %3u  add %7.1f\n", fine, chrec.rising_calibr[fine]);
+      }
+   }
+}
 
-            if (fUseCalibr)
-               chrec.lastr = 1.*BinWidthPs*(fulltm & 0xffffffffffff80LLU) + chrec.rising_calibr[fine];
+/** Fill histograms of time differences between configured channels */
 
-            chrec.lastf = chrec.lastr + 1.*BinWidthPs*tot*fTotMult;
+void get4::MbsProcessor::FillRefHistograms()
+{
+   for (unsigned n=0;n<fRef.size();n++) {
+      Get4MbsRef& rec = fRef[n];
 
-            if (chrec.firstr==0) chrec.firstr = chrec.lastr;
-            if (chrec.firstf==0) chrec.firstf = chrec.lastf;
+      FillH1(rec.fHist, GET4[rec.g2].CH[rec.ch2].gettm(rec.r2) - GET4[rec.g1].CH[rec.ch1].gettm(rec.r1));
+   }
+}
 
-            FillH1(chrec.fTotTm, chrec.lastf - chrec.lastr);
+/** Scan buffer - decode all hits, than calibrate, histogram and match reference pairs */
 
-            break;
-         }
+bool get4::MbsProcessor::FirstBufferScan(const base::Buffer& buf)
+{
+   if (buf.null()) return false;
 
-         default:
-            printf("get wrong get4 message type 0x%02x - abort\n", msgid);
-            return false;
-      }
+   {
+      STREAM_PROFILE("Decode", this);
+      if (!DecodeBuffer(buf)) return false;
    }
 
-   for (unsigned n=0;n<fRef.size();n++) {
-      Get4MbsRef& rec = fRef[n];
-
-      // printf("tm2 %u tm1 %u diff %f\n", GET4[rec.g2].gettm(rec.ch2, rec.r2), GET4[rec.g1].gettm(rec.ch1, rec.r1), 0.+ GET4[rec.g2].gettm(rec.ch2, rec.r2) - GET4[rec.g1].gettm(rec.ch1, rec.r1));
+   {
+      STREAM_PROFILE("Calibration", this);
+      CalibrateHits();
+   }
 
-      FillH1(rec.fHist, GET4[rec.g2].CH[rec.ch2].gettm(rec.r2) - GET4[rec.g1].CH[rec.ch1].gettm(rec.r1));
+   {
+      STREAM_PROFILE("HistogramsFill", this);
+      FillHitsHistograms();
+      FillRefHistograms();
    }
 
    if (fAutoCalibr>1000) ProduceCalibration(fAutoCalibr);
@@ -269,6 +269,9 @@ bool get4::Processor::FirstBufferScan(const base::Buffer& buf)
                AddSyncMarker(marker);
             }
 
+            if (IsCoincidenceChannel(10 + sync_ch))
+               AddCoincidenceHit(10 + sync_ch, localtm);
+
             if (fTriggerSignal == (10 + sync_ch)) {
 
                base::LocalTimeMarker marker;
@@ -289,6 +292,9 @@ bool get4::Processor::FirstBufferScan(const base::Buffer& buf)
             ignoremsg = fIgnore250Mhz;
             if (fIgnore250Mhz) break;
 
+            if (IsCoincidenceChannel(auxid))
+               AddCoincidenceHit(auxid, localtm);
+
             if (fTriggerSignal == auxid) {
 
                base::LocalTimeMarker marker;
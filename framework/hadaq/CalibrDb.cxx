@@ -0,0 +1,347 @@
+#include "hadaq/CalibrDb.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+   const char CalibrDbMagic[8] = { 'H', 'A', 'D', 'C', 'A', 'L', 'D', 'B' };
+
+   /** Round size up to 8 bytes */
+   inline uint64_t AlignDb(uint64_t sz) { return (sz + 7) & ~((uint64_t) 7); }
+
+   /** Returns table for CRC32 calculation, reflected polynomial 0xEDB88320
+     * Initialization of function-local static is thread-safe */
+   const uint32_t *GetCrcTable()
+   {
+      static const std::array<uint32_t, 256> table = []() {
+         std::array<uint32_t, 256> res;
+         for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+               c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            res[n] = c;
+         }
+         return res;
+      }();
+      return table.data();
+   }
+
+   std::mutex gDbMutex;                                            ///< protects map of databases
+   std::map<std::string, std::weak_ptr<hadaq::CalibrDb>> gDbMap;   ///< all used databases
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////
+/// destructor, not yet written blocks are stored
+
+hadaq::CalibrDb::~CalibrDb()
+{
+   if (!fUpdates.empty())
+      Write();
+   Close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Calculate CRC32 of data, can be continued with previous crc value
+
+uint32_t hadaq::CalibrDb::Checksum(const void *data, uint64_t size, uint32_t crc)
+{
+   const uint32_t *table = GetCrcTable();
+   const uint8_t *ptr = (const uint8_t *) data;
+
+   crc = ~crc;
+   while (size-- > 0)
+      crc = table[(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+
+   return ~crc;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns true when file name should be used as calibration database - with ".caldb" suffix
+
+bool hadaq::CalibrDb::IsDbName(const std::string &fname)
+{
+   const std::string suffix = ".caldb";
+   return (fname.length() > suffix.length()) && (fname.compare(fname.length() - suffix.length(), suffix.length(), suffix) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns database instance for specified file name
+///
+/// Same instance returned as long as it is used somewhere, file is not opened
+
+std::shared_ptr<hadaq::CalibrDb> hadaq::CalibrDb::Get(const std::string &fname)
+{
+   std::lock_guard<std::mutex> lock(gDbMutex);
+
+   auto &entry = gDbMap[fname];
+   auto db = entry.lock();
+   if (!db) {
+      db = std::make_shared<CalibrDb>(fname);
+      entry = db;
+   }
+   return db;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Map calibration database file into memory
+///
+/// Header and index are verified, blocks of TDCs verified when accessed
+
+bool hadaq::CalibrDb::Open(const std::string &fname)
+{
+   Close();
+
+   if (!fname.empty()) fFileName = fname;
+
+   if (fFileName.empty()) {
+      printf("Calibration database file name not specified\n");
+      return false;
+   }
+
+   int fd = open(fFileName.c_str(), O_RDONLY);
+   if (fd < 0) {
+      printf("Cannot open calibration database %s for reading\n", fFileName.c_str());
+      return false;
+   }
+
+   struct stat st;
+   if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size >= (off_t) sizeof(CalibrDbHeader))) {
+      void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mem != MAP_FAILED) {
+         fMapped = (char *) mem;
+         fMappedSize = st.st_size;
+      }
+   }
+
+   close(fd);
+
+   if (!fMapped) {
+      printf("Cannot map calibration database %s\n", fFileName.c_str());
+      return false;
+   }
+
+   const CalibrDbHeader *hdr = (const CalibrDbHeader *) fMapped;
+
+   const char *err = nullptr;
+
+   if (memcmp(hdr->magic, CalibrDbMagic, sizeof(CalibrDbMagic)) != 0)
+      err = "wrong signature";
+   else if (hdr->headercrc != Checksum(hdr, offsetof(CalibrDbHeader, headercrc)))
+      err = "header checksum mismatch";
+   else if ((hdr->version == 0) || (hdr->version > CalibrDbVersion))
+      err = "unsupported version";
+   else if (hdr->filesize != fMappedSize)
+      err = "file size mismatch";
+   else if (sizeof(CalibrDbHeader) + (uint64_t) hdr->numtdc * sizeof(CalibrDbIndex) > fMappedSize)
+      err = "index outside file";
+   else if (hdr->indexcrc != Checksum(fMapped + sizeof(CalibrDbHeader), (uint64_t) hdr->numtdc * sizeof(CalibrDbIndex)))
+      err = "index checksum mismatch";
+
+   if (err) {
+      printf("Calibration database %s is corrupted - %s\n", fFileName.c_str(), err);
+      Close();
+      return false;
+   }
+
+   fIndex = (const CalibrDbIndex *) (fMapped + sizeof(CalibrDbHeader));
+   fNumTdc = hdr->numtdc;
+
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Release mapped memory, not yet written blocks are kept
+
+void hadaq::CalibrDb::Close()
+{
+   if (fMapped)
+      munmap(fMapped, fMappedSize);
+
+   fMapped = nullptr;
+   fMappedSize = 0;
+   fIndex = nullptr;
+   fNumTdc = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Find index entry for TDC in mapped file
+
+const hadaq::CalibrDbIndex *hadaq::CalibrDb::FindIndex(unsigned tdcid) const
+{
+   unsigned first = 0, last = fNumTdc;
+
+   while (first < last) {
+      unsigned mid = (first + last) / 2;
+      if (fIndex[mid].tdcid < tdcid)
+         first = mid + 1;
+      else
+         last = mid;
+   }
+
+   return (first < fNumTdc) && (fIndex[first].tdcid == tdcid) ? fIndex + first : nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Find calibration block of TDC
+///
+/// Not yet written updates are checked first, then mapped file.
+/// Checksum of block in mapped file is verified. Returns nullptr when block not found or corrupted
+
+const hadaq::CalibrDbTdc *hadaq::CalibrDb::FindTdc(unsigned tdcid, uint32_t *blksize) const
+{
+   auto iter = fUpdates.find(tdcid);
+   if (iter != fUpdates.end()) {
+      if (blksize) *blksize = iter->second.size();
+      return (const CalibrDbTdc *) iter->second.data();
+   }
+
+   const CalibrDbIndex *entry = FindIndex(tdcid);
+   if (!entry) return nullptr;
+
+   if ((entry->offset % 8 != 0) || (entry->size < sizeof(CalibrDbTdc)) || (entry->offset + entry->size > fMappedSize)) {
+      printf("Calibration database %s - block of TDC 0x%04x outside file\n", fFileName.c_str(), tdcid);
+      return nullptr;
+   }
+
+   if (entry->crc != Checksum(fMapped + entry->offset, entry->size)) {
+      printf("Calibration database %s - checksum mismatch for TDC 0x%04x\n", fFileName.c_str(), tdcid);
+      return nullptr;
+   }
+
+   const CalibrDbTdc *tdc = (const CalibrDbTdc *) (fMapped + entry->offset);
+   if (tdc->tdcid != tdcid) return nullptr;
+
+   if (blksize) *blksize = entry->size;
+   return tdc;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Set new calibration block of TDC, content of vector is taken
+/// Block is not written immediately, see Write() and WriteWhenReady()
+
+void hadaq::CalibrDb::SetTdcBlock(unsigned tdcid, std::vector<char> &blk)
+{
+   fUpdates[tdcid].swap(blk);
+   blk.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Write database when all attached writers provided their blocks
+
+bool hadaq::CalibrDb::WriteWhenReady()
+{
+   if (fUpdates.empty() || (fUpdates.size() < fWriters)) return false;
+
+   return Write();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Unregister writer, not yet written blocks stored when all writers are detached
+
+void hadaq::CalibrDb::Detach()
+{
+   if (++fDetached < fWriters) return;
+
+   fWriters = fDetached = 0;
+
+   if (!fUpdates.empty())
+      Write();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Write calibration database
+///
+/// Current content of the file is mapped again, blocks of TDCs without updates are copied
+/// from there. New file written under temporary name and then replaces old file.
+/// Mapping of old file by other readers stays valid. After writing new file is mapped
+
+bool hadaq::CalibrDb::Write(const std::string &fname)
+{
+   if (!fname.empty()) fFileName = fname;
+
+   if (fFileName.empty()) {
+      printf("Calibration database file name not specified\n");
+      return false;
+   }
+
+   // take latest file content, it may be changed by other process
+   if (access(fFileName.c_str(), F_OK) == 0)
+      Open();
+   else
+      Close();
+
+   // list of all blocks sorted by TDC id
+   std::map<unsigned, std::pair<const char *, uint32_t>> blocks;
+
+   for (unsigned n = 0; n < fNumTdc; n++) {
+      uint32_t sz = 0;
+      const CalibrDbTdc *tdc = FindTdc(fIndex[n].tdcid, &sz);
+      if (tdc) blocks[fIndex[n].tdcid] = std::make_pair((const char *) tdc, sz);
+   }
+
+   for (auto &entry : fUpdates)
+      blocks[entry.first] = std::make_pair(entry.second.data(), (uint32_t) entry.second.size());
+
+   uint64_t indexsize = blocks.size() * sizeof(CalibrDbIndex),
+            filesize = AlignDb(sizeof(CalibrDbHeader) + indexsize);
+
+   for (auto &entry : blocks)
+      filesize += AlignDb(entry.second.second);
+
+   std::vector<char> image(filesize, 0);
+
+   CalibrDbHeader *hdr = (CalibrDbHeader *) image.data();
+   CalibrDbIndex *index = (CalibrDbIndex *) (image.data() + sizeof(CalibrDbHeader));
+
+   uint64_t pos = AlignDb(sizeof(CalibrDbHeader) + indexsize);
+
+   for (auto &entry : blocks) {
+      memcpy(image.data() + pos, entry.second.first, entry.second.second);
+      index->tdcid = entry.first;
+      index->size = entry.second.second;
+      index->offset = pos;
+      index->crc = Checksum(entry.second.first, entry.second.second);
+      index->reserved = 0;
+      index++;
+      pos += AlignDb(entry.second.second);
+   }
+
+   memcpy(hdr->magic, CalibrDbMagic, sizeof(CalibrDbMagic));
+   hdr->version = CalibrDbVersion;
+   hdr->numtdc = blocks.size();
+   hdr->filesize = filesize;
+   hdr->indexcrc = Checksum(image.data() + sizeof(CalibrDbHeader), indexsize);
+   hdr->headercrc = Checksum(hdr, offsetof(CalibrDbHeader, headercrc));
+
+   std::string tmpname = fFileName + ".tmp";
+
+   FILE *f = fopen(tmpname.c_str(), "w");
+   if (!f) {
+      printf("Cannot open file %s for writing calibration database\n", tmpname.c_str());
+      return false;
+   }
+
+   bool res = fwrite(image.data(), filesize, 1, f) == 1;
+   if (fclose(f) != 0) res = false;
+
+   if (!res || (rename(tmpname.c_str(), fFileName.c_str()) != 0)) {
+      printf("Fail to write calibration database %s\n", fFileName.c_str());
+      unlink(tmpname.c_str());
+      return false;
+   }
+
+   printf("Store calibrations of %u TDCs in %s, updated %u\n", (unsigned) blocks.size(), fFileName.c_str(), (unsigned) fUpdates.size());
+
+   fUpdates.clear();
+
+   return Open();
+}
@@ -0,0 +1,264 @@
+#include "hadaq/HldGenerator.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "base/Buffer.h"
+#include "base/ProcMgr.h"
+#include "base/defines.h"
+
+#include "hadaq/definess.h"
+#include "hadaq/HldFile.h"
+#include "hadaq/TdcMessage.h"
+
+///////////////////////////////////////////////////////////////////////////
+/// Set seed of random generator and restart generation from first event
+
+void hadaq::HldGenerator::SetSeed(uint64_t seed)
+{
+   fSeed = seed;
+   fRnd = seed;
+   fEventCnt = 0;
+   fNumErrors = 0;
+   fNumHits = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns maximal size of generated event in bytes
+
+unsigned hadaq::HldGenerator::MaxEventSize() const
+{
+   // TDC header, trailer, ch0 with epoch, per channel hits with epochs, errors
+   unsigned tdcsize = 4 + 4 + (fNumCh - 1) * (1 + fMaxHits * 2 * 2) + 4;
+
+   unsigned trbsize = 4 + fNumHub + 2 + 1 + GetNumTdcs() / (fNumTrb > 0 ? fNumTrb : 1) * (1 + tdcsize);
+
+   return (8 + fNumTrb * trbsize) * 4;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Fill data of single TDC for trigger at time trigtm (in ns)
+///
+/// Returns number of written words and error kind in errkind
+
+unsigned hadaq::HldGenerator::FillTdc(uint32_t *ptr, unsigned &errkind, unsigned trigtype, double trigtm)
+{
+   unsigned n = 0;
+
+   errkind = 0;
+   unsigned mask = fErrorMask & ~err_Status;
+   if (mask && (fErrorRate > 0) && (Uniform() < fErrorRate)) {
+      while ((errkind & mask) == 0)
+         errkind = 1 << Integer(5);
+      fNumErrors++;
+   }
+
+   // coarse unit in ns and number of coarse bits
+   double unit = fVer4 ? hadaq::TdcMessage::CoarseUnit280() * 1e9 : hadaq::TdcMessage::CoarseUnit() * 1e9;
+   unsigned coarse_bits = fVer4 ? 12 : 11;
+
+   uint32_t lastepoch = 0xFFFFFFFF;
+
+   auto addhit = [&](unsigned ch, double tm, bool rising, bool badfine) {
+      double pos = tm / unit;
+      uint64_t full = (uint64_t) ceil(pos);
+      double frac = full - pos;
+
+      uint32_t epoch = (full >> coarse_bits) & 0xFFFFFFF;
+      uint32_t coarse = full & ((1 << coarse_bits) - 1);
+      uint32_t fine = fFineMin + (uint32_t) (frac * (fFineMax - fFineMin));
+      if (badfine) fine = fVer4 ? 0x1FF : 0x3FF;
+
+      if (epoch != lastepoch) {
+         ptr[n++] = hadaq::tdckind_Epoch | epoch;
+         lastepoch = epoch;
+      }
+
+      fNumHits++;
+
+      if (!fVer4)
+         ptr[n++] = hadaq::tdckind_Hit | ((ch & 0x7F) << 22) | ((fine & 0x3FF) << 12) | ((rising ? 1 : 0) << 11) | coarse;
+      else if (ch == 0)
+         ptr[n++] = hadaq::newkind_TMDR | ((rising ? 0 : 1) << 21) | (coarse << 9) | (fine & 0x1FF);
+      else
+         ptr[n++] = hadaq::newkind_TMDT | ((rising ? 0 : 1) << 27) | (((ch - 1) & 0x3F) << 21) | (coarse << 9) | (fine & 0x1FF);
+   };
+
+   if (errkind != err_NoHeader)
+      ptr[n++] = fVer4 ? (hadaq::newkind_HDR | (4 << 24) | (trigtype << 16) | (fEventCnt & 0xFFFF)) : hadaq::tdckind_Header;
+
+   // reference channel 0
+   double ch0tm = trigtm + 20. + Uniform();
+   addhit(0, ch0tm, true, errkind == err_Fine);
+
+   bool is_calibr = (trigtype == 0xD);
+
+   for (unsigned ch = 1; ch < fNumCh; ch++) {
+      unsigned nhits = 0;
+      if (is_calibr)
+         nhits = 1;
+      else if (Uniform() < fHitProb)
+         nhits = 1 + Integer(fMaxHits);
+
+      double tm = is_calibr ? ch0tm + 30. + Uniform() * 2. : ch0tm + 20. + Uniform() * 100.;
+
+      while (nhits-- > 0) {
+         double tot = is_calibr ? 30. : 10. + Uniform() * 30.;
+         addhit(ch, tm, true, false);
+         if (fFalling) addhit(ch, tm + tot, false, false);
+         tm += tot + 5. + Uniform() * 50.;
+      }
+   }
+
+   if (errkind == err_Channel) {
+      unsigned maxch = fVer4 ? 64 : 127;
+      addhit(fNumCh + 3 < maxch ? fNumCh + 3 : maxch, ch0tm + 50., true, false);
+   }
+
+   // TRL message with number of channels
+   if (fVer4)
+      ptr[n++] = hadaq::newkind_TRL | ((fNumCh - 2) & 0x7F);
+
+   return n;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Generate next event in provided buffer
+///
+/// Returns size of produced event in bytes or 0 when buffer is too small.
+/// Event always has size aligned to 8 bytes
+
+unsigned hadaq::HldGenerator::GenerateEvent(void *buf, unsigned bufsize)
+{
+   if (!buf || (bufsize < MaxEventSize())) return 0;
+
+   uint32_t *ptr = (uint32_t *) buf;
+
+   unsigned trigtype = (fCalibrFraction > 0) && (Uniform() < fCalibrFraction) ? 0xD : 0x1;
+
+   double epochlen = fVer4 ? hadaq::TdcMessage::CoarseUnit280() * 1e9 * 4096 : hadaq::TdcMessage::CoarseUnit() * 1e9 * 2048;
+
+   double trigtm = fStartEpoch * epochlen + fEventCnt * fTrigPeriod;
+
+   unsigned n = 8, tdcid = fTdcId; // event header
+
+   for (unsigned trb = 0; trb < fNumTrb; trb++) {
+      unsigned subpos = n;
+      n += 4; // subevent header
+
+      unsigned numhub = fNumHub > 0 ? fNumHub : 1;
+
+      for (unsigned hub = 0; hub < numhub; hub++) {
+         unsigned hubpos = n;
+         if (fNumHub > 0) n++;
+
+         for (unsigned tdc = 0; tdc < fNumTdc; tdc++) {
+            unsigned pos = n++, errkind = 0;
+            unsigned len = FillTdc(ptr + n, errkind, trigtype, trigtm);
+            n += len;
+            if (errkind == err_Length) len++;
+            ptr[pos] = (len << 16) | (tdcid++ & 0xFFFF);
+         }
+
+         if (fNumHub > 0)
+            ptr[hubpos] = ((n - hubpos - 1) << 16) | ((fHubId + trb*fNumHub + hub) & 0xFFFF);
+      }
+
+      // trailer with status word
+      uint32_t status = 0x1;
+      if ((fErrorMask & err_Status) && (fErrorRate > 0) && (Uniform() < fErrorRate)) {
+         status |= 1 << (16 + Integer(16));
+         fNumErrors++;
+      }
+      ptr[n++] = (1 << 16) | 0x5555;
+      ptr[n++] = status;
+
+      unsigned subsize = (n - subpos) * 4;
+      if ((n - subpos) % 2) ptr[n++] = 0; // padding
+
+      ptr[subpos] = subsize;
+      ptr[subpos+1] = 0x00020001 | (trigtype << 4);
+      ptr[subpos+2] = fTrbId + trb;
+      ptr[subpos+3] = fEventCnt;
+   }
+
+   ptr[0] = n * 4;
+   ptr[1] = hadaqs::EvtDecoding_64bitAligned;
+   ptr[2] = (hadaqs::EvtId_DABC & ~0xF) | trigtype;
+   ptr[3] = fEventCnt;
+   ptr[4] = 0; // date and time are not set to get identical data for same seed
+   ptr[5] = 0;
+   ptr[6] = fRunId;
+   ptr[7] = 0;
+
+   if (fSwapped)
+      for (unsigned k = 0; k < n; k++)
+         ptr[k] = HADAQ_SWAP4(ptr[k]);
+
+   fEventCnt++;
+
+   return n * 4;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Write specified number of events into HLD file
+
+bool hadaq::HldGenerator::WriteFile(const char *fname, unsigned long numevents)
+{
+   hadaq::HldFile f;
+   if (!f.OpenWrite(fname, fRunId)) {
+      printf("Fail to create HLD file %s\n", fname);
+      return false;
+   }
+
+   fBuf.resize(MaxEventSize() / 4);
+
+   for (unsigned long cnt = 0; cnt < numevents; cnt++) {
+      unsigned sz = GenerateEvent(fBuf.data(), fBuf.size() * 4);
+      if (!sz || !f.WriteBuffer(fBuf.data(), sz)) {
+         printf("Fail to write event %lu into %s\n", cnt, fname);
+         return false;
+      }
+   }
+
+   f.Close();
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Generate next event and deliver it to the processors manager with ProvideRawData()
+///
+/// Returns false when configured number of events was produced or there is no processor for the events.
+/// While mgr->IsBackpressure() is true, ProduceNextEvent() should be called before next event is provided
+
+bool hadaq::HldGenerator::ProvideEvent(base::ProcMgr *mgr)
+{
+   if (!mgr || (fMaxEvents && (fEventCnt >= fMaxEvents))) return false;
+
+   if (fBuf.size() * 4 < MaxEventSize())
+      fBuf.resize(MaxEventSize() / 4);
+
+   unsigned sz = GenerateEvent(fBuf.data(), fBuf.size() * 4);
+   if (!sz) return false;
+
+   // in stream mode buffers are kept in queues, therefore data must be copied
+   base::Buffer buf;
+   if (mgr->IsStreamAnalysis()) {
+      buf.makenew(sz);
+      memcpy(buf.ptr(), fBuf.data(), sz);
+   } else {
+      buf.makereferenceof(fBuf.data(), sz);
+   }
+
+   buf().kind = base::proc_TRBEvent;
+   buf().boardid = 0;
+   buf().format = 0;
+
+   if (!mgr->ProvideRawData(buf)) {
+      printf("No processor for generated HLD events\n");
+      return false;
+   }
+
+   return true;
+}
@@ -5,12 +5,89 @@
 #include <cmath>
 #include <time.h>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "base/defines.h"
 #include "base/ProcMgr.h"
 
 #include "hadaq/TrbIterator.h"
 #include "hadaq/TrbProcessor.h"
+#include "hadaq/CalibrDb.h"
+
+/** Threads for parallel transformation of HLD events.
+  * Each thread transforms own portion of events */
+
+class hadaq::HldProcessor::TransformThreads {
+   protected:
+      HldProcessor             *fHld{nullptr};   ///< processor
+      std::vector<std::thread>  fThreads;        ///< worker threads
+      std::mutex                fMutex;          ///< mutex for start/stop of the work
+      std::condition_variable   fStartCond;      ///< signals start of new work
+      std::condition_variable   fDoneCond;       ///< signals that all threads finished work
+      unsigned                  fGeneration{0};  ///< counter of works
+      unsigned                  fRunning{0};     ///< number of threads still running
+      bool                      fStop{false};    ///< stop threads
+
+      /** Main function of worker thread */
+      void ThreadFunc(unsigned n)
+      {
+         unsigned generation = 0;
+         while (true) {
+            {
+               std::unique_lock<std::mutex> lock(fMutex);
+               fStartCond.wait(lock, [this, generation] { return fStop || (fGeneration != generation); });
+               if (fStop) return;
+               generation = fGeneration;
+            }
+
+            fHld->TransformPortionOfEvents(n);
+
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (--fRunning == 0) fDoneCond.notify_one();
+         }
+      }
+
+   public:
+      /** constructor, starts nthreads-1 threads - main thread transforms first portion */
+      TransformThreads(HldProcessor *hld, unsigned nthreads) : fHld(hld)
+      {
+         for (unsigned n = 1; n < nthreads; n++)
+            fThreads.emplace_back(&TransformThreads::ThreadFunc, this, n);
+      }
+
+      /** destructor, stops all threads */
+      ~TransformThreads()
+      {
+         {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fStop = true;
+         }
+         fStartCond.notify_all();
+         for (auto &thrd : fThreads)
+            thrd.join();
+      }
+
+      /** Returns number of threads, including main thread */
+      unsigned NumThreads() const { return fThreads.size() + 1; }
+
+      /** Transform all portions, returns when all threads are done */
+      void Run()
+      {
+         {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fRunning = fThreads.size();
+            fGeneration++;
+         }
+         fStartCond.notify_all();
+
+         fHld->TransformPortionOfEvents(0);
+
+         std::unique_lock<std::mutex> lock(fMutex);
+         fDoneCond.wait(lock, [this] { return fRunning == 0; });
+      }
+};
 
 #define RAWPRINT( args ...) if(IsPrintRawData()) printf( args )
 
@@ -65,6 +142,7 @@ hadaq::HldProcessor::HldProcessor(bool auto_create, const char* after_func) :
 
 hadaq::HldProcessor::~HldProcessor()
 {
+   delete fTransformThreads;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -165,6 +243,27 @@ void hadaq::HldProcessor::ConfigureCalibration(const std::string& fileprefix, lo
       iter->second->ConfigureCalibration(fileprefix, period, trigmask);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////
+/// Store calibrations of all TDCs
+/// If file name has ".caldb" suffix, all calibrations written at once in single database file,
+/// otherwise separate file created for each TDC with specified prefix
+
+bool hadaq::HldProcessor::StoreCalibrations(const std::string& fname)
+{
+   if (!CalibrDb::IsDbName(fname)) {
+      for (unsigned n = 0; n < NumberOfTDC(); n++)
+         GetTDC(n)->StoreCalibration(fname);
+      return true;
+   }
+
+   auto db = CalibrDb::Get(fname);
+
+   for (unsigned n = 0; n < NumberOfTDC(); n++)
+      GetTDC(n)->StoreCalibrationDb(*db);
+
+   return db->Write();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 /// Set trigger window not only for itself, but for all subprocessors
 
@@ -380,26 +479,51 @@ void hadaq::HldProcessor::ResetStore()
 
 ////////////////////////////////////////////////////////////////////////////////////////
 /// Function to transform HLD event, used for TDC calibrations
+///
+/// If tgt not specified or same as src, event is transformed in place -
+/// hit messages replaced by hits with calibrated fine time, see \ref TransformEvents
 
 unsigned hadaq::HldProcessor::TransformEvent(void* src, unsigned len, void* tgt, unsigned tgtlen)
 {
+   if (tgt == src) tgt = nullptr;
+
    hadaq::TrbIterator iter(src, len);
 
    // only single event is transformed
-   if (iter.nextEvent() == 0) return 0;
+   hadaqs::RawEvent *evnt = iter.nextEvent();
+   if (!evnt) return 0;
+
+   if (iter.nextEvent() != 0) {
+      fprintf(stderr,"HLD should transform only single event\n");
+      return 0;
+   }
+
+   return TransformSingleEvent(evnt, len, tgt, tgtlen, -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Transform single event, used by \ref TransformEvent and by parallel transformation
+///
+/// If tgt not specified, event is transformed in place and len is returned.
+/// shard >= 0 used when called from worker thread, see \ref SetTransformThreads
 
-   if ((tgt!=0) && (tgtlen<len)) {
-      fprintf(stderr,"HLD requires larger output buffer than original\n");
+unsigned hadaq::HldProcessor::TransformSingleEvent(hadaqs::RawEvent *evnt, unsigned len, void *tgt, unsigned tgtlen, int shard)
+{
+   if ((tgt!=0) && (tgtlen<evnt->GetPaddedSize())) {
+      if (shard < 0) fprintf(stderr,"HLD requires larger output buffer than original\n");
       return 0;
    }
 
+   hadaq::TrbIterator iter(evnt, evnt->GetPaddedSize());
+   iter.nextEvent();
+
    hadaqs::RawSubevent* sub = 0;
 
    unsigned reslen = 0;
    unsigned char* curr = (unsigned char*) tgt;
    if (tgt!=0) {
       // copy event header
-      memcpy(tgt, iter.currEvent(), sizeof(hadaqs::RawEvent));
+      memcpy(tgt, evnt, sizeof(hadaqs::RawEvent));
       reslen += sizeof(hadaqs::RawEvent);
       curr += sizeof(hadaqs::RawEvent);
    }
@@ -408,16 +532,20 @@ unsigned hadaq::HldProcessor::TransformEvent(void* src, unsigned len, void* tgt,
       TrbProcMap::iterator iter = fMap.find(sub->GetId());
       if (iter != fMap.end()) {
          if (curr && (tgtlen-reslen < sub->GetPaddedSize())) {
-            fprintf(stderr,"not enough space for subevent in output buffer\n");
+            if (shard < 0) fprintf(stderr,"not enough space for subevent in output buffer\n");
             return 0;
          }
-         unsigned sublen = iter->second->TransformSubEvent(sub, curr, tgtlen - reslen);
+         unsigned sublen = iter->second->TransformSubEvent(sub, curr, tgtlen - reslen, false, nullptr, shard);
          if (curr) {
             curr += sublen;
             reslen += sublen;
          }
       } else
       if (curr) {
+         if (tgtlen-reslen < sub->GetPaddedSize()) {
+            if (shard < 0) fprintf(stderr,"not enough space for subevent in output buffer\n");
+            return 0;
+         }
          // copy subevent which cannot be recognized
          memcpy(curr, sub, sub->GetPaddedSize());
          curr += sub->GetPaddedSize();
@@ -432,9 +560,201 @@ unsigned hadaq::HldProcessor::TransformEvent(void* src, unsigned len, void* tgt,
       ((hadaqs::RawEvent*) tgt)->SetSize(reslen);
    }
 
-   if (iter.nextEvent() != 0) {
-      fprintf(stderr,"HLD should transform only single event\n");
-      return 0;
+   return reslen;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Configure number of threads used in \ref TransformEvents and \ref TransformBuffer
+///
+/// Each thread transforms own portion of events in the buffer. TDC statistic for
+/// auto-calibration is collected per thread and merged when all threads are finished,
+/// therefore calibrations are updated only between buffers. Histograms are filled by main thread.
+/// 0 or 1 - transformation performed sequentially in main thread
+
+void hadaq::HldProcessor::SetTransformThreads(unsigned nthreads)
+{
+   if (fTransformThreads && (fTransformThreads->NumThreads() == nthreads)) return;
+
+   delete fTransformThreads;
+   fTransformThreads = nullptr;
+
+   if (nthreads > 1)
+      fTransformThreads = new TransformThreads(this, nthreads);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Returns number of threads used for transformation, 1 when done sequentially
+
+unsigned hadaq::HldProcessor::GetTransformThreads() const
+{
+   return fTransformThreads ? fTransformThreads->NumThreads() : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Transform portion of events, called from worker thread
+
+void hadaq::HldProcessor::TransformPortionOfEvents(unsigned n)
+{
+   if (n >= fTransformPortions.size()) return;
+
+   auto &portion = fTransformPortions[n];
+
+   for (unsigned k = portion.first; k < portion.last; ++k) {
+      auto evnt = fTransformEvents[k];
+      if (fTransformInPlace) {
+         TransformSingleEvent(evnt, evnt->GetPaddedSize(), nullptr, 0, n);
+      } else {
+         unsigned maxlen = portion.out.size() * 4 - portion.outlen;
+         unsigned len = TransformSingleEvent(evnt, evnt->GetPaddedSize(), (char *) portion.out.data() + portion.outlen, maxlen, n);
+         if (len == 0) {
+            portion.failed = true;
+            return;
+         }
+         // events are always 8-bytes aligned
+         unsigned padded = (len + 7) / 8 * 8;
+         if (padded > maxlen) {
+            portion.failed = true;
+            return;
+         }
+         memset((char *) portion.out.data() + portion.outlen + len, 0, padded - len);
+         portion.outlen += padded;
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Transform all events in the buffer with configured threads
+///
+/// Histograms are filled first in main thread, then events are distributed between threads.
+/// In copy mode transformed events are kept in per-thread buffers
+
+bool hadaq::HldProcessor::TransformParallel(void *src, unsigned len, bool inplace)
+{
+   fTransformEvents.clear();
+
+   hadaq::TrbIterator iter(src, len);
+
+   hadaqs::RawEvent *evnt = nullptr;
+   while ((evnt = iter.nextEvent()) != nullptr) {
+      fTransformEvents.emplace_back(evnt);
+
+      hadaqs::RawSubevent* sub = nullptr;
+      while ((sub = iter.nextSubevent()) != nullptr) {
+         TrbProcMap::iterator trb = fMap.find(sub->GetId());
+         if (trb != fMap.end())
+            trb->second->TransformSubEvent(sub, nullptr, 0, true);
+      }
+   }
+
+   unsigned nthreads = fTransformThreads->NumThreads();
+
+   for (auto &item : fMap)
+      item.second->PrepareTransformShards(nthreads);
+
+   fTransformInPlace = inplace;
+   fTransformPortions.resize(nthreads);
+
+   unsigned numevents = fTransformEvents.size(), first = 0;
+   for (unsigned n = 0; n < nthreads; ++n) {
+      auto &portion = fTransformPortions[n];
+      portion.first = first;
+      portion.last = first = numevents * (n + 1) / nthreads;
+      portion.outlen = 0;
+      portion.failed = false;
+      if (!inplace) {
+         // calibration messages may increase data size up to 1.5 times
+         unsigned sz = 16;
+         for (unsigned k = portion.first; k < portion.last; ++k)
+            sz += fTransformEvents[k]->GetPaddedSize() / 2 + 8;
+         if (portion.out.size() < sz) portion.out.resize(sz);
+      }
+   }
+
+   fTransformThreads->Run();
+
+   for (auto &item : fMap)
+      item.second->MergeTransformShards();
+
+   for (auto &portion : fTransformPortions)
+      if (portion.failed) {
+         fprintf(stderr,"Fail to transform events in parallel\n");
+         return false;
+      }
+
+   return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Transform in place all events in the buffer
+///
+/// Only hit messages of known TDCs are rewritten, all other words and unknown subevents
+/// are not touched. Event and subevent sizes remain the same, no memory is allocated.
+/// When configured with \ref SetTransformThreads, events are transformed in parallel.
+/// Returns number of processed events or 0 when parallel transformation failed
+
+unsigned hadaq::HldProcessor::TransformEvents(void* buf, unsigned len)
+{
+   if (fTransformThreads) {
+      if (!TransformParallel(buf, len, true)) return 0;
+      return fTransformEvents.size();
+   }
+
+   hadaq::TrbIterator iter(buf, len);
+
+   unsigned cnt = 0;
+
+   while (iter.nextEvent() != nullptr) {
+      hadaqs::RawSubevent* sub = nullptr;
+
+      while ((sub = iter.nextSubevent()) != nullptr) {
+         TrbProcMap::iterator trb = fMap.find(sub->GetId());
+         if (trb != fMap.end())
+            trb->second->TransformSubEvent(sub);
+      }
+
+      cnt++;
+   }
+
+   return cnt;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+/// Transform all events from src buffer into tgt buffer
+///
+/// Hit messages replaced by hits with calibrated fine time, calibration messages are inserted.
+/// When configured with \ref SetTransformThreads, events are transformed in parallel
+/// and order of events is preserved. Returns size of produced data or 0 when tgt buffer is too small
+
+unsigned hadaq::HldProcessor::TransformBuffer(void* src, unsigned len, void* tgt, unsigned tgtlen)
+{
+   if (!src || !tgt || (src == tgt)) return 0;
+
+   unsigned reslen = 0;
+
+   if (fTransformThreads) {
+      if (!TransformParallel(src, len, false)) return 0;
+
+      for (auto &portion : fTransformPortions) {
+         if (tgtlen - reslen < portion.outlen) {
+            fprintf(stderr,"not enough space for events in output buffer\n");
+            return 0;
+         }
+         memcpy((char *) tgt + reslen, portion.out.data(), portion.outlen);
+         reslen += portion.outlen;
+      }
+
+      return reslen;
+   }
+
+   hadaq::TrbIterator iter(src, len);
+
+   hadaqs::RawEvent *evnt = nullptr;
+   while ((evnt = iter.nextEvent()) != nullptr) {
+      unsigned evlen = TransformSingleEvent(evnt, evnt->GetPaddedSize(), (char *) tgt + reslen, tgtlen - reslen, -1);
+      unsigned padded = (evlen + 7) / 8 * 8;
+      if ((evlen == 0) || (padded > tgtlen - reslen)) return 0;
+      memset((char *) tgt + reslen + evlen, 0, padded - evlen);
+      reslen += padded;
    }
 
    return reslen;
@@ -485,7 +805,8 @@ void hadaq::HldProcessor::CreatePerTDCHisto()
    if (!fErrPerTDC)
       fErrPerTDC = MakeH1("ErrPerTDC", "Number of errors per TDC", tdcs.size(), 0, tdcs.size(), opt1.c_str());
 
-   std::string opt2 = lbl + ";opt:colz,pal70;tdc;channels";
+   // matrices are mostly empty in large setups
+   std::string opt2 = lbl + ";opt:colz,pal70;tdc;channels;sparse";
 
    if (!fHitsPerTDCChannel)
       fHitsPerTDCChannel = MakeH2("HitsPerChannel", "Number of hits per TDC channel",
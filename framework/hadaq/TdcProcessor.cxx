@@ -10,17 +10,136 @@
 
 #include "base/defines.h"
 #include "base/ProcMgr.h"
+#include "base/HierProfiler.h"
 
 #include "hadaq/TrbProcessor.h"
 #include "hadaq/HldProcessor.h"
 #include "hadaq/TdcSubEvent.h"
+#include "hadaq/CalibrDb.h"
 #include <iostream>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define STREAM_HIT2_AVX2
+#include <immintrin.h>
+#endif
+
 #define RAWPRINT( args ...) if(IsPrintRawData()) printf( args )
 
 
 #define ADDERROR(code, args ...) if(((1 << code) & gErrorMask) || mgr()->DoLog()) AddError( code, args )
 
+namespace {
+
+   /** number of words transformed at once with Hit2 table */
+   const unsigned Hit2Block = 8;
+
+   struct Hit2Args;
+
+   /** function to transform block of words */
+   typedef uint32_t (*Hit2BlockFunc)(uint32_t *data, bool swapped, Hit2Args &args);
+
+   /** arguments of Hit2 block transformation */
+   struct Hit2Args {
+      const uint16_t *table;  ///< Hit2 table
+      unsigned numch;         ///< number of channels
+      unsigned numfine;       ///< number of fine bins
+      unsigned hitcnt;        ///< counter of Hit messages
+      unsigned hit1cnt;       ///< counter of Hit1 messages
+   };
+
+   /** Transform block of words with Hit2 table, scalar version.
+     * Returns mask of transformed words, all other words are not changed */
+
+   uint32_t TransformHit2Block(uint32_t *data, bool swapped, Hit2Args &args)
+   {
+      uint32_t mask = 0;
+      for (unsigned n = 0; n < Hit2Block; ++n) {
+         uint32_t w = swapped ? HADAQ_SWAP4(data[n]) : data[n];
+         unsigned ch = (w >> 22) & 0x7F, fine = (w >> 12) & 0x3FF, edge = (w >> 11) & 1;
+         // only Hit and Hit1 messages with valid channel and fine counter
+         if (((w >> 30) != 2) || (ch >= args.numch) || (fine >= args.numfine)) continue;
+
+         if (w & 0x20000000) args.hit1cnt++; else args.hitcnt++;
+
+         uint32_t entry = args.table[(ch*2 + edge)*args.numfine + fine],
+                  newfine = entry & 0x3FF, corr_coarse = entry >> 10, coarse = w & 0x7FF;
+         if (corr_coarse > coarse) newfine |= 0x200;
+
+         w = (w & 0x1FC00800) | hadaq::tdckind_Hit2 | (newfine << 12) | ((coarse - corr_coarse) & 0x7FF);
+         data[n] = swapped ? HADAQ_SWAP4(w) : w;
+
+         mask |= 1 << n;
+      }
+      return mask;
+   }
+
+#ifdef STREAM_HIT2_AVX2
+
+   /** Transform block of words with Hit2 table, AVX2 version with gather from the table */
+
+   __attribute__((target("avx2")))
+   uint32_t TransformHit2BlockAVX2(uint32_t *data, bool swapped, Hit2Args &args)
+   {
+      const __m256i bswap = _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+                                             3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+
+      __m256i w = _mm256_loadu_si256((const __m256i *) data);
+      if (swapped) w = _mm256_shuffle_epi8(w, bswap);
+
+      __m256i ch = _mm256_and_si256(_mm256_srli_epi32(w, 22), _mm256_set1_epi32(0x7F)),
+              fine = _mm256_and_si256(_mm256_srli_epi32(w, 12), _mm256_set1_epi32(0x3FF)),
+              edge = _mm256_and_si256(_mm256_srli_epi32(w, 11), _mm256_set1_epi32(1));
+
+      // only Hit and Hit1 messages with valid channel and fine counter
+      __m256i valid = _mm256_cmpeq_epi32(_mm256_srli_epi32(w, 30), _mm256_set1_epi32(2));
+      valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(_mm256_set1_epi32(args.numch), ch));
+      valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(_mm256_set1_epi32(args.numfine), fine));
+
+      uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(valid));
+      if (!mask) return 0;
+
+      // invalid words read first entry of the table, table has extra entry at the end for 32-bit gather
+      __m256i indx = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(_mm256_add_epi32(ch, ch), edge), _mm256_set1_epi32(args.numfine)), fine);
+      indx = _mm256_and_si256(indx, valid);
+      __m256i entry = _mm256_and_si256(_mm256_i32gather_epi32((const int *) args.table, indx, 2), _mm256_set1_epi32(0xFFFF));
+
+      __m256i newfine = _mm256_and_si256(entry, _mm256_set1_epi32(0x3FF)),
+              corr_coarse = _mm256_srli_epi32(entry, 10),
+              coarse = _mm256_and_si256(w, _mm256_set1_epi32(0x7FF));
+
+      newfine = _mm256_or_si256(newfine, _mm256_and_si256(_mm256_cmpgt_epi32(corr_coarse, coarse), _mm256_set1_epi32(0x200)));
+      coarse = _mm256_and_si256(_mm256_sub_epi32(coarse, corr_coarse), _mm256_set1_epi32(0x7FF));
+
+      __m256i res = _mm256_or_si256(_mm256_and_si256(w, _mm256_set1_epi32(0x1FC00800)), _mm256_set1_epi32((int) hadaq::tdckind_Hit2));
+      res = _mm256_or_si256(res, _mm256_or_si256(_mm256_slli_epi32(newfine, 12), coarse));
+      res = _mm256_blendv_epi8(w, res, valid);
+      if (swapped) res = _mm256_shuffle_epi8(res, bswap);
+
+      _mm256_storeu_si256((__m256i *) data, res);
+
+      uint32_t hit1mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(w, 2)));
+      args.hit1cnt += __builtin_popcount(mask & hit1mask);
+      args.hitcnt += __builtin_popcount(mask & ~hit1mask);
+
+      return mask;
+   }
+
+   /** Returns function used for block transformation, selected once according to CPU */
+   Hit2BlockFunc GetHit2BlockFunc()
+   {
+      static Hit2BlockFunc func = __builtin_cpu_supports("avx2") ? TransformHit2BlockAVX2 : TransformHit2Block;
+      return func;
+   }
+
+#else
+
+   /** Returns function used for block transformation */
+   Hit2BlockFunc GetHit2BlockFunc() { return TransformHit2Block; }
+
+#endif
+
+}
+
 
 unsigned hadaq::TdcProcessor::gNumFineBins = FineCounterBins;
 unsigned hadaq::TdcProcessor::gTotRange = 100;
@@ -199,6 +318,7 @@ hadaq::TdcProcessor::TdcProcessor(TrbProcessor* trb, unsigned tdcid, unsigned nu
    fAllTotMode(-1),
    fWriteCalibr(),
    fWriteEveryTime(false),
+   fCalibrDb(),
    fUseLinear(false),
    fEveryEpoch(false),
    fUseLastHit(false),
@@ -277,7 +397,7 @@ hadaq::TdcProcessor::TdcProcessor(TrbProcessor* trb, unsigned tdcid, unsigned nu
       else
          fMsgsKind = MakeH1("MsgKind", "kind of messages", 8, 0, 8, "xbin:HDR,EPOC,TMDR,TMDT,-,-,-,-;kind");
 
-      fAllFine = MakeH2("FineTm", "fine counter value", numchannels, 0, numchannels, (fNumFineBins==1000 ? 100 : fNumFineBins), 0, fNumFineBins, "ch;fine");
+      fAllFine = MakeH2("FineTm", "fine counter value", numchannels, 0, numchannels, (fNumFineBins==1000 ? 100 : fNumFineBins), 0, fNumFineBins, "ch;fine;sparse");
       fhRaisingFineCalibr = MakeH2("RaisingFineTmCalibr", "raising calibrated fine counter value", numchannels, 0, numchannels, (fNumFineBins==1000 ? 100 : fNumFineBins), 0, fNumFineBins, "ch;calibrated fine");
       fAllCoarse = MakeH2("CoarseTm", "coarse counter value", numchannels, 0, numchannels, 2048, 0, 2048, "ch;coarse");
 
@@ -302,6 +422,8 @@ hadaq::TdcProcessor::TdcProcessor(TrbProcessor* trb, unsigned tdcid, unsigned nu
    for (unsigned ch=0;ch<numchannels;ch++)
       fCh[ch].CreateCalibr(fNumFineBins, fVersion4 ? hadaq::TdcMessage::CoarseUnit280() : hadaq::TdcMessage::CoarseUnit());
 
+   fCalibrStat.Init(numchannels, fNumFineBins);
+
    // always create histograms for channel 0
    CreateChannelHistograms(0);
    if (gAllHistos)
@@ -321,6 +443,8 @@ hadaq::TdcProcessor::~TdcProcessor()
       fCh[ch].ReleaseCalibr();
       fCh[ch].ReleaseToTHist();
    }
+
+   DetachCalibrDb();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -333,6 +457,11 @@ void hadaq::TdcProcessor::Set400Mhz(bool on)
 
    for (unsigned ch=0;ch<fNumChannels;ch++)
       fCh[ch].FillCalibr(fNumFineBins, 200. / fCustomMhz * hadaq::TdcMessage::CoarseUnit());
+
+   fCalibrStat.Clear();
+   fRollingIntegral.assign(fRollingIntegral.size(), 0.);
+
+   ResetHit2Table();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -345,6 +474,11 @@ void hadaq::TdcProcessor::SetCustomMhz(float freq)
 
    for (unsigned ch=0;ch<fNumChannels;ch++)
       fCh[ch].FillCalibr(fNumFineBins, 200. / fCustomMhz * hadaq::TdcMessage::CoarseUnit());
+
+   fCalibrStat.Clear();
+   fRollingIntegral.assign(fRollingIntegral.size(), 0.);
+
+   ResetHit2Table();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -475,6 +609,9 @@ void hadaq::TdcProcessor::UserPostLoop()
       if (fCalibrCounts==0) ProduceCalibration(true, fUseLinear);
       StoreCalibration(fWriteCalibr);
    }
+
+   // database written when all TDCs provided calibrations
+   DetachCalibrDb();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -557,7 +694,7 @@ void hadaq::TdcProcessor::SetRefChannel(unsigned ch, unsigned refch, unsigned re
 
          if (twodim && (fCh[ch].fRisingRef2D==0)) {
             snprintf(sbuf, sizeof(sbuf), "corr diff %s and fine counter", refname);
-            snprintf(saxis, sizeof(saxis), "Ch%u - %s, ns;fine counter", ch, refname);
+            snprintf(saxis, sizeof(saxis), "Ch%u - %s, ns;fine counter;sparse", ch, refname);
             fCh[ch].fRisingRef2D = MakeH2("RisingRef2D", sbuf, 500, left, right, 100, 0, 500, saxis);
          }
       }
@@ -722,6 +859,7 @@ void hadaq::TdcProcessor::BeforeFill()
    for (unsigned ch = 0; ch < NumChannels(); ch++) {
       ChannelRec &rec = fCh[ch];
       rec.rising_hit_tm = 0;
+      rec.rising_hit_ps = 0;
       rec.rising_last_tm = 0;
       rec.rising_ref_tm = 0.;
       rec.rising_new_value = false;
@@ -774,19 +912,20 @@ void hadaq::TdcProcessor::AfterFill(SubProcMap* subprocmap)
       // printf("TDC %s %d %d same %d %p %p  %f %f \n", GetName(), ch, ref, (this==refproc), this, refproc, rec.rising_hit_tm, refproc->fCh[ref].rising_hit_tm);
 
       if ((refproc!=0) && ((ref>0) || (refproc!=this)) && (ref<refproc->NumChannels()) && ((ref!=ch) || (refproc!=this))) {
-         if (DoRisingEdge() && (rec.rising_hit_tm != 0) && (refproc->fCh[ref].rising_hit_tm != 0)) {
+         if (DoRisingEdge() && (rec.rising_hit_ps != 0) && (refproc->fCh[ref].rising_hit_ps != 0)) {
 
-            double tm = rec.rising_hit_tm; // relative time to ch0 on same TDC
-            double tm_ref = refproc->fCh[ref].rising_hit_tm; // relative time to ch0 on referenced TDC
+            // differences calculated in integer ps, absolute times of long runs do not fit into double with ps precision
+            base::PicoTime_t tm = rec.rising_hit_ps; // relative time to ch0 on same TDC
+            base::PicoTime_t tm_ref = refproc->fCh[ref].rising_hit_ps; // relative time to ch0 on referenced TDC
 
             if ((refproc!=this) && (ch>0) && (ref>0) && rec.refabs) {
-               tm += fCh[0].rising_hit_tm; // produce again absolute time for channel
-               tm_ref += refproc->fCh[0].rising_hit_tm; // produce again absolute time for reference channel
+               tm += fCh[0].rising_hit_ps; // produce again absolute time for channel
+               tm_ref += refproc->fCh[0].rising_hit_ps; // produce again absolute time for reference channel
             }
 
-            rec.rising_ref_tm = tm - tm_ref;
+            rec.rising_ref_tm = base::PicoToSeconds(tm - tm_ref);
 
-            double diff = rec.rising_ref_tm*1e9;
+            double diff = (tm - tm_ref)*1e-3;
 
             // when refch is 0 on same board, histogram already filled
             if ((ref != 0) || (refproc != this))
@@ -797,7 +936,7 @@ void hadaq::TdcProcessor::AfterFill(SubProcMap* subprocmap)
             DefFillH2(rec.fRisingRef2D, (diff-2.), rec.rising_coarse/4, 1.);
             RAWPRINT("Difference rising %04x:%02u\t %04x:%02u\t %12.3f\t %12.3f\t %7.3f  coarse %03x - %03x = %4d  fine %03x %03x \n",
                   GetID(), ch, reftdc, ref,
-                  tm*1e9,  tm_ref*1e9, diff,
+                  tm*1e-3,  tm_ref*1e-3, diff,
                   rec.rising_coarse, refproc->fCh[ref].rising_coarse, (int) (rec.rising_coarse - refproc->fCh[ref].rising_coarse),
                   rec.rising_fine, refproc->fCh[ref].rising_fine);
 
@@ -835,8 +974,12 @@ void hadaq::TdcProcessor::AfterFill(SubProcMap* subprocmap)
       }
    }
 
-   fCalibrProgress = TestCanCalibrate(false);
-   if ((fCalibrProgress>=1.) && fAutoCalibr) PerformAutoCalibrate();
+   if ((fRollingBlock > 0) && (fAllCalibrMode <= 0)) {
+      CheckRollingCalibration();
+   } else {
+      fCalibrProgress = TestCanCalibrate(false);
+      if ((fCalibrProgress>=1.) && fAutoCalibr) PerformAutoCalibrate();
+   }
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -848,14 +991,14 @@ long hadaq::TdcProcessor::CheckChannelStat(unsigned ch)
    if (!rec.docalibr) return 0;
 
    if (fEdgeMask == edge_CommonStatistic)
-      return rec.all_rising_stat + rec.all_falling_stat;
+      return fCalibrStat.GetAll(ch, 0) + fCalibrStat.GetAll(ch, 1);
 
-   long stat = 0;
+   long stat = 0, all_rising = fCalibrStat.GetAll(ch, 0), all_falling = fCalibrStat.GetAll(ch, 1);
 
-   if (DoRisingEdge() && (rec.all_rising_stat>0)) stat = rec.all_rising_stat;
+   if (DoRisingEdge() && (all_rising>0)) stat = all_rising;
 
-   if (DoFallingEdge() && (rec.all_falling_stat>0) && (fEdgeMask == edge_BothIndepend))
-      if ((stat == 0) || (rec.all_falling_stat < stat)) stat = rec.all_falling_stat;
+   if (DoFallingEdge() && (all_falling>0) && (fEdgeMask == edge_BothIndepend))
+      if ((stat == 0) || (all_falling < stat)) stat = all_falling;
 
    return stat;
 }
@@ -915,6 +1058,146 @@ bool hadaq::TdcProcessor::PerformAutoCalibrate()
    return true;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Configure rolling calibration
+///
+/// Instead of periodic calibration from scratch, calibration of every channel and edge
+/// updated each time when `block` new hits are accumulated. Previous statistic is not cleared,
+/// but scaled with `decay` factor, calibration curve produced from decayed cumulative integral.
+/// Therefore calibration follows temperature drift without periods of bad calibration quality
+/// and without calibration of all channels at once. Effective statistic is `block / (1 - decay)`.
+/// Normal or linear calibration produced depending on SetUseLinear(), new curve not used when its
+/// quality is bad and worse than current. ToT shifts are not changed.
+/// Value `block = 0` disables rolling calibration. Automatic calibration is disabled.
+
+void hadaq::TdcProcessor::SetRollingCalibration(long block, float decay)
+{
+   fRollingBlock = block > 0 ? block : 0;
+   fRollingDecay = (decay < 0.) ? 0. : ((decay > 0.99) ? 0.99 : decay);
+
+   if (fRollingBlock > 0) {
+      fRollingIntegral.assign(NumChannels()*2*fNumFineBins, 0.);
+      fCalibrCounts = fRollingBlock;
+      fAutoCalibr = false;
+      fAutoCalibrOnce = false;
+   } else {
+      fRollingIntegral.clear();
+   }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Update rolling calibration of channel edge (0 - rising, 1 - falling)
+///
+/// Accumulated statistic is added to decayed cumulative integral and cleared.
+/// Calibration curve produced with CalibrateIntegral() - normal or linear, same quality checks as
+/// for regular calibration. Curve changed only when enough effective statistic is there and
+/// new calibration is good or not worse than current one
+
+bool hadaq::TdcProcessor::RollChannelCalibration(unsigned ch, unsigned edge)
+{
+   double *integral = fRollingIntegral.data() + (ch*2 + edge)*fNumFineBins;
+
+   double sum = 0.;
+   for (unsigned n = 0; n < fNumFineBins; n++) {
+      sum += fCalibrStat.Get(ch, edge, n);
+      integral[n] = integral[n]*fRollingDecay + sum;
+   }
+
+   fCalibrStat.ClearEdge(ch, edge);
+
+   double total = integral[fNumFineBins-1];
+   if (total <= (fUseLinear ? 100 : 1000)) return false;
+
+   ChannelRec &rec = fCh[ch];
+   std::vector<float> &calibr = edge ? rec.falling_calibr : rec.rising_calibr;
+   float &quality = edge ? rec.calibr_quality_falling : rec.calibr_quality_rising;
+
+   double newquality = CalibrateIntegral(ch, edge == 0, integral, fRollingCalibr, fUseLinear);
+
+   if ((newquality <= 0.5) && (calibr.size() > 4) && (newquality < quality)) {
+      printf("%s ch %u %s rolling calibration quality %4.2f worse than current %4.2f - ignored\n",
+             GetName(), ch, edge ? "falling" : "rising", newquality, quality);
+      return false;
+   }
+
+   std::swap(calibr, fRollingCalibr);
+   quality = newquality;
+
+   if (edge) {
+      rec.calibr_stat_falling = (long) total;
+      CopyCalibration(calibr, rec.fFallingCalibr, ch, fFallingCalibr);
+   } else {
+      rec.calibr_stat_rising = (long) total;
+      CopyCalibration(calibr, rec.fRisingCalibr, ch, fRisingCalibr);
+   }
+
+   return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Check channels which accumulated enough statistic for rolling calibration
+/// Edges handled same way as in ProduceCalibration(), ToT shifts are not changed
+
+void hadaq::TdcProcessor::CheckRollingCalibration()
+{
+   if (fRollingIntegral.size() != NumChannels()*2*fNumFineBins) return;
+
+   bool changed = false, first = true;
+
+   // status and log reflect last update, problems reported by CalibrateIntegral()
+   auto roll = [&](unsigned ch, unsigned edge) -> bool {
+      if (first) {
+         fCalibrLog.clear();
+         fCalibrStatus = "Rolling";
+         fCalibrQuality = 1.;
+         first = false;
+      }
+      return RollChannelCalibration(ch, edge);
+   };
+
+   for (unsigned ch = 0; ch < NumChannels(); ch++) {
+      ChannelRec &rec = fCh[ch];
+      if (!rec.docalibr) continue;
+
+      bool rolled = false;
+
+      if (fEdgeMask == edge_CommonStatistic) {
+         if (fCalibrStat.GetAll(ch, 0) + fCalibrStat.GetAll(ch, 1) >= fRollingBlock) {
+            fCalibrStat.MergeEdges(ch);
+            rolled = roll(ch, 0);
+         }
+      } else {
+         if (DoRisingEdge() && (fCalibrStat.GetAll(ch, 0) >= fRollingBlock))
+            rolled = roll(ch, 0);
+         if (DoFallingEdge() && (fEdgeMask == edge_BothIndepend) && (fCalibrStat.GetAll(ch, 1) >= fRollingBlock))
+            if (roll(ch, 1)) rolled = true;
+      }
+
+      if (!rolled) continue;
+
+      rec.check_calibr = false;
+
+      if ((fEdgeMask == edge_CommonStatistic) || (fEdgeMask == edge_ForceRising)) {
+         rec.falling_calibr = rec.rising_calibr;
+         rec.calibr_stat_falling = rec.calibr_stat_rising;
+         rec.calibr_quality_falling = rec.calibr_quality_rising;
+      }
+
+      rec.hascalibr = (rec.rising_calibr.size() > 4) && (rec.falling_calibr.size() > 4);
+
+      changed = true;
+   }
+
+   if (!changed) return;
+
+   ResetHit2Table();
+
+   fCalibrProgress = 1.;
+
+   if (!fWriteCalibr.empty() && fWriteEveryTime)
+      StoreCalibration(fWriteCalibr);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// Start mode, when all data will be used for calibrations
 
@@ -1004,8 +1287,14 @@ float hadaq::TdcProcessor::ExtractCalibr(const std::vector<float> &func, unsigne
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// Method transform TDC data, if output specified, use it otherwise change original data
-
-unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_t *rawdata, unsigned indx, unsigned datalen, hadaqs::RawSubevent* tgt, unsigned tgtindx)
+///
+/// Without output hit messages replaced in place by hits with calibrated fine time (Hit2),
+/// all other words are not touched. Data can be in any byte order - as specified in subevent
+///
+/// When shard specified (called from worker thread), processor members are not changed -
+/// statistic and histograms content collected in the shard, see \ref MergeTransformShards
+
+unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_t *rawdata, unsigned indx, unsigned datalen, hadaqs::RawSubevent* tgt, unsigned tgtindx, int shard)
 {
    // do nothing in case of empty TDC sub-sub-event
    if (datalen == 0) return 0;
@@ -1019,6 +1308,9 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
    bool use_in_calibr = ((1 << sub->GetTrigTypeTrb3()) & fCalibrTriggerMask) != 0;
    bool is_0d_trig = (sub->GetTrigTypeTrb3() == 0xD);
+   bool swapped = sub->IsSwapped();
+
+   TransformShard *sh = (shard >= 0) && (shard < (int) fShards.size()) ? &fShards[shard] : nullptr;
 
    if (fAllCalibrMode == 0) {
       use_in_calibr = false;
@@ -1028,7 +1320,9 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
    // do not check progress value too often - this requires extra computations
    bool check_calibr_progress = false;
-   if (use_in_calibr) {
+   if (use_in_calibr && sh) {
+      sh->calibr_cnt++; // progress checked when shards are merged
+   } else if (use_in_calibr) {
       double limit = fCalibrCounts*0.07;
       if (limit < 50) limit = 50; else if (limit>1000) limit = 1000;
       if (++fCalibrAmount > limit) {
@@ -1039,15 +1333,54 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
    uint32_t epoch(0), chid, fine, kind, coarse(0), new_fine,
             idata, *tgtraw = tgt ? (uint32_t *) tgt->RawData() : 0;
-   bool isrising, hard_failure, fast_loop = HistFillLevel() < 2;
+   bool isrising, hard_failure, fast_loop = sh ? sh->rising_fine.empty() : HistFillLevel() < 2;
+   base::H1handle hkind = sh ? nullptr : fMsgsKind;
    double corr, ch0tm{0};
 
+   // in-place transformation without statistic and histograms done with Hit2 table for blocks of words,
+   // words which cannot be transformed with table are processed one by one by code below
+   // in worker thread table only used when prepared before
+   bool use_table = !tgt && !use_in_calibr && fast_loop && (sh ? fHit2TableReady : PrepareHit2Table()) && !fHit2Table.empty();
+   Hit2Args hit2args{fHit2Table.data(), NumChannels(), fNumFineBins, 0, 0};
+   Hit2BlockFunc hit2func = use_table ? GetHit2BlockFunc() : nullptr;
+   uint32_t blockmask = 0;
+   unsigned blockpos = 0;
+
    // if (fAllTotMode==1) printf("%s dtrig %d do_tot %d dofalling %d\n", GetName(), is_0d_trig, do_tot, DoFallingEdge());
 
    while (datalen-- > 0) {
 
+      if (use_table) {
+         if (blockpos == 0) {
+            if (datalen + 1 >= Hit2Block) {
+               blockmask = hit2func(rawdata + indx, swapped, hit2args);
+               blockpos = Hit2Block;
+            } else {
+               use_table = false; // rest of data processed one by one
+            }
+         }
+         if (use_table) {
+            if (blockmask == (1U << Hit2Block) - 1) {
+               // complete block transformed
+               indx += Hit2Block;
+               cnt += Hit2Block;
+               datalen -= Hit2Block - 1;
+               blockpos = 0;
+               continue;
+            }
+            blockpos--;
+            bool done = blockmask & 1;
+            blockmask >>= 1;
+            if (done) {
+               indx++;
+               cnt++;
+               continue;
+            }
+         }
+      }
+
       idata = rawdata[indx++];
-      msg.assign(HADAQ_SWAP4(idata));
+      msg.assign(swapped ? HADAQ_SWAP4(idata) : idata);
 
       cnt++;
 
@@ -1064,20 +1397,26 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
       if (kind == hadaq::tdckind_Hit) hitcnt++; else
       if (kind == hadaq::tdckind_Hit1) hit1cnt++; else {
+         if (sh) sh->msgs_kind[kind >> 29]++;
+
          if (kind == hadaq::tdckind_Epoch) {
             epoch = msg.getEpochValue();
             epochcnt++;
          } else if (kind == hadaq::tdckind_Calibr) {
-            DefFastFillH1(fMsgsKind, kind >> 29, 1);
+            DefFastFillH1(hkind, kind >> 29, 1);
             calibr.assign(msg.getData()); // copy message into
             calibr_indx = tgtindx;
             calibr_num = 0;
          } else if (kind == hadaq::tdckind_Header) {
-            DefFastFillH1(fMsgsKind, kind >> 29, 1);
-            if (use_in_calibr && fToTdflt && DoFallingEdge())
-               ConfigureToTByHwType(msg.getHeaderHwType());
+            DefFastFillH1(hkind, kind >> 29, 1);
+            if (use_in_calibr && fToTdflt && DoFallingEdge()) {
+               if (sh)
+                  sh->hwtype = msg.getHeaderHwType();
+               else
+                  ConfigureToTByHwType(msg.getHeaderHwType());
+            }
          } else {
-            DefFastFillH1(fMsgsKind, kind >> 29, 1);
+            DefFastFillH1(hkind, kind >> 29, 1);
          }
 
          if (tgtraw) tgtraw[tgtindx++] = idata; // tgt->SetData(tgtindx++, msg.getData());
@@ -1113,39 +1452,18 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
       if (!tgt) {
          coarse = msg.getHitTmCoarse();
-         if (isrising) {
-            // simple approach for rising edge - replace data in the source buffer
-            // value from 0 to 1000 is 5 ps unit, should be SUB from coarse time value
-            uint32_t new_fine = (uint32_t) (corr/5e-12);
-            if (new_fine>=1000) new_fine = 1000;
-            if (hard_failure) new_fine = 0x3ff;
-            msg.setAsHit2(new_fine);
-         } else {
-            // simple approach for falling edge - replace data in the source buffer
-            // value from 0 to 500 is 10 ps unit, should be SUB from coarse time value
-
-            unsigned corr_coarse = 0;
-            if (rec.tot_shift > 0) {
-               // if tot_shift calibrated (in ns), included it into correction
-               // in such case which should add correction into coarse counter
-               corr += rec.tot_shift*1e-9;
-               corr_coarse = (unsigned) (corr/5e-9);
-               corr -= corr_coarse*5e-9;
-            }
-
-            uint32_t new_fine = (uint32_t) (corr/10e-12);
-            if (new_fine>=500) new_fine = 500;
+         unsigned corr_coarse = 0;
+         new_fine = CalcHit2Fine(rec, corr, isrising, corr_coarse);
 
-            if (corr_coarse > coarse)
-               new_fine |= 0x200; // indicate that corrected time belongs to the previous epoch
+         if (corr_coarse > coarse)
+            new_fine |= 0x200; // indicate that corrected time belongs to the previous epoch
 
-            if (hard_failure) new_fine = 0x3ff;
+         if (hard_failure) new_fine = 0x3ff;
 
-            msg.setAsHit2(new_fine);
-            if (corr_coarse > 0)
-               msg.setHitTmCoarse(coarse - corr_coarse);
-         }
-         sub->SetData(indx-1, msg.getData());
+         msg.setAsHit2(new_fine);
+         if (corr_coarse > 0)
+            msg.setHitTmCoarse(coarse - corr_coarse);
+         rawdata[indx-1] = swapped ? HADAQ_SWAP4(msg.getData()) : msg.getData();
       } else {
          // copy data to the target, introduce extra messages with calibrated
 
@@ -1171,7 +1489,7 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
          // tgt->SetData(calibr_indx, calibr.getData());
          if (calibr_num == 2) {
-            tgtraw[calibr_indx] = HADAQ_SWAP4(calibr.getData());
+            tgtraw[calibr_indx] = swapped ? HADAQ_SWAP4(calibr.getData()) : calibr.getData();
             calibr_indx = 0;
             calibr_num = 0;
          }
@@ -1202,18 +1520,30 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
                } else {
                   nmatches = 1;
                }
-               rec.rising_stat[fine]++;
-               rec.all_rising_stat++;
-               rec.rising_last_tm = tm;
-               rec.rising_new_value = true;
+               if (sh) {
+                  sh->stat.Inc(chid, 0, fine);
+                  sh->rising_last_tm[chid] = tm;
+                  sh->rising_new_value[chid] = 1;
+               } else {
+                  fCalibrStat.Inc(chid, 0, fine);
+                  rec.rising_last_tm = tm;
+                  rec.rising_new_value = true;
+               }
             }
          } else {
             if (usehit) {
                nfalling++;
                if (nmatches == chid*2) nmatches++; else nmatches = 0;
-               rec.falling_stat[fine]++;
-               rec.all_falling_stat++;
-               if (rec.rising_new_value) {
+               if (sh) {
+                  sh->stat.Inc(chid, 1, fine);
+                  if (sh->rising_new_value[chid]) {
+                     sh->last_tot[chid] = (tm - sh->rising_last_tm[chid])*1e9 + rec.tot_shift;
+                     sh->rising_new_value[chid] = 0;
+                  }
+               } else {
+                  fCalibrStat.Inc(chid, 1, fine);
+               }
+               if (!sh && rec.rising_new_value) {
                   double tot = (tm - rec.rising_last_tm)*1e9;
 
                   // DefFillH1(rec.fTot, tot, 1.);
@@ -1226,7 +1556,7 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
          // trigger check of calibration only when enough statistic in that channel
          // done only once for specified channel
-         if (!check_calibr_progress && rec.docalibr && !rec.check_calibr && (fCalibrCounts > 0)) {
+         if (!sh && !check_calibr_progress && rec.docalibr && !rec.check_calibr && (fCalibrCounts > 0)) {
             long stat = CheckChannelStat(chid);
 
             // if ToT mode enabled, make first check at half of the statistic to make preliminary calibrations
@@ -1239,6 +1569,12 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
       if (fast_loop) continue;
 
+      if (sh) {
+         (isrising ? sh->rising_fine : sh->falling_fine)[chid*fNumFineBins + fine]++;
+         sh->coarse[chid*2048 + (coarse & 0x7ff)]++;
+         continue;
+      }
+
       FastFillH1(fChannels, chid);
       FastFillH1(fHits, (chid*2 + (isrising ? 0 : 1)));
       DefFastFillH2(fAllFine, chid, fine);
@@ -1255,10 +1591,51 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
 
    // if last calibration message not yet copied into output
    if ((calibr_num == 1) && tgtraw && calibr_indx) {
-      tgtraw[calibr_indx] = HADAQ_SWAP4(calibr.getData());
+      tgtraw[calibr_indx] = swapped ? HADAQ_SWAP4(calibr.getData()) : calibr.getData();
       calibr_indx = 0;
    }
 
+   // hits transformed with Hit2 table
+   hitcnt += hit2args.hitcnt;
+   hit1cnt += hit2args.hit1cnt;
+
+   if (sh) {
+      // histograms, ToT mode and calibration progress handled when shards are merged
+      sh->used = true;
+      sh->msgs_kind[hadaq::tdckind_Hit >> 29] += hitcnt;
+      sh->msgs_kind[hadaq::tdckind_Hit1 >> 29] += hit1cnt;
+      sh->msgcnt += cnt;
+      sh->hitcnt += hitcnt;
+      sh->errcnt += errcnt;
+
+      if ((hitcnt>0) && use_in_calibr && (fCurrentTemp>0)) {
+         sh->temp_sum0 += 1.;
+         sh->temp_sum1 += fCurrentTemp;
+         sh->temp_sum2 += fCurrentTemp*fCurrentTemp;
+      }
+
+      if (fAllCalibrMode > 0) {
+         if (!is_0d_trig && (nrising == nfalling) && (nrising+1 == NumChannels())) is_0d_trig = true;
+         if (!is_0d_trig && (nmatches > 16)) is_0d_trig = true;
+         if (is_0d_trig) sh->dtrig_cnt++;
+      }
+
+      if (use_in_calibr && is_0d_trig && DoFallingEdge() && (fAllTotMode==1))
+         for (unsigned ch=1;ch<NumChannels();ch++) {
+            float tot = sh->last_tot[ch];
+            if (fCh[ch].hascalibr && (tot >= fToThmin) && (tot < fToThmax)) {
+               int bin = (int) ((tot - fToThmin) / (fToThmax - fToThmin) * TotBins);
+               if (sh->tot0d_hist.empty()) sh->tot0d_hist.resize(NumChannels() * TotBins, 0);
+               sh->tot0d_hist[ch*TotBins + bin]++;
+            }
+
+            sh->last_tot[ch] = 0.;
+            sh->rising_new_value[ch] = 0;
+         }
+
+      return tgt ? (tgtindx - tgtindx0) : cnt;
+   }
+
    if (hitcnt) DefFastFillH1(fMsgsKind, hadaq::tdckind_Hit >> 29, hitcnt);
    if (hit1cnt) DefFastFillH1(fMsgsKind, hadaq::tdckind_Hit1 >> 29, hit1cnt);
    if (epochcnt) DefFastFillH1(fMsgsKind, hadaq::tdckind_Epoch >> 29, epochcnt);
@@ -1301,19 +1678,248 @@ unsigned hadaq::TdcProcessor::TransformTdcData(hadaqs::RawSubevent* sub, uint32_
          rec.rising_new_value = false;
       }
 
-   if (check_calibr_progress) {
-      fCalibrProgress = TestCanCalibrate(true, &fCalibrStatus);
-      fCalibrQuality = (fCalibrProgress > 2) ? 0.9 : 0.7 + fCalibrProgress*0.1;
+   if (check_calibr_progress)
+      CheckCalibrProgress();
+
+   return tgt ? (tgtindx - tgtindx0) : cnt;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Calculate fine value of Hit2 message for in-place transformation
+///
+/// For rising edge value from 0 to 1000 in 5 ps units, for falling edge from 0 to 500 in 10 ps units.
+/// Value should be subtracted from coarse time. If ToT shift is calibrated, it is included
+/// into correction and whole coarse units returned in corr_coarse
+
+uint32_t hadaq::TdcProcessor::CalcHit2Fine(const ChannelRec &rec, double corr, bool isrising, unsigned &corr_coarse)
+{
+   corr_coarse = 0;
+
+   if (isrising) {
+      uint32_t new_fine = (uint32_t) (corr/5e-12);
+      return new_fine >= 1000 ? 1000 : new_fine;
+   }
+
+   if (rec.tot_shift > 0) {
+      // if tot_shift calibrated (in ns), included it into correction
+      // in such case which should add correction into coarse counter
+      corr += rec.tot_shift*1e-9;
+      corr_coarse = (unsigned) (corr/5e-9);
+      corr -= corr_coarse*5e-9;
+   }
+
+   uint32_t new_fine = (uint32_t) (corr/10e-12);
+   return new_fine >= 500 ? 500 : new_fine;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Prepare table with Hit2 fine value and coarse correction for each channel, edge and fine counter
+///
+/// Table used for in-place transformation of blocks of hit messages in TransformTdcData.
+/// Entry has fine value in lower 10 bits and coarse correction in upper 6 bits.
+/// Table is rebuild only when calibrations were changed, see \ref ResetHit2Table.
+/// Returns false when table cannot be used - for instance, when ToT shift is too large
+
+bool hadaq::TdcProcessor::PrepareHit2Table()
+{
+   if (fHit2TableReady)
+      return !fHit2Table.empty();
+
+   fHit2TableReady = true;
+
+   // one extra entry to read last entry with 32-bit gather
+   fHit2Table.assign(NumChannels()*2*fNumFineBins + 1, 0);
+
+   for (unsigned ch = 0; ch < NumChannels(); ++ch) {
+      ChannelRec &rec = fCh[ch];
+
+      for (unsigned edge = 0; edge < 2; ++edge) {
+         bool isrising = (edge == 1);
+         const std::vector<float> &func = isrising ? rec.rising_calibr : rec.falling_calibr;
+
+         if ((func.size() > 100) ? (func.size() < fNumFineBins) : (func.size() < 5)) {
+            fHit2Table.clear();
+            return false;
+         }
+
+         uint16_t *entries = fHit2Table.data() + (ch*2 + edge)*fNumFineBins;
+
+         for (unsigned fine = 0; fine < fNumFineBins; ++fine) {
+            unsigned corr_coarse = 0;
+            uint32_t new_fine = CalcHit2Fine(rec, ExtractCalibrDirect(func, fine), isrising, corr_coarse);
+
+            if (corr_coarse > 0x3F) {
+               fHit2Table.clear();
+               return false;
+            }
 
-      if ((fAllTotMode == 0) && (fCalibrProgress >= 0.5)) {
-         ProduceCalibration(false, fUseLinear, false, true);
-         fAllTotMode = 1; // now can start accumulate ToT values
+            entries[fine] = new_fine | (corr_coarse << 10);
+         }
       }
+   }
 
-      if ((fCalibrProgress>=1.) && fAutoCalibr) PerformAutoCalibrate();
+   return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Check progress of calibration during data transformation
+/// Produce preliminary calibration for ToT mode or perform auto calibration when enough statistic accumulated
+
+void hadaq::TdcProcessor::CheckCalibrProgress()
+{
+   if ((fRollingBlock > 0) && (fAllCalibrMode <= 0)) {
+      CheckRollingCalibration();
+      return;
    }
 
-   return tgt ? (tgtindx - tgtindx0) : cnt;
+   fCalibrProgress = TestCanCalibrate(true, &fCalibrStatus);
+   fCalibrQuality = (fCalibrProgress > 2) ? 0.9 : 0.7 + fCalibrProgress*0.1;
+
+   if ((fAllTotMode == 0) && (fCalibrProgress >= 0.5)) {
+      ProduceCalibration(false, fUseLinear, false, true);
+      fAllTotMode = 1; // now can start accumulate ToT values
+   }
+
+   if ((fCalibrProgress>=1.) && fAutoCalibr) PerformAutoCalibrate();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Prepare statistic shards for parallel transformation - one shard per thread
+/// Must be called before threads are started, memory allocated only once
+
+void hadaq::TdcProcessor::PrepareTransformShards(unsigned numshards)
+{
+   // table can be used by worker threads only when build before
+   PrepareHit2Table();
+
+   if (fShards.size() != numshards)
+      fShards.resize(numshards);
+
+   unsigned numch = NumChannels();
+   bool hists = HistFillLevel() > 1;
+
+   for (auto &sh : fShards) {
+      if (sh.stat.NumChannels() != numch) {
+         sh.stat.Init(numch, fNumFineBins);
+         sh.rising_last_tm.assign(numch, 0.);
+         sh.rising_new_value.assign(numch, 0);
+         sh.last_tot.assign(numch, 0.);
+         sh.ResetCounters();
+      }
+
+      if (hists && sh.rising_fine.empty()) {
+         sh.rising_fine.assign(numch * fNumFineBins, 0);
+         sh.falling_fine.assign(numch * fNumFineBins, 0);
+         sh.coarse.assign(numch * 2048, 0);
+      }
+   }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Merge statistic of all shards into processor, fill histograms and check calibration progress
+/// Called when all threads of parallel transformation are finished
+
+void hadaq::TdcProcessor::MergeTransformShards()
+{
+   bool check_calibr_progress = false;
+
+   for (auto &sh : fShards) {
+      if (!sh.used) continue;
+
+      for (unsigned ch = 0; ch < NumChannels(); ch++) {
+         ChannelRec &rec = fCh[ch];
+
+         if (sh.stat.HasChannelStat(ch)) {
+            fCalibrStat.MoveChannelFrom(sh.stat, ch);
+
+            if (!check_calibr_progress && rec.docalibr && !rec.check_calibr && (fCalibrCounts > 0)) {
+               long stat = CheckChannelStat(ch);
+               if (stat >= fCalibrCounts * ((fAllTotMode==0) ? 0.5 : 1.)) {
+                  rec.check_calibr = true;
+                  check_calibr_progress = true;
+               }
+            }
+         }
+
+         if (!sh.tot0d_hist.empty()) {
+            uint32_t *tot = sh.tot0d_hist.data() + ch*TotBins;
+            for (unsigned n = 0; n < TotBins; n++)
+               if (tot[n]) {
+                  if (rec.tot0d_hist.empty()) rec.CreateToTHist();
+                  rec.tot0d_hist[n] += tot[n];
+                  rec.tot0d_cnt += tot[n];
+                  tot[n] = 0;
+               }
+         }
+
+         if (sh.rising_fine.empty()) continue;
+
+         uint32_t *rfine = sh.rising_fine.data() + ch*fNumFineBins,
+                  *ffine = sh.falling_fine.data() + ch*fNumFineBins,
+                  *coarse = sh.coarse.data() + ch*2048;
+
+         long nrising = 0, nfalling = 0;
+         for (unsigned n = 0; n < fNumFineBins; n++) {
+            nrising += rfine[n];
+            nfalling += ffine[n];
+         }
+         if (nrising + nfalling == 0) continue;
+
+         if ((HistFillLevel()>2) && ((rec.fRisingFine==0) || (rec.fFallingFine==0)))
+            CreateChannelHistograms(ch);
+
+         FastFillH1(fChannels, ch, nrising + nfalling);
+         FastFillH1(fHits, ch*2, nrising);
+         FastFillH1(fHits, ch*2 + 1, nfalling);
+
+         for (unsigned n = 0; n < fNumFineBins; n++) {
+            if (!rfine[n] && !ffine[n]) continue;
+            FillH2(fAllFine, ch, n, rfine[n] + ffine[n]);
+            if (rfine[n]) FastFillH1(rec.fRisingFine, n, rfine[n]);
+            if (ffine[n]) FastFillH1(rec.fFallingFine, n, ffine[n]);
+            rfine[n] = ffine[n] = 0;
+         }
+
+         for (unsigned n = 0; n < 2048; n++)
+            if (coarse[n]) {
+               FillH2(fAllCoarse, ch, n, coarse[n]);
+               coarse[n] = 0;
+            }
+      }
+
+      for (unsigned n = 0; n < 8; n++)
+         if (sh.msgs_kind[n]) DefFastFillH1(fMsgsKind, n, sh.msgs_kind[n]);
+
+      if (sh.msgcnt && fMsgPerBrd) FastFillH1(*fMsgPerBrd, fSeqeunceId, sh.msgcnt);
+      if (sh.hitcnt && fHitsPerBrd) FastFillH1(*fHitsPerBrd, fSeqeunceId, sh.hitcnt);
+      if (sh.errcnt && fErrPerBrd) FastFillH1(*fErrPerBrd, fSeqeunceId, sh.errcnt);
+
+      fCalibrTempSum0 += sh.temp_sum0;
+      fCalibrTempSum1 += sh.temp_sum1;
+      fCalibrTempSum2 += sh.temp_sum2;
+
+      if ((sh.hwtype >= 0) && fToTdflt && DoFallingEdge())
+         ConfigureToTByHwType(sh.hwtype);
+
+      fAllDTrigCnt += sh.dtrig_cnt;
+
+      if (sh.calibr_cnt > 0) {
+         double limit = fCalibrCounts*0.07;
+         if (limit < 50) limit = 50; else if (limit>1000) limit = 1000;
+         fCalibrAmount += sh.calibr_cnt;
+         if (fCalibrAmount > limit) {
+            fCalibrAmount = 0;
+            check_calibr_progress = true;
+         }
+      }
+
+      sh.ResetCounters();
+   }
+
+   if ((fAllCalibrMode > 0) && (fAllDTrigCnt>10) && (fAllTotMode<0)) fAllTotMode = 0;
+
+   if (check_calibr_progress)
+      CheckCalibrProgress();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -1672,6 +2278,7 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
    unsigned help_index(0);
 
    double localtm(0.), minimtm(0), ch0time(0);
+   base::PicoTime_t localps(0), ch0ps(0); // same as localtm and ch0time, used for reference channels
 
    hadaq::TdcMessage& msg = iter.msg();
    hadaq::TdcMessage calibr;
@@ -1750,8 +2357,10 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
             unsigned epoch = iter.isCurEpoch() ? iter.getCurEpoch() : 0;
 
             localtm = ((epoch << 12) | coarse25) * 1000. / fCustomMhz * 1e-9;
+            localps = base::SecondsToPico(localtm);
          } else {
             localtm = iter.getMsgTimeCoarse();
+            localps = iter.getMsgTimeCoarsePs();
          }
 
          if (chid >= NumChannels()) {
@@ -1831,14 +2440,16 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
 
          // apply correction
          localtm -= corr;
+         localps -= base::SecondsToPico(corr);
 
-         if ((chid==0) && (ch0time==0)) ch0time = localtm;
+         if ((chid==0) && (ch0time==0)) { ch0time = localtm; ch0ps = localps; }
 
          if (IsTriggeredAnalysis()) {
             if (ch0time==0)
                ADDERROR(errCh0, "channel 0 time not found when first HIT in channel %u appears", chid);
 
             localtm -= ch0time;
+            localps -= ch0ps;
          }
 
          // printf("%s first %d ch %3u tm %12.9f\n", GetName(), first_scan, chid, localtm);
@@ -1886,8 +2497,7 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
                   switch (use_for_calibr) {
                      case 1:
                      case 3:
-                        rec.rising_stat[fine]++;
-                        rec.all_rising_stat++;
+                        fCalibrStat.Inc(chid, 0, fine);
                         if (fCalHitsPerBrd) DefFillH2(*fCalHitsPerBrd, fSeqeunceId, chid, 1.); // accumulate only rising edges
                         break;
                      case 2:
@@ -1907,6 +2517,7 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
 
                if (use_for_ref && ((rec.rising_hit_tm == 0.) || fUseLastHit)) {
                   rec.rising_hit_tm = (chid > 0) ? localtm : ch0time;
+                  rec.rising_hit_ps = (chid > 0) ? localps : ch0ps;
                   rec.rising_coarse = coarse;
                   rec.rising_fine = fine;
 
@@ -1942,8 +2553,7 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
                   switch (use_for_calibr) {
                      case 1:
                      case 3:
-                        rec.falling_stat[fine]++;
-                        rec.all_falling_stat++;
+                        fCalibrStat.Inc(chid, 1, fine);
                         break;
                      case 2:
                         rec.last_falling_fine = fine;
@@ -1977,6 +2587,9 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
                hitcnt++;
                if ((minimtm==0) || (localtm < minimtm)) minimtm = localtm;
 
+               if (isrising && IsCoincidenceChannel(chid))
+                  AddCoincidenceHit(chid, localtm);
+
                if (dostore)
                   switch(GetStoreKind()) {
                      case 1:
@@ -2074,14 +2687,12 @@ bool hadaq::TdcProcessor::DoBufferScan(const base::Buffer& buf, bool first_scan)
          for (unsigned ch=0;ch<NumChannels();ch++) {
             ChannelRec& rec = fCh[ch];
             if (rec.last_rising_fine > 0) {
-               rec.rising_stat[rec.last_rising_fine]++;
-               rec.all_rising_stat++;
+               fCalibrStat.Inc(ch, 0, rec.last_rising_fine);
                rec.last_rising_fine = 0;
                if (fCalHitsPerBrd) DefFillH2(*fCalHitsPerBrd, fSeqeunceId, ch, 1.); // accumulate only rising edges
             }
             if (rec.last_falling_fine > 0) {
-               rec.falling_stat[rec.last_falling_fine]++;
-               rec.all_falling_stat++;
+               fCalibrStat.Inc(ch, 1, rec.last_falling_fine);
                rec.last_falling_fine = 0;
             }
          }
@@ -2274,6 +2885,7 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
    unsigned help_index(0);
 
    double localtm(0.), minimtm(0), ch0time(0);
+   base::PicoTime_t localps(0), ch0ps(0); // same as localtm and ch0time, used for reference channels
 
    hadaq::TdcMessage& msg = iter.msg();
    hadaq::TdcMessage calibr;
@@ -2409,6 +3021,7 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
          // localtm = iter.getMsgTimeCoarse();
 
          localtm = (((uint64_t) iter.getCurEpoch()) << 12 | coarse) * hadaq::TdcMessage::CoarseUnit280(); // 280 MHz
+         localps = base::SecondsToPico(localtm); // 280 MHz period is not integer number of ps
 
          if (chid >= NumChannels()) {
             ADDERROR(errChId, "Channel number %u bigger than configured %u", chid, NumChannels());
@@ -2462,14 +3075,16 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
 
          // apply correction
          localtm -= corr;
+         localps -= base::SecondsToPico(corr);
 
-         if ((chid==0) && (ch0time==0) && isrising) ch0time = localtm;
+         if ((chid==0) && (ch0time==0) && isrising) { ch0time = localtm; ch0ps = localps; }
 
          if (IsTriggeredAnalysis()) {
             if (ch0time==0)
                ADDERROR(errCh0, "channel 0 time not found when first HIT in channel %u appears", chid);
 
             localtm -= ch0time;
+            localps -= ch0ps;
          }
 
          // printf("%s first %d ch %3u tm %12.9f\n", GetName(), first_scan, chid, localtm);
@@ -2512,8 +3127,7 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
                   switch (use_for_calibr) {
                      case 1:
                      case 3:
-                        rec.rising_stat[fine]++;
-                        rec.all_rising_stat++;
+                        fCalibrStat.Inc(chid, 0, fine);
                         if (fCalHitsPerBrd) DefFillH2(*fCalHitsPerBrd, fSeqeunceId, chid, 1.); // accumulate only rising edges
                         break;
                      case 2:
@@ -2533,6 +3147,7 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
 
                if (use_for_ref && ((rec.rising_hit_tm == 0.) || fUseLastHit)) {
                   rec.rising_hit_tm = (chid > 0) ? localtm : ch0time;
+                  rec.rising_hit_ps = (chid > 0) ? localps : ch0ps;
                   rec.rising_coarse = coarse;
                   rec.rising_fine = fine;
 
@@ -2568,8 +3183,7 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
                   switch (use_for_calibr) {
                      case 1:
                      case 3:
-                        rec.falling_stat[fine]++;
-                        rec.all_falling_stat++;
+                        fCalibrStat.Inc(chid, 1, fine);
                         break;
                      case 2:
                         rec.last_falling_fine = fine;
@@ -2603,6 +3217,9 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
                hitcnt++;
                if ((minimtm==0) || (localtm < minimtm)) minimtm = localtm;
 
+               if (isrising && IsCoincidenceChannel(chid))
+                  AddCoincidenceHit(chid, localtm);
+
                if (dostore)
                   switch(GetStoreKind()) {
                      case 1:
@@ -2669,14 +3286,12 @@ bool hadaq::TdcProcessor::DoBuffer4Scan(const base::Buffer& buf, bool first_scan
          for (unsigned ch=0;ch<NumChannels();ch++) {
             ChannelRec& rec = fCh[ch];
             if (rec.last_rising_fine > 0) {
-               rec.rising_stat[rec.last_rising_fine]++;
-               rec.all_rising_stat++;
+               fCalibrStat.Inc(ch, 0, rec.last_rising_fine);
                rec.last_rising_fine = 0;
                if (fCalHitsPerBrd) DefFillH2(*fCalHitsPerBrd, fSeqeunceId, ch, 1.); // accumulate only rising edges
             }
             if (rec.last_falling_fine > 0) {
-               rec.falling_stat[rec.last_falling_fine]++;
-               rec.all_falling_stat++;
+               fCalibrStat.Inc(ch, 1, rec.last_falling_fine);
                rec.last_falling_fine = 0;
             }
          }
@@ -2993,23 +3608,53 @@ void hadaq::TdcProcessor::SetLinearCalibration(unsigned nch, unsigned finemin, u
 {
    if (nch < NumChannels())
       fCh[nch].SetLinearCalibr(finemin, finemax);
+
+   ResetHit2Table();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Set channel TOT shift in nano-seconds, typical value is around 30 ns
+///
+/// Shift is included into Hit2 table, therefore table will be rebuild
+
+void hadaq::TdcProcessor::SetChannelTotShift(unsigned ch, float tot_shift)
+{
+   if (ch < NumChannels())
+      fCh[ch].tot_shift = tot_shift;
+
+   ResetHit2Table();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// Calibrate channel
 
 double hadaq::TdcProcessor::CalibrateChannel(unsigned nch, bool rising, const std::vector<uint32_t> &statistic, std::vector<float> &calibr, bool use_linear, bool preliminary)
+{
+   std::vector<double> integral(fNumFineBins, 0.);
+   double sum = 0.;
+   for (unsigned n=0;n<fNumFineBins;n++) {
+      sum += statistic[n];
+      integral[n] = sum;
+   }
+
+   return CalibrateIntegral(nch, rising, integral.data(), calibr, use_linear, preliminary);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Calibrate channel from cumulative integral of fine counter statistic
+///
+/// Integral may be non-integer like decayed integral of rolling calibration.
+/// Half of bin content rounded down - as integer division of statistic done before
+
+double hadaq::TdcProcessor::CalibrateIntegral(unsigned nch, bool rising, const double *integral, std::vector<float> &calibr, bool use_linear, bool preliminary)
 {
    double sum(0.), limits(use_linear ? 100 : 1000);
    unsigned finemin(0), finemax(0);
-   std::vector<double> integral(fNumFineBins, 0.);
    for (unsigned n=0;n<fNumFineBins;n++) {
-      if (statistic[n]) {
+      if (integral[n] > sum) {
          if (sum == 0.) finemin = n; else finemax = n;
       }
-
-      sum += statistic[n];
-      integral[n] = sum;
+      sum = integral[n];
    }
 
 /*   if (sum <= limits) {
@@ -3088,7 +3733,7 @@ double hadaq::TdcProcessor::CalibrateChannel(unsigned nch, bool rising, const st
          double ksum1 = 0., ksum2 = 0.;
 
          for (int fine = fine_last+1; fine <= fine_next; fine++) {
-            double exact = ((integral[fine] - statistic[fine]/2) / sum) * coarse_unit;
+            double exact = ((integral[fine] - std::floor((integral[fine] - integral[fine-1])/2)) / sum) * coarse_unit;
             ksum1 = (fine - fine_last) * (exact - calibr[indx+1]); // sum (dx*dy)
             ksum2 = (fine - fine_last) * (fine - fine_last);       // sum (dx*dx)
          }
@@ -3140,14 +3785,15 @@ double hadaq::TdcProcessor::CalibrateChannel(unsigned nch, bool rising, const st
 
          sum1 += 1.;
 
-         exact = (integral[n] - statistic[n]/2) / sum;
+         exact = (integral[n] - std::floor((integral[n] - (n > 0 ? integral[n-1] : 0.))/2)) / sum;
          sum2 += (exact - linear) * (exact - linear);
          calibr[n] = exact * coarse_unit;
       }
 
       if (!preliminary && (sum1>100)) {
          double dev = sqrt(sum2/sum1); // average deviation
-         printf("%s ch %u cnts %5.0f deviation %5.4f\n", GetName(), nch, sum, dev);
+         if (!IsRollingCalibration())
+            printf("%s ch %u cnts %5.0f deviation %5.4f\n", GetName(), nch, sum, dev);
          if (dev > 0.05) {
             err_log.append("_NonLinear");
             if (quality > 0.6) quality = 0.6;
@@ -3265,6 +3911,10 @@ void hadaq::TdcProcessor::CopyCalibration(const std::vector<float> &calibr, base
 
 void hadaq::TdcProcessor::ProduceCalibration(bool clear_stat, bool use_linear, bool dummy, bool preliminary)
 {
+   STREAM_PROFILE("Calibration", this);
+
+   ResetHit2Table();
+
    std::string log_msg;
    if (!preliminary) {
       if (fCalibrProgress >= 1) {
@@ -3315,6 +3965,8 @@ void hadaq::TdcProcessor::ProduceCalibration(bool clear_stat, bool use_linear, b
       ClearH1(fTotShifts);
    }
 
+   std::vector<uint32_t> stat; // statistic of single channel and edge
+
    for (unsigned ch=0;ch<NumChannels();ch++) {
 
       ChannelRec &rec = fCh[ch];
@@ -3330,28 +3982,25 @@ void hadaq::TdcProcessor::ProduceCalibration(bool clear_stat, bool use_linear, b
 
          // special case - use common statistic
          if (fEdgeMask == edge_CommonStatistic) {
-            rec.all_rising_stat += rec.all_falling_stat;
-            if (fCalHitsPerBrd) DefFillH2(*fCalHitsPerBrd, fSeqeunceId, ch, rec.all_falling_stat); // add all falling edges
-            rec.all_falling_stat = 0;
-            for (unsigned n=0;n<fNumFineBins;n++) {
-               rec.rising_stat[n] += rec.falling_stat[n];
-               rec.falling_stat[n] = 0;
-            }
+            if (fCalHitsPerBrd) DefFillH2(*fCalHitsPerBrd, fSeqeunceId, ch, fCalibrStat.GetAll(ch, 1)); // add all falling edges
+            fCalibrStat.MergeEdges(ch);
          }
 
-         // printf("%s Ch:%d do: %d %d stat: %ld %ld mask %d\n", GetName(), ch, DoRisingEdge(), DoFallingEdge(), rec.all_rising_stat, rec.all_falling_stat, fEdgeMask);
+         // printf("%s Ch:%d do: %d %d stat: %ld %ld mask %d\n", GetName(), ch, DoRisingEdge(), DoFallingEdge(), fCalibrStat.GetAll(ch, 0), fCalibrStat.GetAll(ch, 1), fEdgeMask);
 
          bool res = false;
 
-         if (DoRisingEdge() && (rec.all_rising_stat > 0)) {
-            rec.calibr_quality_rising = CalibrateChannel(ch, true, rec.rising_stat, rec.rising_calibr, use_linear, preliminary);
-            rec.calibr_stat_rising = rec.all_rising_stat;
+         if (DoRisingEdge() && (fCalibrStat.GetAll(ch, 0) > 0)) {
+            fCalibrStat.Fill(ch, 0, stat);
+            rec.calibr_quality_rising = CalibrateChannel(ch, true, stat, rec.rising_calibr, use_linear, preliminary);
+            rec.calibr_stat_rising = fCalibrStat.GetAll(ch, 0);
             res = (rec.calibr_quality_rising > 0.5);
          }
 
-         if (DoFallingEdge() && (rec.all_falling_stat > 0) && (fEdgeMask == edge_BothIndepend)) {
-            rec.calibr_quality_falling = CalibrateChannel(ch, false, rec.falling_stat, rec.falling_calibr, use_linear, preliminary);
-            rec.calibr_stat_falling = rec.all_falling_stat;
+         if (DoFallingEdge() && (fCalibrStat.GetAll(ch, 1) > 0) && (fEdgeMask == edge_BothIndepend)) {
+            fCalibrStat.Fill(ch, 1, stat);
+            rec.calibr_quality_falling = CalibrateChannel(ch, false, stat, rec.falling_calibr, use_linear, preliminary);
+            rec.calibr_stat_falling = fCalibrStat.GetAll(ch, 1);
             if (rec.calibr_quality_falling <= 0.5) res = false;
          }
 
@@ -3417,23 +4066,26 @@ void hadaq::TdcProcessor::FillToTHistogram()
 
 void hadaq::TdcProcessor::ClearChannelStat(unsigned ch)
 {
-   for (unsigned n=0;n<fNumFineBins;n++) {
-      fCh[ch].falling_stat[n] = 0;
-      fCh[ch].rising_stat[n] = 0;
-   }
-   fCh[ch].all_falling_stat = 0;
-   fCh[ch].all_rising_stat = 0;
+   fCalibrStat.ClearChannel(ch);
    fCh[ch].tot0d_cnt = 0;
    fCh[ch].ReleaseToTHist();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// For expert use - store calibration in the file
+/// If name has ".caldb" suffix, calibration stored in the database, see hadaq::CalibrDb
 
 void hadaq::TdcProcessor::StoreCalibration(const std::string& fprefix, unsigned fileid)
 {
    if (fprefix.empty()) return;
 
+   if (CalibrDb::IsDbName(fprefix)) {
+      AttachCalibrDb(fprefix);
+      StoreCalibrationDb(*fCalibrDb);
+      fCalibrDb->WriteWhenReady();
+      return;
+   }
+
    if (fileid == 0) fileid = GetID();
    char fname[1024];
    snprintf(fname, sizeof(fname), "%s%04x.cal", fprefix.c_str(), fileid);
@@ -3664,11 +4316,19 @@ void hadaq::TdcProcessor::CreateV4CalibrTable(unsigned ch, uint32_t *table)
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// Load calibration from the file
+/// If name has ".caldb" suffix, calibration loaded from the database, see hadaq::CalibrDb
 
 bool hadaq::TdcProcessor::LoadCalibration(const std::string& fprefix)
 {
    if (fprefix.empty()) return false;
 
+   if (CalibrDb::IsDbName(fprefix)) {
+      AttachCalibrDb(fprefix);
+      if (!fCalibrDb->IsOpened() && !fCalibrDb->Open())
+         return false;
+      return LoadCalibrationDb(*fCalibrDb);
+   }
+
    char fname[1024];
 
    snprintf(fname, sizeof(fname), "%s%04x.cal", fprefix.c_str(), GetID());
@@ -3679,6 +4339,8 @@ bool hadaq::TdcProcessor::LoadCalibration(const std::string& fprefix)
       return false;
    }
 
+   ResetHit2Table();
+
    uint64_t num(0);
 
    fread(&num, sizeof(num), 1, f);
@@ -3691,37 +4353,29 @@ bool hadaq::TdcProcessor::LoadCalibration(const std::string& fprefix)
       printf("%s in file %s mismatch of channels number in calibrations  %u and in processor %u\n", GetName(), fname, (unsigned) num, NumChannels());
    }
 
-   for (unsigned ch=0;ch<num;ch++) {
-     fCh[ch].hascalibr = false;
+   // read calibration curve, first value defines number of points, 0 means full table
+   auto read_calibr = [this, f](std::vector<float> &calibr) {
+      calibr.clear();
+      float val0 = 0.;
+      if (fread(&val0, sizeof(float), 1, f) != 1) return;
+      calibr.resize(val0 ? 1 + ((int)val0)*2 : fNumFineBins);
+      calibr[0] = val0;
+      fread(calibr.data()+1, sizeof(float)*(calibr.size()-1), 1, f);
+   };
 
+   std::vector<float> skip_calibr;
+
+   for (unsigned ch=0;ch<num;ch++) {
      if (ch>=NumChannels()) {
-        fseek(f, 2*sizeof(float)*fNumFineBins, SEEK_CUR);
+        read_calibr(skip_calibr);
+        read_calibr(skip_calibr);
         continue;
      }
 
-     fCh[ch].rising_calibr.clear();
-     fCh[ch].falling_calibr.clear();
-
-     float val0 = 0.;
-     if (fread(&val0, sizeof(float), 1, f) == 1) {
-        if (val0) {
-           fCh[ch].rising_calibr.resize(1 + ((int)val0)*2);
-        } else{
-           fCh[ch].rising_calibr.resize(fNumFineBins);
-        }
-        fCh[ch].rising_calibr[0] = val0;
-        fread(fCh[ch].rising_calibr.data()+1, sizeof(float)*(fCh[ch].rising_calibr.size()-1), 1, f);
-     }
+     fCh[ch].hascalibr = false;
 
-     if (fread(&val0, sizeof(float), 1, f) == 1) {
-        if (val0) {
-           fCh[ch].falling_calibr.resize(1 + ((int)val0)*2);
-        } else{
-           fCh[ch].falling_calibr.resize(fNumFineBins);
-        }
-        fCh[ch].falling_calibr[0] = val0;
-        fread(fCh[ch].falling_calibr.data()+1, sizeof(float)*(fCh[ch].falling_calibr.size()-1), 1, f);
-     }
+     read_calibr(fCh[ch].rising_calibr);
+     read_calibr(fCh[ch].falling_calibr);
 
      fCh[ch].hascalibr = (fCh[ch].rising_calibr.size() > 4) && (fCh[ch].falling_calibr.size() > 4);
 
@@ -3732,12 +4386,12 @@ bool hadaq::TdcProcessor::LoadCalibration(const std::string& fprefix)
 
    if (!feof(f)) {
       for (unsigned ch=0;ch<num;ch++) {
-         if (ch>=NumChannels())
+         if (ch>=NumChannels()) {
             fseek(f, sizeof(fCh[0].tot_shift), SEEK_CUR);
-         else
+         } else {
             fread(&(fCh[ch].tot_shift), sizeof(fCh[ch].tot_shift), 1, f);
-
-         DefFillH1(fTotShifts, ch, fCh[ch].tot_shift);
+            DefFillH1(fTotShifts, ch, fCh[ch].tot_shift);
+         }
       }
 
       if (!feof(f)) {
@@ -3779,6 +4433,159 @@ bool hadaq::TdcProcessor::LoadCalibration(const std::string& fprefix)
    return true;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Use calibration database with specified file name
+/// Database shared with all other TDCs using same file, file written when all TDCs provided calibrations
+
+void hadaq::TdcProcessor::AttachCalibrDb(const std::string &fname)
+{
+   if (fCalibrDb && (fCalibrDb->GetFileName() == fname)) return;
+
+   DetachCalibrDb();
+
+   fCalibrDb = CalibrDb::Get(fname);
+   fCalibrDb->Attach();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Release calibration database, pending calibrations may be written
+
+void hadaq::TdcProcessor::DetachCalibrDb()
+{
+   if (!fCalibrDb) return;
+
+   fCalibrDb->Detach();
+   fCalibrDb.reset();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Store calibration as block in calibration database
+/// Block contains all channels records and all calibration curves, see hadaq::CalibrDbTdc
+
+void hadaq::TdcProcessor::StoreCalibrationDb(CalibrDb &db)
+{
+   uint64_t sz = sizeof(CalibrDbTdc) + NumChannels()*sizeof(CalibrDbChannel);
+   for (unsigned ch = 0; ch < NumChannels(); ch++)
+      sz += (fCh[ch].rising_calibr.size() + fCh[ch].falling_calibr.size()) * sizeof(float);
+
+   std::vector<char> blk(sz, 0);
+
+   CalibrDbTdc *tdc = (CalibrDbTdc *) blk.data();
+   tdc->tdcid = GetID();
+   tdc->numch = NumChannels();
+   tdc->numfine = fNumFineBins;
+   tdc->flags = fVersion4 ? 1 : 0;
+   tdc->temp = fCalibrTemp;
+   tdc->tempcoef = fCalibrTempCoef;
+
+   CalibrDbChannel *chrec = (CalibrDbChannel *) (tdc + 1);
+   float *data = (float *) (chrec + NumChannels());
+
+   for (unsigned ch = 0; ch < NumChannels(); ch++, chrec++) {
+      ChannelRec &rec = fCh[ch];
+      chrec->rising_len = rec.rising_calibr.size();
+      chrec->falling_len = rec.falling_calibr.size();
+      chrec->stat_rising = rec.calibr_stat_rising;
+      chrec->stat_falling = rec.calibr_stat_falling;
+      chrec->quality_rising = rec.calibr_quality_rising;
+      chrec->quality_falling = rec.calibr_quality_falling;
+      chrec->tot_shift = rec.tot_shift;
+      chrec->tot_dev = rec.tot_dev;
+      chrec->time_shift_per_grad = rec.time_shift_per_grad;
+      chrec->trig0d_coef = rec.trig0d_coef;
+
+      memcpy(data, rec.rising_calibr.data(), rec.rising_calibr.size()*sizeof(float));
+      data += rec.rising_calibr.size();
+      memcpy(data, rec.falling_calibr.data(), rec.falling_calibr.size()*sizeof(float));
+      data += rec.falling_calibr.size();
+   }
+
+   printf("%s storing calibration in %s\n", GetName(), db.GetFileName().c_str());
+
+   db.SetTdcBlock(GetID(), blk);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Load calibration from calibration database
+/// Length of every calibration curve stored in the block, therefore full tables
+/// with other number of fine bins can be read - they are cut or extended with last value
+
+bool hadaq::TdcProcessor::LoadCalibrationDb(const CalibrDb &db)
+{
+   uint32_t blksize = 0;
+   const CalibrDbTdc *tdc = db.FindTdc(GetID(), &blksize);
+   if (!tdc) {
+      printf("%s no calibration in database %s\n", GetName(), db.GetFileName().c_str());
+      return false;
+   }
+
+   const CalibrDbChannel *chrec = (const CalibrDbChannel *) (tdc + 1);
+   const float *data = (const float *) (chrec + tdc->numch),
+               *data_end = (const float *) ((const char *) tdc + blksize);
+
+   if ((const char *) data > (const char *) data_end) {
+      printf("%s wrong calibration block in database %s\n", GetName(), db.GetFileName().c_str());
+      return false;
+   }
+
+   if (tdc->numch != NumChannels())
+      printf("%s in database %s mismatch of channels number in calibrations  %u and in processor %u\n", GetName(), db.GetFileName().c_str(), (unsigned) tdc->numch, NumChannels());
+
+   ResetHit2Table();
+
+   ClearH2(fRisingCalibr);
+   ClearH2(fFallingCalibr);
+   ClearH1(fTotShifts);
+
+   // copy calibration curve, full table adjusted to number of fine bins
+   auto copy_calibr = [this](std::vector<float> &calibr, const float *src, uint32_t len) {
+      calibr.assign(src, src + len);
+      if ((len > 0) && (src[0] == 0) && (len != fNumFineBins))
+         calibr.resize(fNumFineBins, calibr.back());
+   };
+
+   for (unsigned ch = 0; ch < tdc->numch; ch++, chrec++) {
+      if (data + chrec->rising_len + chrec->falling_len > data_end) {
+         printf("%s calibration of channel %u outside block in database %s\n", GetName(), ch, db.GetFileName().c_str());
+         return false;
+      }
+
+      if (ch < NumChannels()) {
+         ChannelRec &rec = fCh[ch];
+
+         copy_calibr(rec.rising_calibr, data, chrec->rising_len);
+         copy_calibr(rec.falling_calibr, data + chrec->rising_len, chrec->falling_len);
+
+         rec.hascalibr = (rec.rising_calibr.size() > 4) && (rec.falling_calibr.size() > 4);
+         rec.calibr_stat_rising = chrec->stat_rising;
+         rec.calibr_stat_falling = chrec->stat_falling;
+         rec.calibr_quality_rising = chrec->quality_rising;
+         rec.calibr_quality_falling = chrec->quality_falling;
+         rec.tot_shift = chrec->tot_shift;
+         rec.tot_dev = chrec->tot_dev;
+         rec.time_shift_per_grad = chrec->time_shift_per_grad;
+         rec.trig0d_coef = chrec->trig0d_coef;
+
+         CopyCalibration(rec.rising_calibr, rec.fRisingCalibr, ch, fRisingCalibr);
+         CopyCalibration(rec.falling_calibr, rec.fFallingCalibr, ch, fFallingCalibr);
+         DefFillH1(fTotShifts, ch, rec.tot_shift);
+      }
+
+      data += chrec->rising_len + chrec->falling_len;
+   }
+
+   fCalibrTemp = tdc->temp;
+   fCalibrTempCoef = tdc->tempcoef;
+
+   printf("%s reading calibration from %s uset:%d done\n", GetName(), db.GetFileName().c_str(), fCalibrUseTemp);
+
+   fCalibrStatus = "CalibrFile";
+
+   fCalibrQuality = 0.99;
+
+   return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 /// For expert use - artificially set calibration statistic
 
@@ -3786,15 +4593,11 @@ void hadaq::TdcProcessor::IncCalibration(unsigned ch, bool rising, unsigned fine
 {
    if ((ch>=NumChannels()) || (fine>=fNumFineBins)) return;
 
-   if (rising && DoRisingEdge()) {
-      fCh[ch].rising_stat[fine] += value;
-      fCh[ch].all_rising_stat += value;
-   }
+   if (rising && DoRisingEdge())
+      fCalibrStat.Add(ch, 0, fine, value);
 
-   if (!rising && DoFallingEdge()) {
-      fCh[ch].falling_stat[fine] += value;
-      fCh[ch].all_falling_stat += value;
-   }
+   if (!rising && DoFallingEdge())
+      fCalibrStat.Add(ch, 1, fine, value);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
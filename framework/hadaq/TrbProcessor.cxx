@@ -5,6 +5,7 @@
 
 #include "base/defines.h"
 #include "base/ProcMgr.h"
+#include "base/HierProfiler.h"
 
 #include "hadaq/TrbIterator.h"
 #include "hadaq/TdcProcessor.h"
@@ -15,6 +16,7 @@
 unsigned hadaq::TrbProcessor::gNumChannels = 65;
 unsigned hadaq::TrbProcessor::gEdgesMask = 0x1;
 bool hadaq::TrbProcessor::gIgnoreSync = false;
+bool hadaq::TrbProcessor::gDirectScan = true;
 unsigned hadaq::TrbProcessor::gTDCMin = 0x0000;
 unsigned hadaq::TrbProcessor::gTDCMax = 0x0FFF;
 unsigned hadaq::TrbProcessor::gHUBMin = 0x8100;
@@ -67,7 +69,6 @@ hadaq::TrbProcessor::TrbProcessor(unsigned brdid, HldProcessor* hldproc, int hfi
 
    // printf("Create TrbProcessor %s\n", GetName());
 
-   fMinTdc = fMaxTdc = 0;
    fCurrentRunId = 0;
    fCurrentEventId = 0;
 
@@ -112,8 +113,6 @@ hadaq::TrbProcessor::TrbProcessor(unsigned brdid, HldProcessor* hldproc, int hfi
 
    // only raw scan, data can be immediately removed
    SetRawScanOnly();
-
-//   fProfiler.Reserve(50);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -188,8 +187,6 @@ void hadaq::TrbProcessor::UserPreLoop()
 {
    if (fMap.size() > 0)
       CreatePerTDCHistos();
-
-   // fProfiler.MakeStatistic();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -197,8 +194,6 @@ void hadaq::TrbProcessor::UserPreLoop()
 
 void hadaq::TrbProcessor::UserPostLoop()
 {
-   // fProfiler.MakeStatistic();
-   // printf("TRB PROFILER: %s\n", fProfiler.Format().c_str());
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -271,6 +266,17 @@ void hadaq::TrbProcessor::SetAutoCalibrations(long cnt)
    }
 }
 
+//////////////////////////////////////////////////////////////////////////////
+/// Enable rolling calibration for all existing TDCs, see TdcProcessor::SetRollingCalibration()
+
+void hadaq::TrbProcessor::SetRollingCalibrations(long block, float decay)
+{
+   for (auto &entry : fMap) {
+      if (entry.second->IsTDC())
+        ((TdcProcessor*)entry.second)->SetRollingCalibration(block, decay);
+   }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 /// Disable calibration of specified channels for all existing TDCs
 
@@ -350,6 +356,7 @@ void hadaq::TrbProcessor::SetCalibrTriggerMask(unsigned trigmask)
 void hadaq::TrbProcessor::AddSub(SubProcessor* tdc, unsigned id)
 {
    fMap[id] = tdc;
+   fDispatchReady = false;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -488,9 +495,10 @@ void hadaq::TrbProcessor::BeforeEventScan()
 
 void hadaq::TrbProcessor::AfterEventScan()
 {
-   // scan all new data
+   // scan all new data, sub-processors without queued buffers were already scanned directly
    for (auto &entry : fMap)
-      entry.second->ScanNewBuffers();
+      if (IsStreamAnalysis() || entry.second->HasNewBuffers())
+         entry.second->ScanNewBuffers();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -500,8 +508,10 @@ void hadaq::TrbProcessor::AfterEventFill()
 {
    // after scan data, fill extra histograms
    if (IsCrossProcess()) {
-      for (auto &entry : fMap)
+      for (auto &entry : fMap) {
+         STREAM_PROFILE("AfterFill", entry.second);
          entry.second->AfterFill(&fMap);
+      }
    }
 }
 
@@ -548,6 +558,8 @@ void hadaq::TrbProcessor::AddBufferToTDC(hadaqs::RawSubevent* sub,
       return;
    }
 
+   if (DirectScanTDC(sub, tdcproc, ix, datalen)) return;
+
    base::Buffer buf;
 
    if (gIgnoreSync && (sub->Alignment()==4)) {
@@ -570,6 +582,48 @@ void hadaq::TrbProcessor::AddBufferToTDC(hadaqs::RawSubevent* sub,
    tdcproc->SetNewDataFlag(true);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+/// Scan sub-processor data directly in the subevent memory
+///
+/// Used in triggered and raw analysis, where buffer is scanned only once and
+/// never kept in the processor queue. Same buffer descriptor is reused for all calls,
+/// therefore no memory allocation and no queue operations are performed.
+/// Returns false if direct scan is not possible and normal buffer should be used
+
+bool hadaq::TrbProcessor::DirectScanTDC(hadaqs::RawSubevent* sub,
+                                        hadaq::SubProcessor* tdcproc,
+                                        unsigned ix, unsigned datalen)
+{
+   if (!gDirectScan || tdcproc->IsStreamAnalysis() || (sub->Alignment() != 4))
+      return false;
+
+   void *ptr = (char*)sub->RawData() + 4*ix;
+
+   // descriptor can be reused only when nobody else keeps reference on it
+   if (fDirectBuf.null() || (fDirectBuf().refcnt > 1)) {
+      fDirectBuf.makereferenceof(ptr, 4*datalen);
+      if (fDirectBuf.null()) return false;
+   } else {
+      fDirectBuf().buf = ptr;
+      fDirectBuf().datalen = 4*datalen;
+      fDirectBuf().local_tm = 0.;
+      fDirectBuf().global_tm = 0.;
+      fDirectBuf().user_tag = 0;
+   }
+
+   fDirectBuf().kind = sub->GetTrigTypeTrb3();
+   fDirectBuf().boardid = tdcproc->GetID();
+   fDirectBuf().format = sub->IsSwapped() ? 2 : 1; // special format without sync
+
+   {
+      STREAM_PROFILE("FirstBufferScan", tdcproc);
+      tdcproc->FirstBufferScan(fDirectBuf);
+   }
+   tdcproc->SetNewDataFlag(true);
+
+   return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 /// Add event-related error message - adds event info
 
@@ -620,12 +674,6 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
 
    bool did_create_tdc = false;
 
-   if ((fMinTdc == 0) && (fMaxTdc == 0) && (fTdcsVect.size()==0) && (fMap.size() > 0)) {
-      BuildFastTDCVector();
-   }
-
-   bool get_fast = fMaxTdc > fMinTdc;
-
    unsigned maxhublen = 0, lasthubid = 0; // if saw HUB subsubevents, control size of data inside
 
 //   RAWPRINT("Scan TRB3 raw event 4-bytes size %u\n", trbSubEvSize);
@@ -657,7 +705,9 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
 //         continue;
 //      }
 
-      if (std::find(fHadaqHUBId.begin(), fHadaqHUBId.end(), dataid) != fHadaqHUBId.end()) {
+      const DispatchEntry &disp = FindDispatch(dataid);
+
+      if (disp.hub) {
          RAWPRINT ("   HUB header: 0x%08x, hub=0x%04x, size=%u (ignore)\n", (unsigned) data, (unsigned) dataid, datalen);
 
          if (maxhublen==0) {
@@ -776,7 +826,7 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
 
          if (datalen > 0) {
 
-            TdcProcessor* tdcproc = GetTDC(fHadaqCTSId, true);
+            TdcProcessor* tdcproc = (fHadaqCTSId >> 16) ? nullptr : FindDispatch(fHadaqCTSId).tdc;
             if (tdcproc) {
                // if TDC processor found, process such data as normal TDC data
                AddBufferToTDC(sub, tdcproc, ix, datalen);
@@ -805,12 +855,7 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
          continue;
       }
 
-      TdcProcessor *tdcproc = nullptr;
-      if (get_fast) {
-         if ((dataid >= fMinTdc) && (dataid < fMaxTdc)) tdcproc = fTdcsVect[dataid-fMinTdc];
-      } else {
-         tdcproc = GetTDC(dataid, true);
-      }
+      TdcProcessor *tdcproc = disp.tdc;
 
       ///<! ================= FPGA TDC header ========================
       if (tdcproc) {
@@ -855,8 +900,7 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
          continue;
       }
 
-      auto iter = fMap.find(dataid);
-      SubProcessor* subproc = iter != fMap.end() ? iter->second : nullptr;
+      SubProcessor* subproc = disp.sub;
 
       ///<! ================= any other header ========================
       if (subproc) {
@@ -869,8 +913,7 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
 
          // check if this processor has some attached TDC
          unsigned  offset = 0;
-         auto iter_tdc = fMap.find(dataid | 0xff0000);
-         if(iter_tdc != fMap.end()) {
+         if(disp.attached) {
             // pre-scan for begin marker of non-TDC data
             for(unsigned i=0;i<datalen;i++) {
                unsigned data_ = sub->Data(ix+i);
@@ -880,7 +923,7 @@ void hadaq::TrbProcessor::ScanSubEvent(hadaqs::RawSubevent* sub, unsigned trb3ru
                }
             }
             if(offset>0)
-               AddBufferToTDC(sub, iter_tdc->second, ix, offset);
+               AddBufferToTDC(sub, disp.attached, ix, offset);
          }
 
          datalen -= offset;
@@ -992,13 +1035,15 @@ bool hadaq::TrbProcessor::CollectMissingTDCs(hadaqs::RawSubevent *sub, std::vect
 
       uint32_t datalen = (data >> 16) & 0xFFFF;
 
-      if (std::find(fHadaqHUBId.begin(), fHadaqHUBId.end(), dataid) != fHadaqHUBId.end()) {
+      const DispatchEntry &disp = FindDispatch(dataid);
+
+      if (disp.hub) {
          // TODO: formally we should analyze HUB subevent as real subevent but
          // we just skip header and continue to analyze data
          continue;
       }
 
-      TdcProcessor* subproc = GetTDC(dataid, true);
+      TdcProcessor* subproc = disp.tdc;
 
       if (!subproc && (dataid != 0x5555)) {
          ids.emplace_back(dataid);
@@ -1012,80 +1057,105 @@ bool hadaq::TrbProcessor::CollectMissingTDCs(hadaqs::RawSubevent *sub, std::vect
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Build vector of TDCs processor for fast access
+/// Build dispatch table for sub-sub-event ids
+///
+/// Table covers complete 16-bit id space as two-level pages table: upper byte of id
+/// selects page of 256 entries. Pages without any known id refer to single empty page,
+/// therefore lookup never needs to check id range. Table is rebuild automatically
+/// when sub-processor or HUB id is added
 
-void hadaq::TrbProcessor::BuildFastTDCVector()
+void hadaq::TrbProcessor::BuildDispatchTable()
 {
-   bool isany = false;
-   fMinTdc = 0xffffff;
-   fMaxTdc = 0;
+   for (unsigned n = 0; n < 256; ++n)
+      fDispatchPage[n] = 0;
+
+   // first page remains always empty
+   unsigned numpages = 1;
+
+   auto get_entry = [this, &numpages](unsigned id) -> DispatchEntry & {
+      uint16_t &page = fDispatchPage[(id >> 8) & 0xff];
+      if (page == 0) page = numpages++;
+      return fDispatch[page*256 + (id & 0xff)];
+   };
+
+   // all pages allocated at once, references on entries remain valid
+   fDispatch.clear();
+   fDispatch.resize((1 + fMap.size() + fHadaqHUBId.size()) * 256);
 
    for (auto &entry : fMap) {
-      if (entry.second->IsTDC()) {
-         isany = true;
-         if (entry.first > fMaxTdc) fMaxTdc = entry.first;
-         if (entry.first < fMinTdc) fMinTdc = entry.first;
+      if ((entry.first >> 16) == 0xff) {
+         get_entry(entry.first).attached = entry.second;
+      } else if ((entry.first >> 16) == 0) {
+         // ignore integrated TDCs, they have upper 16bits set
+         if (entry.second->IsTDC())
+            get_entry(entry.first).tdc = static_cast<hadaq::TdcProcessor *>(entry.second);
+         else
+            get_entry(entry.first).sub = entry.second;
       }
    }
 
-   if (!isany || (fMaxTdc-fMinTdc > 0xffff)) {
-      fMinTdc = fMaxTdc = 1;
-   } else {
-      fMaxTdc++;
-      fTdcsVect.resize(fMaxTdc - fMinTdc, nullptr);
-      for (auto &entry : fMap)
-         if (entry.second->IsTDC())
-            fTdcsVect[entry.first - fMinTdc] = static_cast<hadaq::TdcProcessor *>(entry.second);
-   }
+   for (auto id : fHadaqHUBId)
+      if ((id >> 16) == 0)
+         get_entry(id).hub = true;
+
+   fDispatch.resize(numpages * 256);
+
+   fDispatchReady = true;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Clear helper vector of TDCs processor for fast access
+/// Clear dispatch table, it will be build again with next event
 
 void hadaq::TrbProcessor::ClearFastTDCVector()
 {
-   fTdcsVect.clear();
-   fMinTdc = fMaxTdc = 0;
+   fDispatch.clear();
+   fDispatchReady = false;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 /// Transform (calibrate) raw data
 /// Creates output HLD structure, used in HADES DAQ
+///
+/// If tgtbuf not specified or same as subevent, data transformed in place:
+/// only hit messages are rewritten, nothing is copied and no memory is allocated.
+/// Returns size of produced subevent or 0 for in-place transformation
+///
+/// With shard >= 0 method is called from worker thread of parallel transformation:
+/// histograms are not filled (caller should do it with only_hist = true) and
+/// TDC statistic is collected in shards, see \ref PrepareTransformShards
 
-unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *tgtbuf, unsigned tgtlen, bool only_hist, std::vector<unsigned> *newids)
+unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *tgtbuf, unsigned tgtlen, bool only_hist, std::vector<unsigned> *newids, int shard)
 {
-//   base::ProfilerGuard grd(fProfiler, "enter");
-
-   unsigned trig_type = sub->GetTrigTypeTrb3(), sz = sub->GetSize();
-
-   if (only_hist && (GetID() == 0x8800)) {
-      unsigned wordNr = 2;
-      uint32_t bitmask = 0xff000000; /* extended mask to contain spill on/off bit*/
-      uint32_t bitshift = 24;
-      // above from args.c defaults
-      uint32_t val = sub->Data(wordNr - 1);
-      trig_type = (val & bitmask) >> bitshift;
-   }
+   STREAM_PROFILE("TransformSubEvent", this);
+
+   // in worker thread histograms are not filled
+   if (shard < 0) {
+      unsigned trig_type = sub->GetTrigTypeTrb3(), sz = sub->GetSize();
+
+      if (only_hist && (GetID() == 0x8800)) {
+         unsigned wordNr = 2;
+         uint32_t bitmask = 0xff000000; /* extended mask to contain spill on/off bit*/
+         uint32_t bitshift = 24;
+         // above from args.c defaults
+         uint32_t val = sub->Data(wordNr - 1);
+         trig_type = (val & bitmask) >> bitshift;
+      }
 
-   DefFastFillH1(fTrigType, (trig_type & 0xF), 1.);
+      DefFastFillH1(fTrigType, (trig_type & 0xF), 1.);
 
-   if (sz < fSubevHLen)
-      DefFastFillH1(fSubevSize, sz / fSubevHDiv, 1.);
+      if (sz < fSubevHLen)
+         DefFastFillH1(fSubevSize, sz / fSubevHDiv, 1.);
 
-   // JAM2018: add errorbit statistics
-   uint32_t error_word = sub->GetErrBits();
-   for(int bit=0; bit<32; ++bit)
-      if(error_word & (1 << bit))
-         DefFastFillH1(fErrBits, bit, 1.);
+      // JAM2018: add errorbit statistics
+      uint32_t error_word = sub->GetErrBits();
+      for(int bit=0; bit<32; ++bit)
+         if(error_word & (1 << bit))
+            DefFastFillH1(fErrBits, bit, 1.);
+   }
 
    // only fill histograms
    if (only_hist) return 0;
 
-   if ((fMinTdc == 0) && (fMaxTdc == 0) && (fTdcsVect.size()==0) && (fMap.size() > 0))
-      BuildFastTDCVector();
-
-   bool get_fast = fMaxTdc > fMinTdc;
-
    // !!! DEBUG ONLY - just copy data
    // if (tgtbuf && tgtlen) {
    //   printf("SUBEVENT swap:%u len:%u\n", sub->IsSwapped(), sub->GetPaddedSize());
@@ -1096,6 +1166,8 @@ unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *
 //   grd.Next("hdr");
 
    hadaqs::RawSubevent* tgt = (hadaqs::RawSubevent*) tgtbuf;
+   if (tgt == sub) tgt = nullptr;
+
    // copy complete header first
    if (tgt) {
       // copy header
@@ -1114,6 +1186,8 @@ unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *
 
    bool standalone_subevnt = (sub->GetDecoding() & hadaqs::EvtDecoding_AloneSubevt) != 0;
 
+   bool swapped = sub->IsSwapped();
+
    while (ix < trbSubEvSize) {
 
 //      grd.Next("sub", 5);
@@ -1124,7 +1198,7 @@ unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *
          id = sub->GetId();
       } else {
          data = rawdata[ix++];
-         data = HADAQ_SWAP4(data);
+         if (swapped) data = HADAQ_SWAP4(data);
          datalen = (data >> 16) & 0xFFFF;
          id = data & 0xFFFF;
       }
@@ -1134,36 +1208,32 @@ unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *
          return 0;
       }
 
-      if (fHadaqHUBId.size() > 0)
-         if (std::find(fHadaqHUBId.begin(), fHadaqHUBId.end(), id) != fHadaqHUBId.end()) {
-            // ix+=datalen;  // WORKAROUND !!!
+      const DispatchEntry &disp = FindDispatch(id);
 
-            // copy hub header to the target
-            if (tgt && !standalone_subevnt) tgt->SetData(tgtix++, data);
+      if (disp.hub) {
+         // ix+=datalen;  // WORKAROUND !!!
 
-            // TODO: formally we should analyze HUB subevent as real subevent but
-            // we just skip header and continue to analyze data
-            continue;
-         }
+         // copy hub header to the target
+         if (tgt && !standalone_subevnt) tgt->SetData(tgtix++, data);
+
+         // TODO: formally we should analyze HUB subevent as real subevent but
+         // we just skip header and continue to analyze data
+         continue;
+      }
 
 //      grd.Next("get");
 
       ///<! ================= FPGA TDC header ========================
-      TdcProcessor *subproc = nullptr;
-      if (get_fast) {
-         if ((id >= fMinTdc) && (id < fMaxTdc)) subproc = fTdcsVect[id-fMinTdc];
-      } else {
-         subproc = GetTDC(id, true);
-      }
+      TdcProcessor *subproc = disp.tdc;
 
       if (subproc) {
 //         grd.Next("trans");
 
          if (standalone_subevnt && (ix==0)) {
-            unsigned newlen = subproc->TransformTdcData(sub, rawdata, ix, datalen, tgt, tgtix);
+            unsigned newlen = subproc->TransformTdcData(sub, rawdata, ix, datalen, tgt, tgtix, shard);
             if (tgt) tgtix += newlen;
          } else {
-            unsigned newlen = subproc->TransformTdcData(sub, rawdata, ix, datalen, tgt, tgtix+1);
+            unsigned newlen = subproc->TransformTdcData(sub, rawdata, ix, datalen, tgt, tgtix+1, shard);
             if (tgt) {
                tgt->SetData(tgtix++, id | ((newlen & 0xffff) << 16)); // set sub-sub header
                tgtix += newlen;
@@ -1194,12 +1264,40 @@ unsigned hadaq::TrbProcessor::TransformSubEvent(hadaqs::RawSubevent *sub, void *
 
    if (tgt) {
       tgt->SetSize(sizeof(hadaqs::RawSubevent) + tgtix*4);
+      // clear padding to get same output independent from buffer content
+      if (tgt->GetPaddedSize() > tgt->GetSize())
+         memset(tgt->RawData(tgtix), 0, tgt->GetPaddedSize() - tgt->GetSize());
       return tgt->GetPaddedSize();
    }
 
    return 0;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare TDC processors for parallel transformation with specified number of threads
+/// Must be called before threads are started
+
+void hadaq::TrbProcessor::PrepareTransformShards(unsigned numshards)
+{
+   // dispatch table used read-only by worker threads
+   BuildDispatchTable();
+
+   for (auto &item : fMap)
+      if (item.second->IsTDC())
+         ((TdcProcessor *) item.second)->PrepareTransformShards(numshards);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Merge statistic of parallel transformation into TDC processors
+/// Called when all threads are finished
+
+void hadaq::TrbProcessor::MergeTransformShards()
+{
+   for (auto &item : fMap)
+      if (item.second->IsTDC())
+         ((TdcProcessor *) item.second)->MergeTransformShards();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 /// Emulate transform (calibrate) raw data - only for debugging
 
@@ -0,0 +1,250 @@
+#include "mbs/LmdFile.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "base/ProcMgr.h"
+
+///////////////////////////////////////////////////////////////////////////
+/// destructor
+
+mbs::LmdFile::~LmdFile()
+{
+   Close();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Open file for reading
+///
+/// Regular files are mapped into memory, kernel is advised to read data ahead.
+/// Other files (like named pipes) are read with normal file functions
+
+bool mbs::LmdFile::OpenRead(const char *fname)
+{
+   Close();
+
+   if (!fname || !*fname) {
+      printf("LMD file name not specified\n");
+      return false;
+   }
+
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) {
+      printf("Cannot open LMD file %s for reading\n", fname);
+      return false;
+   }
+
+   struct stat st;
+   if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+      void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mem != MAP_FAILED) {
+         fMapped = (char *) mem;
+         fMappedSize = fEnd = st.st_size;
+         madvise(mem, st.st_size, MADV_SEQUENTIAL);
+      }
+   }
+
+   close(fd);
+
+   if (!fMapped) {
+      fFile = fopen(fname, "r");
+      if (!fFile) {
+         printf("Cannot open LMD file %s for reading\n", fname);
+         return false;
+      }
+   }
+
+   fFileName = fname;
+   fEOF = false;
+
+   // analyze first element - it is file header or the first event
+   Header hdr;
+
+   if (fMapped) {
+      if (fMappedSize < sizeof(Header)) {
+         fEOF = true;
+         return true;
+      }
+      memcpy(&hdr, fMapped, sizeof(Header));
+   } else if (fread(&hdr, sizeof(Header), 1, fFile) != 1) {
+      fEOF = true;
+      return true;
+   }
+
+   if (hdr.iType == MbsTypeFileHeader) {
+      FileHeader fhdr;
+      memcpy(&fhdr, &hdr, sizeof(Header));
+
+      uint64_t hdrsize = sizeof(FileHeader);
+
+      if (fMapped) {
+         if (fMappedSize < hdrsize) {
+            printf("LMD file %s too short\n", fname);
+            Close();
+            return false;
+         }
+         memcpy(&fhdr, fMapped, sizeof(FileHeader));
+         fPos = hdrsize + fhdr.iUsedWords*2;
+         // table with events offsets is placed after all events
+         if ((fhdr.iTableOffset > 0) && (fhdr.iTableOffset*4 < fEnd))
+            fEnd = fhdr.iTableOffset*4;
+      } else {
+         if (fread((char *) &fhdr + sizeof(Header), hdrsize - sizeof(Header), 1, fFile) != 1) {
+            printf("LMD file %s too short\n", fname);
+            Close();
+            return false;
+         }
+         // skip extra data of file header
+         for (unsigned n = 0; n < fhdr.iUsedWords*2; n++)
+            if (fgetc(fFile) == EOF) { fEOF = true; break; }
+      }
+   } else if (hdr.iType == MbsTypeLong) {
+      // file without header, first event starts immediately
+      if (!fMapped) {
+         fNextHdr = hdr;
+         fHasNextHdr = true;
+      }
+   } else {
+      printf("LMD file %s has unsupported format, first element type 0x%08x\n", fname, (unsigned) hdr.iType);
+      Close();
+      return false;
+   }
+
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Close file
+/// All buffers, delivered from mapped file, become invalid after this call
+
+void mbs::LmdFile::Close()
+{
+   if (fMapped)
+      munmap(fMapped, fMappedSize);
+   fMapped = nullptr;
+   fMappedSize = fPos = fEnd = 0;
+
+   if (fFile)
+      fclose(fFile);
+   fFile = nullptr;
+
+   fEventBuf.reset();
+   fHasNextHdr = false;
+   fEOF = true;
+   fFileName.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Read next event from not-mapped file into internal buffer
+
+mbs::EventHeader *mbs::LmdFile::ReadNextEvent()
+{
+   Header hdr;
+
+   if (fHasNextHdr) {
+      hdr = fNextHdr;
+      fHasNextHdr = false;
+   } else if (fread(&hdr, sizeof(Header), 1, fFile) != 1) {
+      fEOF = true;
+      return nullptr;
+   }
+
+   if ((hdr.iType != MbsTypeLong) || (hdr.FullSize() < sizeof(EventHeader))) {
+      printf("LMD file %s unsupported element type 0x%08x or size %u\n", fFileName.c_str(), (unsigned) hdr.iType, (unsigned) hdr.FullSize());
+      fEOF = true;
+      return nullptr;
+   }
+
+   // reuse buffer when it is large enough, subevents data always copied from it
+   if (fEventBuf.null() || (fEventBuf.datalen() < hdr.FullSize()))
+      fEventBuf.makenew(hdr.FullSize() < 0x10000 ? 0x10000 : hdr.FullSize());
+
+   memcpy(fEventBuf.ptr(), &hdr, sizeof(Header));
+
+   if (fread(fEventBuf.ptr(sizeof(Header)), hdr.FullSize() - sizeof(Header), 1, fFile) != 1) {
+      printf("LMD file %s truncated event\n", fFileName.c_str());
+      fEOF = true;
+      return nullptr;
+   }
+
+   return (EventHeader *) fEventBuf.ptr();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns next event from the file, nullptr when end of file is reached
+/// Event stays valid until file is closed (mapped file) or next event is read
+
+mbs::EventHeader *mbs::LmdFile::NextEvent()
+{
+   if (fEOF) return nullptr;
+
+   EventHeader *evnt = nullptr;
+
+   if (!fMapped) {
+      evnt = ReadNextEvent();
+   } else {
+      if (fPos + sizeof(EventHeader) > fEnd) {
+         fEOF = true;
+         return nullptr;
+      }
+
+      evnt = (EventHeader *) (fMapped + fPos);
+
+      if ((evnt->iType != MbsTypeLong) || (evnt->FullSize() < sizeof(EventHeader))) {
+         printf("LMD file %s unsupported element type 0x%08x or size %u at position %lu\n",
+                fFileName.c_str(), (unsigned) evnt->iType, (unsigned) evnt->FullSize(), (long unsigned) fPos);
+         fEOF = true;
+         return nullptr;
+      }
+
+      if (fPos + evnt->FullSize() > fEnd) {
+         printf("LMD file %s truncated event at position %lu\n", fFileName.c_str(), (long unsigned) fPos);
+         fEOF = true;
+         return nullptr;
+      }
+
+      fPos += evnt->FullSize();
+   }
+
+   if (evnt) fNumEvents++;
+
+   return evnt;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Deliver all subevents of the event to the processors manager
+///
+/// Subevent procid used as buffer kind, subcrate as board id and control as format,
+/// same as done for Go4 MBS events.
+/// For mapped file data are not copied unless copy flag is specified.
+/// Copy required when buffers may be used after file is closed - like in stream analysis.
+/// Returns number of accepted subevents
+
+unsigned mbs::LmdFile::ProvideEvent(EventHeader *evnt, base::ProcMgr *mgr, bool copy)
+{
+   if (!evnt || !mgr) return 0;
+
+   unsigned cnt = 0;
+
+   for (SubeventHeader *sub = evnt->FirstSubevent(); sub; sub = evnt->NextSubevent(sub)) {
+      base::Buffer buf;
+
+      if (IsMapped() && !copy)
+         buf.makereferenceof(sub->RawData(), sub->RawDataSize());
+      else
+         buf.makecopyof(sub->RawData(), sub->RawDataSize());
+
+      if (buf.null()) continue;
+
+      buf().kind = (uint16_t) sub->iProcId;
+      buf().boardid = (uint8_t) sub->iSubcrate;
+      buf().format = (uint8_t) sub->iControl;
+
+      if (mgr->ProvideRawData(buf)) cnt++;
+   }
+
+   return cnt;
+}
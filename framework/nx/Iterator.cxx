@@ -1,5 +1,8 @@
 #include "nx/Iterator.h"
 
+// mask of 46-bit stamp - 32-bit epoch and 14-bit nXYTER time stamp
+const uint64_t STAMPMASK = (((uint64_t) 1) << 46) - 1;
+
 nx::Iterator::Iterator(int fmt) :
    base::Iterator(fmt),
    fEpoch(0),
@@ -86,7 +89,91 @@ void nx::Iterator::VerifyMessage()
    fVerifyRes = res;
 }
 
+/** Bulk decoding of hit and epoch messages, starting from current position.
+  * Batch is filled from the beginning, epoch numbers are stored separately from hits.
+  * Decoding stops at the end of buffer, when batch is full, at first message of other kind
+  * or from other ROC, which can be read afterwards with next(). Current message msg() is not changed.
+  * Format dispatched only once, decoding loop is specialized for each format.
+  * Returns number of hits in the batch */
+
+unsigned nx::Iterator::nextHits(HitsBatch &batch)
+{
+   batch.size = batch.numepochs = 0;
+
+   if (!fBuffer) return 0;
+
+   switch (fFormat) {
+      case base::formatEth1: decodeHits<base::formatEth1>(batch); break;
+      case base::formatOptic1: decodeHits<base::formatOptic1>(batch); break;
+      case base::formatEth2: decodeHits<base::formatEth2>(batch); break;
+      case base::formatOptic2: decodeHits<base::formatOptic2>(batch); break;
+      case base::formatNormal: decodeHits<base::formatNormal>(batch); break;
+      default: return 0;
+   }
+
+   // simple loop without dependencies between hits
+   for (unsigned n = 0; n < batch.size; n++) {
+      const nx::Message &msg = batch.msg[n];
+      batch.nx[n] = msg.getNxNumber();
+      batch.ch[n] = msg.getNxChNum();
+      batch.adc[n] = msg.getNxAdcValue();
+      // pileup, overflow and last-epoch bits are neighbours, copied at once
+      batch.flags[n] = msg.getNxLtsMsb() | (msg.getField(45, 3) << 3);
+      // stamp with last-epoch flag applied, hits with wrong flag restored in CorrectHits()
+      batch.stamp[n] = ((batch.stamp[n] | msg.getNxTs()) - ((uint64_t) msg.getNxLastEpoch() << 14)) & STAMPMASK;
+   }
+
+   CorrectHits(batch);
+
+   return batch.size;
+}
+
+/** Last-epoch verification of decoded hits, same as in VerifyMessage().
+  * If last-epoch flag is wrong, flag is cleared and hit stamp is restored.
+  * All checks which do not depend on previous hits are done in separate simple loop */
+
+void nx::Iterator::CorrectHits(HitsBatch &batch)
+{
+   unsigned sz = batch.size;
+
+   if (!fCorrecion || (sz == 0)) return;
+
+   for (unsigned n = 0; n < sz; n++) {
+      uint8_t flags = batch.flags[n];
+      uint16_t ts = batch.stamp[n] & 0x3fff;
+      batch.verify[n] = !(flags & HitsBatch::LastEpochFlag) ? 0 : ((ts < 15800) ? -1 : (((flags + 7) & 0x7) != ((ts >> 11) & 0x7) ? -5 : 1));
+   }
 
+   // comparison with previous hit of same nXYTER, nXYTER number has only 2 bits
+   uint64_t lasthit[4];
+   for (unsigned nxid = 0; nxid < 4; nxid++)
+      lasthit[nxid] = fLastNxHit[nxid];
+
+   for (unsigned n = 0; n < sz; n++) {
+      unsigned nxid = batch.nx[n];
+      uint64_t fulltm = (batch.stamp[n] + ((uint64_t) (batch.flags[n] & HitsBatch::LastEpochFlag) << 9)) & STAMPMASK;
+      int8_t res = batch.verify[n];
+
+      if (fulltm + fNxTmDistance < lasthit[nxid]) {
+         if (res == 1) res = -1; else
+         if (res == 0) res = ((fulltm & 0x3fff) < 30) ? -2 : -3;
+         batch.verify[n] = res;
+      }
+
+      lasthit[nxid] = fulltm;
+      if ((res == -1) || (res == -5)) {
+         lasthit[nxid] += 16*1024;
+         batch.flags[n] &= ~HitsBatch::LastEpochFlag;
+         batch.msg[n].setNxLastEpoch(0);
+         batch.stamp[n] = fulltm;
+      }
+   }
+
+   for (unsigned nxid = 0; nxid < 4; nxid++)
+      fLastNxHit[nxid] = lasthit[nxid];
+
+   fVerifyRes = batch.verify[sz-1];
+}
 
 void nx::Iterator::setRocNumber(uint16_t rocnum)
 {
@@ -14,7 +14,7 @@ double nx::Processor::fNXDisorderTm = 17e-6;
 bool nx::Processor::fLastEpochCorr = false;
 
 nx::Processor::Processor(unsigned rocid, unsigned nxmask, base::OpticSplitter* spl) :
-   base::SysCoreProc("ROC%u", rocid),
+   base::SysCoreProc("ROC%u", rocid, spl),
    fIter1(),
    fIter2()
 {
@@ -132,6 +132,68 @@ void nx::Processor::AssignBufferTo(nx::Iterator& iter, const base::Buffer& buf)
 
 
 
+/** Account hits and epochs, decoded by nx::Iterator::nextHits() in first scan.
+  * Statistic and histograms are same as for messages read one by one.
+  * Returns number of accounted messages */
+
+unsigned nx::Processor::ScanHitsBatch(const base::Buffer& buf, bool &first)
+{
+   unsigned numepochs = fBatch.numepochs;
+
+   // ignore epoch message at the end of the buffer
+   if (fIter1.islast() && fBatch.endsepoch) numepochs--;
+
+   if (fBatch.roc != GetID()) {
+      for (unsigned n = 0; n < fBatch.size + numepochs; n++)
+         printf("Message from wrong ROCID %u, expected %u\n", fBatch.roc, GetID());
+      return 0;
+   }
+
+   for (unsigned n = 0; n < numepochs; n++) {
+      FillH1(fMsgsKind, base::MSG_EPOCH);
+
+      double localtm = fIter1.StampToTime(nx::Iterator::FullTimeStamp(fBatch.epoch[n], 0));
+      FillH1(fALLt, localtm - floor(localtm/1000.)*1000.);
+   }
+
+   // keep time of first non-epoch message as start point of the buffer
+   if (first && (fBatch.size > 0)) {
+      first = false;
+      buf().local_tm = fIter1.StampToTime(fBatch.stamp[0]); // nx-based is always in ns
+   }
+
+   bool correction = fIter1.IsCorrection();
+
+   for (unsigned n = 0; n < fBatch.size; n++) {
+      FillH1(fMsgsKind, base::MSG_HIT);
+
+      double localtm = fIter1.StampToTime(fBatch.stamp[n]);
+      // this time used for histograming
+      double msgtm = localtm - floor(localtm/1000.)*1000.;
+
+      FillH1(fALLt, msgtm);
+      FillH1(fHITt, msgtm);
+
+      unsigned nxid = fBatch.nx[n];
+
+      if (!nx_in_use(nxid)) continue;
+
+      fNumHits++;
+
+      if (correction) {
+         int isok = fBatch.verify[n];
+         if ((isok==-1) || (isok==-5)) fNumCorrHits++; else
+         if (isok<0) fNumBadHits++;
+      }
+
+      FillH1(NX[nxid].fChannels, fBatch.ch[n]);
+      FillH2(NX[nxid].fADCs, fBatch.ch[n], fBatch.adc[n]);
+      FillH1(NX[nxid].fHITt, msgtm);
+   }
+
+   return fBatch.size + numepochs;
+}
+
 bool nx::Processor::FirstBufferScan(const base::Buffer& buf)
 {
    if (buf.null()) return false;
@@ -150,7 +212,19 @@ bool nx::Processor::FirstBufferScan(const base::Buffer& buf)
 //   static int doprint = 0;
 //   static double mymarker = 4311410447414.;
 
-   while (fIter1.next()) {
+   // hits and epochs decoded in batches, other messages read one by one
+   // when messages should be printed, all of them read one by one
+   bool use_batch = fNumPrintMessages <= 0;
+
+   while (true) {
+
+      if (use_batch && (fIter1.nextHits(fBatch) + fBatch.numepochs > 0)) {
+         cnt += fBatch.size + fBatch.numepochs;
+         msgcnt += ScanHitsBatch(buf, first);
+         continue;
+      }
+
+      if (!fIter1.next()) break;
 
       cnt++;
 
@@ -241,6 +315,9 @@ bool nx::Processor::FirstBufferScan(const base::Buffer& buf)
                AddSyncMarker(marker);
             }
 
+            if (IsCoincidenceChannel(10 + sync_ch))
+               AddCoincidenceHit(10 + sync_ch, localtm);
+
             if (fTriggerSignal == (10 + sync_ch)) {
 
                base::LocalTimeMarker marker;
@@ -260,6 +337,9 @@ bool nx::Processor::FirstBufferScan(const base::Buffer& buf)
 
 //            printf("Find AUX%u\n", auxid);
 
+            if (IsCoincidenceChannel(auxid))
+               AddCoincidenceHit(auxid, localtm);
+
             if (fTriggerSignal == auxid) {
 
                base::LocalTimeMarker marker;
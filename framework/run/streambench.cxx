@@ -0,0 +1,712 @@
+// stream-bench - throughput benchmarks of decoding and calibration hot paths
+//
+// Data produced in memory with hadaq::HldGenerator. Micro-benchmarks measure single
+// methods like TdcIterator::next() or TdcProcessor::DoBufferScan(), end-to-end scenarios
+// run complete triggered analysis for all histograms levels and store kinds.
+// Results printed as JSON lines - one object per benchmark - which can be compared
+// between versions to detect performance regressions.
+
+#include "base/ProcMgr.h"
+#include "base/Buffer.h"
+#include "base/Event.h"
+#include "base/Processor.h"
+#include "base/Queue.h"
+
+#include "hadaq/HldGenerator.h"
+#include "hadaq/HldProcessor.h"
+#include "hadaq/TrbProcessor.h"
+#include "hadaq/TdcProcessor.h"
+#include "hadaq/TdcIterator.h"
+#include "hadaq/TrbIterator.h"
+#include "hadaq/TdcMessage.h"
+
+#include "nx/Iterator.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+// count all memory allocations, reported as allocations per operation or per event
+// operator new counted here, malloc of records in base::Buffer counted by buffer itself
+
+static std::atomic<unsigned long> gNumAllocs{0};
+
+void *operator new(size_t sz)
+{
+   gNumAllocs.fetch_add(1, std::memory_order_relaxed);
+   void *p = malloc(sz > 0 ? sz : 1);
+   if (!p) throw std::bad_alloc();
+   return p;
+}
+
+void operator delete(void *p) noexcept
+{
+   free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+   free(p);
+}
+
+/** Returns number of all allocations - operator new and base::Buffer records */
+
+static unsigned long NumAllocs()
+{
+   return gNumAllocs.load() + base::Buffer::NumAllocations();
+}
+
+/** TRB processor with access to subevent scan */
+
+class BenchTrb : public hadaq::TrbProcessor {
+   public:
+      BenchTrb(unsigned brdid, hadaq::HldProcessor *hld = nullptr) : hadaq::TrbProcessor(brdid, hld) {}
+
+      using hadaq::TrbProcessor::ScanSubEvent;
+};
+
+/** TDC processor with access to buffer scan and calibration methods */
+
+class BenchTdc : public hadaq::TdcProcessor {
+   public:
+      BenchTdc(hadaq::TrbProcessor *trb, unsigned tdcid, unsigned numch, unsigned edges, bool ver4) :
+         hadaq::TdcProcessor(trb, tdcid, numch, edges, ver4) {}
+
+      using hadaq::TdcProcessor::DoBufferScan;
+      using hadaq::TdcProcessor::DoBuffer4Scan;
+      using hadaq::TdcProcessor::CalibrateChannel;
+};
+
+/** Processor with 1D and 2D histograms to measure filling */
+
+class BenchProc : public base::Processor {
+   public:
+      base::H1handle fH1{nullptr};
+      base::H2handle fH2{nullptr};
+
+      BenchProc() : base::Processor("BENCH")
+      {
+         fH1 = MakeH1("H1", "1D histogram", 1000, 0., 1000.);
+         fH2 = MakeH2("H2", "2D histogram", 100, 0., 100., 100, 0., 100.);
+      }
+
+      void Fill1(double x) { DefFillH1(fH1, x, 1.); }
+
+      void Fill2(double x, double y) { DefFillH2(fH2, x, y, 1.); }
+};
+
+/** nXYTER message with access to raw data */
+
+struct BenchNxMsg : public nx::Message {
+   uint64_t raw() const { return data; }
+};
+
+/** Events produced by generator, kept in memory */
+
+struct BenchEvents {
+   std::vector<uint32_t> data;      ///< data of all events
+   std::vector<unsigned> offsets;   ///< offset of each event in words
+   unsigned long hits{0};           ///< number of hits in all events
+   unsigned long bytes{0};          ///< total size of events
+   bool swapped{false};             ///< data in swapped byte order
+
+   void Generate(unsigned numevents, bool ver4, bool swapped)
+   {
+      hadaq::HldGenerator gen;
+      gen.SetLayout(1, 0, 4, 33);
+      gen.SetVer4(ver4);
+      gen.SetSwapped(swapped);
+
+      unsigned maxsize = gen.MaxEventSize();
+      data.resize((unsigned long) numevents * maxsize / 4);
+
+      unsigned long pos = 0;
+      for (unsigned n = 0; n < numevents; n++) {
+         unsigned sz = gen.GenerateEvent(data.data() + pos, maxsize);
+         offsets.emplace_back(pos);
+         pos += sz / 4;
+      }
+
+      data.resize(pos);
+      hits = gen.GetNumHits();
+      bytes = pos * 4;
+      this->swapped = swapped;
+   }
+
+   unsigned size() const { return offsets.size(); }
+
+   hadaqs::RawEvent *event(unsigned n) { return (hadaqs::RawEvent *) (data.data() + offsets[n]); }
+};
+
+/** Location of TDC data inside subevent */
+
+struct BenchBlock {
+   hadaqs::RawSubevent *sub{nullptr};  ///< subevent
+   unsigned ix{0};                     ///< index of first word
+   unsigned len{0};                    ///< number of words
+   unsigned id{0};                     ///< TDC id
+};
+
+/** Collect all TDC blocks from events, HUB headers and trailer are skipped */
+
+std::vector<BenchBlock> CollectBlocks(BenchEvents &evnts)
+{
+   std::vector<BenchBlock> res;
+
+   for (unsigned n = 0; n < evnts.size(); n++) {
+      hadaq::TrbIterator iter(evnts.event(n), evnts.event(n)->GetSize());
+      iter.nextEvent();
+      hadaqs::RawSubevent *sub = nullptr;
+      while ((sub = iter.nextSubevent()) != nullptr) {
+         unsigned ix = 0, nwords = sub->GetNrOfDataWords();
+         while (ix < nwords) {
+            uint32_t data = sub->Data(ix++);
+            unsigned id = data & 0xFFFF, len = data >> 16;
+            if (id == 0x5555) break;
+            if ((id & 0xFF00) == 0x8100) continue; // HUB header, TDCs follow
+            BenchBlock blk;
+            blk.sub = sub;
+            blk.ix = ix;
+            blk.len = (ix + len <= nwords) ? len : nwords - ix;
+            blk.id = id;
+            res.emplace_back(blk);
+            ix += len;
+         }
+      }
+   }
+
+   return res;
+}
+
+/** Benchmarks runner and results output */
+
+class BenchRunner {
+   protected:
+      FILE *fOut{nullptr};          ///< output for results
+      std::string fFilter;          ///< only benchmarks containing this string
+      double fMinTime{0.5};         ///< minimal time of each micro-benchmark in seconds
+
+   public:
+      BenchRunner(FILE *out, const std::string &filter, double mintime) : fOut(out), fFilter(filter), fMinTime(mintime) {}
+
+      /** Returns true if benchmark should run */
+      bool Selected(const std::string &name) const { return fFilter.empty() || (name.find(fFilter) != std::string::npos); }
+
+      /** Run function repeatedly until minimal time is reached, function returns number of operations.
+        * Hits and bytes are numbers processed with single function call */
+      template<class Func>
+      void Micro(const std::string &name, Func func, unsigned long hits = 0, unsigned long bytes = 0)
+      {
+         if (!Selected(name)) return;
+
+         func(); // warm up
+
+         unsigned long nops = 0, ncalls = 0, allocs0 = NumAllocs();
+
+         auto start = std::chrono::steady_clock::now();
+         double tm = 0;
+
+         do {
+            nops += func();
+            ncalls++;
+            tm = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         } while (tm < fMinTime);
+
+         unsigned long allocs = NumAllocs() - allocs0;
+
+         fprintf(fOut, "{\"bench\":\"%s\",\"ops\":%lu,\"time_s\":%.4f,\"ns_per_op\":%.3f", name.c_str(), nops, tm, nops ? tm*1e9/nops : 0.);
+         if (hits > 0)
+            fprintf(fOut, ",\"ns_per_hit\":%.3f", tm*1e9/hits/ncalls);
+         if (bytes > 0)
+            fprintf(fOut, ",\"mb_per_s\":%.2f", bytes*ncalls/tm/1e6);
+         fprintf(fOut, ",\"allocs_per_op\":%.4f}\n", nops ? 1.*allocs/nops : 0.);
+         fflush(fOut);
+      }
+
+      /** Complete triggered analysis of all events with histograms level and store kind */
+      void EndToEnd(BenchEvents &evnts, bool ver4, int hlvl, unsigned store)
+      {
+         char name[100];
+         snprintf(name, sizeof(name), "e2e/%s/hlvl%d/store%u", ver4 ? "v4" : "v3", hlvl, store);
+         if (!Selected(name)) return;
+
+         base::ProcMgr *mgr = new base::ProcMgr;
+         mgr->SetTriggeredAnalysis(true);
+         mgr->SetHistFilling(hlvl);
+
+         hadaq::HldProcessor *hld = new hadaq::HldProcessor();
+         hadaq::TrbProcessor *trb = new hadaq::TrbProcessor(0x8000, hld);
+         for (unsigned k = 0; k < 4; k++)
+            new hadaq::TdcProcessor(trb, 0x0900 + k, 33, 2, ver4);
+
+         mgr->SetStoreKind(store);
+         mgr->UserPreLoop();
+
+         base::Event *evt = nullptr;
+
+         auto process = [&](unsigned n) {
+            base::Buffer buf;
+            buf.makereferenceof(evnts.event(n), evnts.event(n)->GetSize());
+            buf().kind = base::proc_TRBEvent;
+            buf().boardid = 0;
+            buf().format = 0;
+            mgr->ProvideRawData(buf);
+            if (mgr->AnalyzeNewData(evt))
+               mgr->ProcessEvent(evt);
+            // do not provide next event until queues are processed
+            while (mgr->IsBackpressure() && mgr->ProduceNextEvent(evt))
+               mgr->ProcessEvent(evt);
+         };
+
+         // warm up - create event structures and touch histograms memory
+         unsigned nwarm = evnts.size() < 1000 ? evnts.size() : 1000;
+         for (unsigned n = 0; n < nwarm; n++)
+            process(n);
+
+         unsigned long allocs0 = NumAllocs();
+         auto start = std::chrono::steady_clock::now();
+
+         for (unsigned n = 0; n < evnts.size(); n++)
+            process(n);
+
+         double tm = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         unsigned long allocs = NumAllocs() - allocs0;
+
+         mgr->UserPostLoop();
+
+         fprintf(fOut, "{\"bench\":\"%s\",\"events\":%u,\"time_s\":%.4f,\"events_per_s\":%.1f,\"mb_per_s\":%.2f,\"ns_per_hit\":%.3f,\"allocs_per_event\":%.4f}\n",
+                 name, evnts.size(), tm, tm > 0 ? evnts.size()/tm : 0., tm > 0 ? evnts.bytes/tm/1e6 : 0.,
+                 evnts.hits ? tm*1e9/evnts.hits : 0., evnts.size() ? 1.*allocs/evnts.size() : 0.);
+         fflush(fOut);
+
+         delete evt;
+         delete mgr;
+      }
+};
+
+/** Micro-benchmarks of TDC decoding for TDC v3 or v4 data */
+
+void BenchTdcDecoding(BenchRunner &runner, BenchEvents &evnts, bool ver4, int hlvl)
+{
+   std::vector<BenchBlock> blocks = CollectBlocks(evnts);
+
+   base::ProcMgr *mgr = new base::ProcMgr;
+   mgr->SetRawAnalysis(true);
+   mgr->SetHistFilling(hlvl);
+
+   BenchTrb *trb = new BenchTrb(0x8000);
+   std::vector<BenchTdc *> tdcs;
+   for (unsigned k = 0; k < 4; k++)
+      tdcs.emplace_back(new BenchTdc(trb, 0x0900 + k, 33, 2, ver4));
+
+   mgr->UserPreLoop();
+
+   std::vector<base::Buffer> bufs(blocks.size());
+   std::vector<BenchTdc *> procs(blocks.size());
+   for (unsigned n = 0; n < blocks.size(); n++) {
+      auto &blk = blocks[n];
+      bufs[n].makereferenceof(blk.sub->GetDataPtr(blk.ix), blk.len * 4);
+      bufs[n]().kind = blk.sub->GetTrigTypeTrb3();
+      bufs[n]().boardid = blk.id;
+      bufs[n]().format = 1;
+      procs[n] = tdcs[(blk.id - 0x0900) & 3];
+   }
+
+   std::string ver = ver4 ? "v4" : "v3";
+
+   runner.Micro(std::string("TdcIterator::") + (ver4 ? "next4/" : "next/") + ver, [&]() -> unsigned long {
+      hadaq::TdcIterator iter;
+      unsigned long cnt = 0;
+      uint32_t sum = 0;
+      for (auto &blk : blocks) {
+         iter.assign(blk.sub->GetDataPtr(blk.ix), blk.len, false);
+         if (ver4)
+            while (iter.next4()) { cnt++; sum += iter.msg().getData(); }
+         else
+            while (iter.next()) { cnt++; sum += iter.msg().getData(); }
+      }
+      return sum ? cnt : cnt + 1;
+   }, evnts.hits, evnts.bytes);
+
+   runner.Micro(std::string(ver4 ? "TdcProcessor::DoBuffer4Scan/" : "TdcProcessor::DoBufferScan/") + ver + "/hlvl" + std::to_string(hlvl), [&]() -> unsigned long {
+      for (unsigned n = 0; n < bufs.size(); n++)
+         if (ver4)
+            procs[n]->DoBuffer4Scan(bufs[n], true);
+         else
+            procs[n]->DoBufferScan(bufs[n], true);
+      return bufs.size();
+   }, evnts.hits, evnts.bytes);
+
+   runner.Micro(std::string("TrbProcessor::ScanSubEvent/") + ver + "/hlvl" + std::to_string(hlvl), [&]() -> unsigned long {
+      unsigned cnt = 0;
+      for (unsigned n = 0; n < evnts.size(); n++) {
+         hadaqs::RawEvent *evnt = evnts.event(n);
+         hadaq::TrbIterator iter(evnt, evnt->GetSize());
+         iter.nextEvent();
+         hadaqs::RawSubevent *sub = nullptr;
+         while ((sub = iter.nextSubevent()) != nullptr) {
+            trb->ScanSubEvent(sub, evnt->GetRunNr(), evnt->GetSeqNr());
+            cnt++;
+         }
+      }
+      return cnt;
+   }, evnts.hits, evnts.bytes);
+
+   mgr->UserPostLoop();
+
+   delete mgr;
+}
+
+/** Micro-benchmarks of TDC v3 data transformation - with output buffer and in place */
+
+void BenchTransform(BenchRunner &runner, BenchEvents &evnts, int hlvl)
+{
+   std::vector<BenchBlock> blocks = CollectBlocks(evnts);
+
+   base::ProcMgr *mgr = new base::ProcMgr;
+   mgr->SetTriggeredAnalysis(true);
+   mgr->SetHistFilling(hlvl);
+
+   hadaq::HldProcessor *hld = new hadaq::HldProcessor();
+   hadaq::TrbProcessor *trb = new hadaq::TrbProcessor(0x8000, hld);
+   std::vector<hadaq::TdcProcessor *> tdcs;
+   for (unsigned k = 0; k < 4; k++)
+      tdcs.emplace_back(new hadaq::TdcProcessor(trb, 0x0900 + k, 33, 2, false));
+
+   mgr->UserPreLoop();
+
+   unsigned maxlen = 0;
+   for (auto &blk : blocks)
+      if (blk.len > maxlen) maxlen = blk.len;
+
+   // target subevent with header copied from source subevent, calibration messages added for every two hits
+   std::vector<uint32_t> tgtbuf(sizeof(hadaqs::RawSubevent)/4 + maxlen * 2 + 16);
+   hadaqs::RawSubevent *tgt = (hadaqs::RawSubevent *) tgtbuf.data();
+
+   std::string suffix = std::string(evnts.swapped ? "/v3swap" : "/v3") + "/hlvl" + std::to_string(hlvl);
+
+   runner.Micro("TdcProcessor::TransformTdcData" + suffix, [&]() -> unsigned long {
+      for (auto &blk : blocks) {
+         memcpy((void *) tgt, blk.sub, sizeof(hadaqs::RawSubevent));
+         tdcs[(blk.id - 0x0900) & 3]->TransformTdcData(blk.sub, (uint32_t *) blk.sub->RawData(), blk.ix, blk.len, tgt, 0);
+      }
+      return blocks.size();
+   }, evnts.hits, evnts.bytes);
+
+   // output buffer for complete event
+   unsigned maxevsize = 0;
+   for (unsigned n = 0; n < evnts.size(); n++)
+      if (evnts.event(n)->GetPaddedSize() > maxevsize) maxevsize = evnts.event(n)->GetPaddedSize();
+   std::vector<uint32_t> evbuf(maxevsize / 2 + 64);
+
+   runner.Micro("HldProcessor::TransformEvent" + suffix, [&]() -> unsigned long {
+      for (unsigned n = 0; n < evnts.size(); n++)
+         hld->TransformEvent(evnts.event(n), evnts.event(n)->GetPaddedSize(), evbuf.data(), evbuf.size() * 4);
+      return evnts.size();
+   }, evnts.hits, evnts.bytes);
+
+   // in place transformation changes data, therefore original data restored before each pass
+   std::vector<uint32_t> work(evnts.data.size());
+
+   runner.Micro("HldProcessor::TransformEvents/inplace" + suffix, [&]() -> unsigned long {
+      memcpy(work.data(), evnts.data.data(), evnts.bytes);
+      return hld->TransformEvents(work.data(), evnts.bytes);
+   }, evnts.hits, evnts.bytes);
+
+   // complete buffer with calibration messages, sequential and with several threads
+   std::vector<uint32_t> outbuf(evnts.data.size() * 2);
+
+   for (unsigned nthreads : {1, 2, 4}) {
+      hld->SetTransformThreads(nthreads);
+      std::string thrd = "/threads" + std::to_string(nthreads);
+
+      runner.Micro("HldProcessor::TransformBuffer" + suffix + thrd, [&]() -> unsigned long {
+         hld->TransformBuffer(evnts.data.data(), evnts.bytes, outbuf.data(), outbuf.size() * 4);
+         return evnts.size();
+      }, evnts.hits, evnts.bytes);
+
+      if (nthreads > 1)
+         runner.Micro("HldProcessor::TransformEvents/inplace" + suffix + thrd, [&]() -> unsigned long {
+            memcpy(work.data(), evnts.data.data(), evnts.bytes);
+            return hld->TransformEvents(work.data(), evnts.bytes);
+         }, evnts.hits, evnts.bytes);
+   }
+
+   hld->SetTransformThreads(1);
+
+   mgr->UserPostLoop();
+
+   delete mgr;
+}
+
+/** Micro-benchmarks of nXYTER hits decoding - message by message and in batches
+  * Synthetic data: epochs with hits of 4 nXYTERs, partially with last-epoch flag, and sync messages.
+  * Before measurement results of both methods are compared */
+
+void BenchNxDecoding(BenchRunner &runner, unsigned numepochs)
+{
+   std::vector<uint64_t> data;
+   uint32_t rnd = 4321;
+   auto random = [&rnd](unsigned range) -> unsigned { rnd = rnd * 1664525 + 1013904223; return (rnd >> 8) % range; };
+
+   unsigned long numhits = 0;
+
+   for (unsigned epoch = 1; epoch <= numepochs; epoch++) {
+      BenchNxMsg msg;
+      msg.setMessageType(base::MSG_EPOCH);
+      msg.setEpochNumber(epoch);
+      data.emplace_back(msg.raw());
+
+      unsigned nhits = random(12), ts = 0;
+      for (unsigned k = 0; k < nhits; k++) {
+         ts += random(16384 / (nhits + 1));
+         msg.reset();
+         msg.setMessageType(base::MSG_HIT);
+         msg.setNxNumber(random(4));
+         msg.setNxChNum(random(128));
+         msg.setNxAdcValue(random(4096));
+         if (random(20) == 0) {
+            // hit from previous epoch, few of them with wrong FIFO fill status
+            unsigned lts = 15800 + random(584);
+            msg.setNxTs(lts);
+            msg.setNxLtsMsb((((lts >> 11) & 0x7) + 1 + (random(4) == 0 ? 1 : 0)) & 0x7);
+            msg.setNxLastEpoch(1);
+         } else {
+            msg.setNxTs(ts);
+            msg.setNxLtsMsb(((ts >> 11) + 1) & 0x7);
+         }
+         data.emplace_back(msg.raw());
+         numhits++;
+      }
+
+      if (epoch % 8 == 0) {
+         msg.reset();
+         msg.setMessageType(base::MSG_SYNC);
+         msg.setSyncChNum(0);
+         msg.setSyncTs(ts & 0x3ffe);
+         msg.setSyncEpochLSB(epoch & 1);
+         msg.setSyncData(epoch / 8);
+         data.emplace_back(msg.raw());
+      }
+   }
+
+   unsigned long bytes = data.size() * sizeof(uint64_t);
+
+   nx::Iterator iter(base::formatNormal);
+
+   auto scan_next = [&](std::vector<uint64_t> *stamps) -> unsigned long {
+      iter.assign(data.data(), bytes);
+      unsigned long cnt = 0, sum = 0;
+      while (iter.next())
+         if (iter.msg().isHitMsg()) {
+            uint64_t stamp = iter.getMsgStamp();
+            sum += stamp + iter.msg().getNxAdcValue();
+            if (stamps) stamps->emplace_back(stamp);
+            cnt++;
+         }
+      return sum ? cnt : 0;
+   };
+
+   nx::HitsBatch batch;
+
+   // hits decoded in batches, other messages like sync read with next()
+   auto scan_batch = [&](std::vector<uint64_t> *stamps) -> unsigned long {
+      iter.assign(data.data(), bytes);
+      unsigned long cnt = 0, sum = 0;
+      while (true) {
+         unsigned nhits = iter.nextHits(batch);
+         if ((nhits == 0) && (batch.numepochs == 0)) {
+            if (!iter.next()) break;
+            continue;
+         }
+         for (unsigned n = 0; n < nhits; n++)
+            sum += batch.stamp[n] + batch.adc[n];
+         if (stamps) stamps->insert(stamps->end(), batch.stamp, batch.stamp + nhits);
+         cnt += nhits;
+      }
+      return sum ? cnt : 0;
+   };
+
+   std::vector<uint64_t> stamps1, stamps2;
+   iter.SetCorrection(true);
+   scan_next(&stamps1);
+   iter.SetCorrection(true);
+   scan_batch(&stamps2);
+   if ((stamps1 != stamps2) || (stamps1.size() != numhits))
+      printf("nx::Iterator::nextHits produces %u hits, next() %u hits, expected %lu - results differ\n",
+             (unsigned) stamps2.size(), (unsigned) stamps1.size(), numhits);
+
+   runner.Micro("nx::Iterator::next", [&]() -> unsigned long {
+      return scan_next(nullptr);
+   }, numhits, bytes);
+
+   runner.Micro("nx::Iterator::nextHits", [&]() -> unsigned long {
+      return scan_batch(nullptr);
+   }, numhits, bytes);
+}
+
+/** Micro-benchmarks of calibration, histograms filling and queue */
+
+void BenchOther(BenchRunner &runner)
+{
+   base::ProcMgr *mgr = new base::ProcMgr;
+   mgr->SetRawAnalysis(true);
+   mgr->SetHistFilling(4);
+
+   BenchTrb *trb = new BenchTrb(0x8000);
+   BenchTdc *tdc = new BenchTdc(trb, 0x0900, 33, 2, false);
+   BenchProc *proc = new BenchProc;
+
+   mgr->UserPreLoop();
+
+   // uniform statistic between fine counter limits
+   std::vector<uint32_t> stat(hadaq::FineCounterBins, 0);
+   for (unsigned n = 31; n <= 491; n++)
+      stat[n] = 200 + (n % 7) * 10;
+   std::vector<float> calibr;
+
+   runner.Micro("TdcProcessor::CalibrateChannel", [&]() -> unsigned long {
+      tdc->CalibrateChannel(1, true, stat, calibr, false, false);
+      return 1;
+   });
+
+   runner.Micro("TdcProcessor::CalibrateChannel/linear", [&]() -> unsigned long {
+      tdc->CalibrateChannel(1, true, stat, calibr, true, false);
+      return 1;
+   });
+
+   // pseudo-random values, partially outside histograms ranges
+   std::vector<double> values(4096);
+   uint32_t rnd = 12345;
+   for (auto &v : values) {
+      rnd = rnd * 1664525 + 1013904223;
+      v = (rnd >> 8) % 110000 / 100. - 50.;
+   }
+
+   runner.Micro("Processor::DefFillH1", [&]() -> unsigned long {
+      for (auto v : values)
+         proc->Fill1(v);
+      return values.size();
+   });
+
+   runner.Micro("Processor::DefFillH2", [&]() -> unsigned long {
+      for (unsigned n = 0; n < values.size(); n++)
+         proc->Fill2(values[n] * 0.1, values[(n * 7 + 3) % values.size()] * 0.1);
+      return values.size();
+   });
+
+   base::Queue<unsigned, true> queue(64);
+
+   runner.Micro("Queue::push/pop", [&]() -> unsigned long {
+      unsigned sum = 0;
+      for (unsigned k = 0; k < 64; k++) {
+         for (unsigned n = 0; n < 48; n++)
+            queue.push(n);
+         while (queue.size() > 0)
+            sum += queue.pop_front();
+      }
+      return sum ? 64 * 48 : 0;
+   });
+
+   mgr->UserPostLoop();
+
+   delete mgr;
+}
+
+void usage()
+{
+   printf("Throughput benchmarks of decoding and calibration hot paths\n");
+   printf("Usage: stream-bench [options]\n");
+   printf("   -n number     - number of generated events (default 10000)\n");
+   printf("   -f substring  - run only benchmarks which names contain substring\n");
+   printf("   -t seconds    - minimal time of each micro-benchmark (default 0.5)\n");
+   printf("   -H level      - histograms level for micro-benchmarks of TDC scan (default 2)\n");
+   printf("   -o file       - write results into the file instead of stdout\n");
+   printf("   -e            - run only end-to-end scenarios\n");
+   printf("   -m            - run only micro-benchmarks\n");
+   printf("Each result is JSON object in separate line, other lines are messages of processors\n");
+}
+
+int main(int argc, char* argv[])
+{
+   unsigned numevents = 10000;
+   std::string filter, outname;
+   double mintime = 0.5;
+   int hlvl = 2;
+   bool do_micro = true, do_e2e = true;
+
+   for (int n = 1; n < argc; n++) {
+      std::string arg = argv[n];
+      bool hasnext = (n + 1 < argc);
+
+      if ((arg == "-h") || (arg == "--help")) {
+         usage();
+         return 0;
+      } else if ((arg == "-n") && hasnext) {
+         numevents = strtoul(argv[++n], nullptr, 0);
+      } else if ((arg == "-f") && hasnext) {
+         filter = argv[++n];
+      } else if ((arg == "-t") && hasnext) {
+         mintime = atof(argv[++n]);
+      } else if ((arg == "-H") && hasnext) {
+         hlvl = atoi(argv[++n]);
+      } else if ((arg == "-o") && hasnext) {
+         outname = argv[++n];
+      } else if (arg == "-e") {
+         do_micro = false;
+      } else if (arg == "-m") {
+         do_e2e = false;
+      } else {
+         printf("Unknown option %s\n", arg.c_str());
+         usage();
+         return 1;
+      }
+   }
+
+   if (numevents == 0) numevents = 1;
+
+   FILE *out = stdout;
+   if (!outname.empty()) {
+      out = fopen(outname.c_str(), "w");
+      if (!out) {
+         printf("Fail to create %s\n", outname.c_str());
+         return 1;
+      }
+   }
+
+   hadaq::TdcMessage::SetFineLimits(31, 491);
+
+   BenchRunner runner(out, filter, mintime);
+
+   BenchEvents ev3, ev4, ev3swap;
+   ev3.Generate(numevents, false, false);
+   ev4.Generate(numevents, true, false);
+
+   if (do_micro) {
+      ev3swap.Generate(numevents, false, true);
+
+      BenchTdcDecoding(runner, ev3, false, hlvl);
+      BenchTdcDecoding(runner, ev4, true, hlvl);
+      BenchTransform(runner, ev3, hlvl);
+      BenchTransform(runner, ev3swap, hlvl);
+      BenchNxDecoding(runner, numevents * 10);
+      BenchOther(runner);
+   }
+
+   if (do_e2e)
+      for (int lvl = 0; lvl <= 4; lvl++)
+         for (unsigned store = 0; store <= 3; store++) {
+            runner.EndToEnd(ev3, false, lvl, store);
+            runner.EndToEnd(ev4, true, lvl, store);
+         }
+
+   if (out != stdout)
+      fclose(out);
+
+   return 0;
+}
@@ -0,0 +1,109 @@
+// streamgen - generator of synthetic TRB3/TDC HLD files
+//
+// Produces HLD file with configurable number of TRBs, HUBs, TDCs and channels,
+// see hadaq::HldGenerator for details
+
+#include "hadaq/HldGenerator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+void usage()
+{
+   printf("Generator of synthetic TRB3/TDC HLD data\n");
+   printf("Usage: streamgen [options] file.hld\n");
+   printf("   -n number      - number of events (default 10000)\n");
+   printf("   -trb N         - number of TRBs (default 1)\n");
+   printf("   -hub N         - number of HUBs in each TRB (default 0)\n");
+   printf("   -tdc N         - number of TDCs in each TRB or HUB (default 4)\n");
+   printf("   -ch N          - number of channels in TDC, including channel 0 (default 33)\n");
+   printf("   -v4            - produce TDC v4 data\n");
+   printf("   -hits prob max - probability of channel hits and maximal hits per channel (default 0.3 2)\n");
+   printf("   -nofalling     - do not produce falling edges\n");
+   printf("   -calibr frac   - fraction of 0xD calibration triggers (default 0.1)\n");
+   printf("   -period ns     - time between triggers (default 1000)\n");
+   printf("   -epoch value   - epoch counter of first event, like 0xFFFFFF0 to get epoch wrap\n");
+   printf("   -err rate mask - probability of errors in TDC block and mask of errors kinds (default 0x1F)\n");
+   printf("   -swap          - write data in swapped byte order\n");
+   printf("   -seed value    - seed of random generator (default 1)\n");
+   printf("   -run id        - run id\n");
+}
+
+int main(int argc, char* argv[])
+{
+   hadaq::HldGenerator gen;
+
+   std::string fname;
+   unsigned long numevents = 10000;
+   unsigned numtrb = 1, numhub = 0, numtdc = 4, numch = 33, maxhits = 2;
+   double hitprob = 0.3;
+   bool falling = true;
+   double period = 1000., calibr = 0.1;
+   uint64_t seed = 1;
+
+   for (int n = 1; n < argc; n++) {
+      std::string arg = argv[n];
+      bool hasnext = (n + 1 < argc);
+
+      if ((arg == "-h") || (arg == "--help")) {
+         usage();
+         return 0;
+      } else if ((arg == "-n") && hasnext) {
+         numevents = strtoul(argv[++n], nullptr, 0);
+      } else if ((arg == "-trb") && hasnext) {
+         numtrb = strtoul(argv[++n], nullptr, 0);
+      } else if ((arg == "-hub") && hasnext) {
+         numhub = strtoul(argv[++n], nullptr, 0);
+      } else if ((arg == "-tdc") && hasnext) {
+         numtdc = strtoul(argv[++n], nullptr, 0);
+      } else if ((arg == "-ch") && hasnext) {
+         numch = strtoul(argv[++n], nullptr, 0);
+      } else if (arg == "-v4") {
+         gen.SetVer4(true);
+      } else if ((arg == "-hits") && (n + 2 < argc)) {
+         hitprob = atof(argv[++n]);
+         maxhits = strtoul(argv[++n], nullptr, 0);
+      } else if (arg == "-nofalling") {
+         falling = false;
+      } else if ((arg == "-calibr") && hasnext) {
+         calibr = atof(argv[++n]);
+      } else if ((arg == "-period") && hasnext) {
+         period = atof(argv[++n]);
+      } else if ((arg == "-epoch") && hasnext) {
+         gen.SetEpoch(strtoul(argv[++n], nullptr, 0));
+      } else if ((arg == "-err") && (n + 2 < argc)) {
+         double rate = atof(argv[++n]);
+         gen.SetErrors(rate, strtoul(argv[++n], nullptr, 0));
+      } else if (arg == "-swap") {
+         gen.SetSwapped(true);
+      } else if ((arg == "-seed") && hasnext) {
+         seed = strtoull(argv[++n], nullptr, 0);
+      } else if ((arg == "-run") && hasnext) {
+         gen.SetRunId(strtoul(argv[++n], nullptr, 0));
+      } else if (arg[0] == '-') {
+         printf("Unknown option %s\n", arg.c_str());
+         usage();
+         return 1;
+      } else {
+         fname = arg;
+      }
+   }
+
+   if (fname.empty()) {
+      usage();
+      return 1;
+   }
+
+   gen.SetLayout(numtrb, numhub, numtdc, numch);
+   gen.SetHits(hitprob, maxhits, falling);
+   gen.SetTriggers(period, calibr);
+   gen.SetSeed(seed);
+
+   if (!gen.WriteFile(fname.c_str(), numevents))
+      return 1;
+
+   printf("Write %u events with %u TDCs and %lu errors into %s\n", gen.GetNumEvents(), gen.GetNumTdcs(), gen.GetNumErrors(), fname.c_str());
+
+   return 0;
+}
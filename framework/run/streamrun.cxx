@@ -0,0 +1,302 @@
+// streamrun - standalone runner of stream analysis without ROOT, Go4 or DABC
+//
+// Reads HLD or LMD files, configures processors with compiled-in configuration
+// or with configuration plugin and runs analysis in raw, triggered or stream mode.
+// Histograms in internal format can be stored in file, which can be read with base::ShmHistRegistry
+
+#include "base/ProcMgr.h"
+#include "base/Buffer.h"
+#include "base/Event.h"
+#include "base/ShmHistRegistry.h"
+
+#include "hadaq/HldFile.h"
+#include "hadaq/HldProcessor.h"
+#include "hadaq/TrbProcessor.h"
+#include "hadaq/TdcMessage.h"
+
+#include "mbs/LmdFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <dlfcn.h>
+
+/** Processors manager of standalone runner
+  *
+  * Functions like after_create are searched in the loaded configuration plugin */
+
+class RunProcMgr : public base::ProcMgr {
+   public:
+      RunProcMgr() : base::ProcMgr() {}
+
+      /** call function from configuration plugin or from executable itself */
+      bool CallFunc(const char* funcname, void* arg) override
+      {
+         if (!funcname || !*funcname) return false;
+
+         typedef void (*myfunc)(void*);
+
+         myfunc func = (myfunc) dlsym(RTLD_DEFAULT, funcname);
+         if (!func) {
+            printf("Function %s not found\n", funcname);
+            return false;
+         }
+
+         func(arg);
+         return true;
+      }
+};
+
+/** Compiled-in configuration - TRB/TDC processors are created automatically */
+
+void DefaultConfig(int calibr)
+{
+   hadaq::TdcMessage::SetFineLimits(31, 491);
+
+   hadaq::TrbProcessor::SetDefaults(49, 2);
+
+   hadaq::HldProcessor* hld = new hadaq::HldProcessor(true);
+
+   hld->ConfigureCalibration("", calibr, (1 << 0xD));
+}
+
+/** Load configuration plugin and call first() and second() functions from it */
+
+bool LoadConfig(const char *fname)
+{
+   void *handle = dlopen(fname, RTLD_NOW | RTLD_GLOBAL);
+   if (!handle) {
+      printf("Fail to load configuration %s: %s\n", fname, dlerror());
+      return false;
+   }
+
+   typedef void (*myfunc)();
+
+   const char *names[4] = { "first", "_Z5firstv", "second", "_Z6secondv" };
+
+   bool isfirst = false;
+
+   for (int n = 0; n < 4; n += 2) {
+      myfunc func = (myfunc) dlsym(handle, names[n]);
+      if (!func) func = (myfunc) dlsym(handle, names[n+1]);
+      if (!func) continue;
+      func();
+      if (n == 0) isfirst = true;
+   }
+
+   if (!isfirst) {
+      printf("Configuration %s does not provide first() function\n", fname);
+      return false;
+   }
+
+   return true;
+}
+
+void usage()
+{
+   printf("Standalone stream analysis runner\n");
+   printf("Usage: streamrun [options] file1.hld [file2.hld ...]\n");
+   printf("   -c lib.so     - configuration plugin with first() and optional second() functions,\n");
+   printf("                   compiled from first.C like: g++ -shared -fPIC first.C -o first.so -I$STREAMSYS/include\n");
+   printf("                   without plugin TRB/TDC processors created automatically\n");
+   printf("   -m mode       - analysis mode: raw, triggered or stream\n");
+   printf("   -t nthreads   - number of threads for parallel buffers scan\n");
+   printf("   -H level      - histograms filling level\n");
+   printf("   -a hits       - auto-calibration statistic for compiled-in configuration (default 0 - off)\n");
+   printf("   -n number     - maximal number of input events to process\n");
+   printf("   -o file       - store histograms in internal format into the file\n");
+   printf("   -p [file]     - enable profiling, optionally write JSON report into the file\n");
+   printf("Files with .lmd extension read as MBS list-mode data\n");
+}
+
+int main(int argc, char* argv[])
+{
+   std::string config, mode, histfile, proffile;
+   int nthreads = -1, histlvl = -1, calibr = 0;
+   long unsigned maxevents = 0;
+   bool profiling = false;
+   std::vector<std::string> files;
+
+   for (int n = 1; n < argc; n++) {
+      std::string arg = argv[n];
+      bool hasnext = (n + 1 < argc);
+
+      if ((arg == "-h") || (arg == "--help")) {
+         usage();
+         return 0;
+      } else if ((arg == "-c") && hasnext) {
+         config = argv[++n];
+      } else if ((arg == "-m") && hasnext) {
+         mode = argv[++n];
+      } else if ((arg == "-t") && hasnext) {
+         nthreads = atoi(argv[++n]);
+      } else if ((arg == "-H") && hasnext) {
+         histlvl = atoi(argv[++n]);
+      } else if ((arg == "-a") && hasnext) {
+         calibr = atoi(argv[++n]);
+      } else if ((arg == "-n") && hasnext) {
+         maxevents = strtoul(argv[++n], nullptr, 10);
+      } else if ((arg == "-o") && hasnext) {
+         histfile = argv[++n];
+      } else if (arg == "-p") {
+         profiling = true;
+         if (hasnext && (argv[n+1][0] != '-') && strstr(argv[n+1], ".json"))
+            proffile = argv[++n];
+      } else if (arg[0] == '-') {
+         printf("Unknown option %s\n", arg.c_str());
+         usage();
+         return 1;
+      } else {
+         files.emplace_back(arg);
+      }
+   }
+
+   if (files.empty()) {
+      usage();
+      return 1;
+   }
+
+   if (!mode.empty() && (mode != "raw") && (mode != "triggered") && (mode != "stream")) {
+      printf("Wrong analysis mode %s\n", mode.c_str());
+      return 1;
+   }
+
+   RunProcMgr mgr;
+
+   // histograms must be placed in the file before any processor is created
+   if (!histfile.empty() && !mgr.SetSharedHistograms(histfile.c_str(), 0x40000000, 10000, true)) {
+      printf("Fail to create histograms file %s\n", histfile.c_str());
+      return 1;
+   }
+
+   // defaults, may be changed by configuration
+   mgr.SetTriggeredAnalysis(true);
+   if (histlvl >= 0) mgr.SetHistFilling(histlvl);
+
+   if (config.empty())
+      DefaultConfig(calibr);
+   else if (!LoadConfig(config.c_str()))
+      return 1;
+
+   // command line options have priority
+   if (mode == "raw")
+      mgr.SetRawAnalysis(true);
+   else if (mode == "triggered")
+      mgr.SetTriggeredAnalysis(true);
+   else if (mode == "stream")
+      mgr.SetTriggeredAnalysis(false);
+
+   if (histlvl >= 0) mgr.SetHistFilling(histlvl);
+   if (nthreads >= 0) mgr.SetParallelScan(nthreads);
+   if (profiling) mgr.SetProfiling(true, 0., proffile.empty() ? nullptr : proffile.c_str());
+
+   mgr.UserPreLoop();
+
+   std::vector<char> hldbuf(0x1000000);
+
+   base::Event *evt = nullptr;
+   long unsigned numinp = 0, numout = 0, numskip = 0, totalsize = 0;
+   bool finished = false;
+
+   auto tm_start = std::chrono::steady_clock::now();
+
+   // process all data provided with ProvideRawData, same sequence as in Go4 first step
+   // next input is not provided until backpressure is released or no more events can be produced
+   auto analyze = [&]() {
+      if (maxevents && (numinp >= maxevents)) finished = true;
+      bool filled = mgr.AnalyzeNewData(evt);
+      while (true) {
+         if (!filled) filled = mgr.ProduceNextEvent(evt);
+         if (!filled) break;
+         mgr.ProcessEvent(evt);
+         numout++;
+         if (!mgr.IsStreamAnalysis() && !mgr.IsBackpressure()) break;
+         filled = false;
+      }
+   };
+
+   for (auto &fname : files) {
+      if (finished) break;
+
+      printf("Processing %s\n", fname.c_str());
+
+      if ((fname.length() > 4) && (fname.compare(fname.length() - 4, 4, ".lmd") == 0)) {
+         mbs::LmdFile f;
+         if (!f.OpenRead(fname.c_str())) {
+            printf("Fail to open %s\n", fname.c_str());
+            continue;
+         }
+         while (!finished) {
+            auto evnt = f.NextEvent();
+            if (!evnt) break;
+            numinp++;
+            totalsize += evnt->FullSize();
+            // in stream mode buffers kept in the queues after file is closed, therefore data must be copied
+            if (!f.ProvideEvent(evnt, &mgr, mgr.IsStreamAnalysis())) numskip++;
+            analyze();
+         }
+         continue;
+      }
+
+      hadaq::HldFile f;
+      if (!f.OpenRead(fname.c_str())) {
+         printf("Fail to open %s\n", fname.c_str());
+         continue;
+      }
+
+      while (!finished && !f.eof()) {
+         uint32_t bufsize = hldbuf.size();
+         // always single event in the buffer, required for triggered analysis
+         if (!f.ReadBuffer(hldbuf.data(), &bufsize, true)) break;
+
+         numinp++;
+         totalsize += bufsize;
+
+         // in stream mode buffers kept in the queues, therefore data must be copied
+         base::Buffer buf;
+         if (mgr.IsStreamAnalysis()) {
+            buf.makenew(bufsize);
+            memcpy(buf.ptr(), hldbuf.data(), bufsize);
+         } else {
+            buf.makereferenceof(hldbuf.data(), bufsize);
+         }
+         buf().kind = base::proc_TRBEvent;
+         buf().boardid = 0;
+         buf().format = 0;
+
+         if (!mgr.ProvideRawData(buf)) {
+            printf("No processor for HLD events - stop\n");
+            finished = true;
+            break;
+         }
+         analyze();
+      }
+   }
+
+   // get rest of the events in stream mode
+   if (mgr.IsStreamAnalysis())
+      analyze();
+
+   double tm = std::chrono::duration<double>(std::chrono::steady_clock::now() - tm_start).count();
+
+   mgr.UserPostLoop();
+
+   if (profiling)
+      mgr.ProduceProfilerReport();
+
+   printf("Input events %lu output events %lu size %.3f MB time %.3f s rate %.1f ev/s %.2f MB/s\n",
+          numinp, numout, totalsize/1e6, tm, tm > 0 ? numinp/tm : 0., tm > 0 ? totalsize/1e6/tm : 0.);
+
+   if (numskip > 0)
+      printf("Input events without processed subevents %lu\n", numskip);
+
+   if (mgr.GetSharedHistograms())
+      printf("Stored %u histograms in %s\n", mgr.GetSharedHistograms()->NumHists(), histfile.c_str());
+
+   delete evt;
+
+   return 0;
+}
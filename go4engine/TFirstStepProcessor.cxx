@@ -169,7 +169,8 @@ Bool_t TFirstStepProcessor::BuildEvent(TGo4EventElement* outevnt)
       Bool_t store = TRootProcMgr::ProcessEvent(event);
 
       // only for stream analysis we need possibility to produce as much events as possible
-      if (TRootProcMgr::IsStreamAnalysis())
+      // when queues are too large, next input is not read until events are produced
+      if (TRootProcMgr::IsStreamAnalysis() || TRootProcMgr::IsBackpressure())
          SetKeepInputEvent(kTRUE);
 
       // printf("Store event %s\n", store ? "true" : "false");
@@ -361,6 +362,7 @@ base::H2handle TFirstStepProcessor::MakeH2(const char* name, const char* title,
       if (part.Index("kind:")==0) { kind = part[5]; } else
       if (part.Index("reuse")==0) { useexisting = kTRUE; } else
       if (part.Index("clear_protect")==0) { clear_protect = kTRUE; } else
+      if (part.Index("sparse")==0) { /* only for internal histogram format */ } else
       if (xtitle.Length()==0) xtitle = part;
                          else ytitle = part;
    }
@@ -22,8 +22,10 @@ namespace base {
 
       unsigned      user_tag;   ///< arbitrary data, can be used for any additional data
 
+      RawDataRec*   parent;     ///< record which owns referenced data, released together with this record
+
       /** constructor */
-      RawDataRec() : refcnt(0), kind(0), boardid(0), format(0), local_tm(0), global_tm(0), buf(0), datalen(0), user_tag(0) {}
+      RawDataRec() : refcnt(0), kind(0), boardid(0), format(0), local_tm(0), global_tm(0), buf(0), datalen(0), user_tag(0), parent(0) {}
 
       /** reset */
       void reset()
@@ -37,6 +39,7 @@ namespace base {
          buf = 0;
          datalen = 0;
          user_tag = 0;
+         parent = 0;
       }
    };
 
@@ -102,6 +105,13 @@ namespace base {
           * Source data should exists until single instance of buffer is existing */
          void makereferenceof(void* buf, unsigned datalen);
 
+         /** Method produces buffer instance with own record, which references data of other buffer
+          * Data of source buffer kept until this instance is released, fields like boardid
+          * can be changed without modifying source buffer */
+         void makereferenceof(const Buffer& src);
+
+         static unsigned long NumAllocations();
+
    };
 
 }
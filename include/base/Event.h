@@ -7,11 +7,22 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace base {
 
    typedef std::map<std::string, base::SubEvent*> EventsMap;
 
+   /** Reference on message in subevent, produced by time merging of all subevents */
+   struct MergedMsg {
+      GlobalTime_t  globaltm;    ///< global time of message
+      base::SubEvent *sub;       ///< subevent with message
+      unsigned      indx;        ///< message index in subevent
+
+      /** constructor */
+      MergedMsg(GlobalTime_t tm = 0., base::SubEvent *_sub = nullptr, unsigned _indx = 0) : globaltm(tm), sub(_sub), indx(_indx) {}
+   };
+
    /** Event - collection of several subevents */
 
    class Event {
@@ -78,6 +89,8 @@ namespace base {
 
          /** Return events map */
          EventsMap &GetEventsMap() { return fMap; }
+
+         unsigned MergeTimeSorted(std::vector<MergedMsg> &res, bool dosort = true);
    };
 
 }
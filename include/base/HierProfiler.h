@@ -0,0 +1,181 @@
+#ifndef BASE_HIERPROFILER_H
+#define BASE_HIERPROFILER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#if !defined(__x86_64__) && !defined(__i386__) && !defined(__aarch64__)
+#include <chrono>
+#endif
+
+namespace base {
+
+   class Processor;
+
+   /** \brief Hierarchical profiler with per-processor attribution
+    *
+    * \ingroup stream_core_classes
+    *
+    * Time is measured with CPU cycles counter for nested scopes, created with
+    * STREAM_PROFILE(name, proc) macro. Every scope is identified by its name,
+    * processor and parent scope, therefore same scope name produces
+    * separate entries for each processor and for each calling path.
+    * Every thread accumulates statistic in its own tree without any locking,
+    * trees are merged only when report is produced.
+    *
+    * base::ProcMgr automatically measures main steps of data processing
+    * like FirstBufferScan, SecondBufferScan, AfterFill, calibration, event processors and store.
+    * Enabled with:
+    *
+    *     base::ProcMgr::instance()->SetProfiling(true, 10.); // report every 10 s
+    *
+    * When disabled, every scope costs single check of atomic flag.
+    * When compiled with STREAM_NO_PROFILER definition, scopes are removed completely. */
+
+   class HierProfiler {
+
+      friend class ProfileScope;
+
+      public:
+
+         typedef uint64_t ticks_t;
+
+         /** Returns current value of cycles counter */
+         static inline ticks_t GetTicks()
+         {
+#if defined(__x86_64__) || defined(__i386__)
+            unsigned low, high;
+            asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+            return (ticks_t(high) << 32) | low;
+#elif defined(__aarch64__)
+            uint64_t virtual_timer_value;
+            asm volatile("mrs %0, cntvct_el0" : "=r"(virtual_timer_value));
+            return virtual_timer_value;
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+         }
+
+         /** scope statistic */
+         struct Node {
+            const char       *name{nullptr};    ///< scope name, must be static string
+            const Processor  *proc{nullptr};    ///< processor
+            unsigned          parent{0};        ///< parent node
+            ticks_t           sum{0};           ///< accumulated ticks
+            uint64_t          cnt{0};           ///< number of calls
+            std::string       procname;         ///< processor name
+            std::string       classname;        ///< processor class name
+         };
+
+         /** key to find node */
+         struct Key {
+            const char       *name;             ///< scope name
+            const Processor  *proc;             ///< processor
+            unsigned          parent;           ///< parent node
+            /** compare operator */
+            bool operator==(const Key &k) const { return (name == k.name) && (proc == k.proc) && (parent == k.parent); }
+         };
+
+         /** hash function for the key */
+         struct KeyHash {
+            /** hash value */
+            size_t operator()(const Key &k) const { return (((uintptr_t) k.name >> 3) * 0x9E3779B1u) ^ (((uintptr_t) k.proc >> 4) * 0x85EBCA6Bu) ^ (k.parent * 0xC2B2AE35u); }
+         };
+
+         enum { CacheSize = 1024 };
+
+         /** entry of direct-mapped cache for nodes lookup */
+         struct CacheEntry {
+            Key       key{nullptr, nullptr, 0}; ///< key
+            unsigned  indx{0};                  ///< node index
+         };
+
+         /** statistic of single thread */
+         struct ThreadData {
+            unsigned                                 id{0};      ///< thread number
+            std::vector<Node>                        nodes;      ///< nodes, first is root
+            std::unordered_map<Key, unsigned, KeyHash> map;      ///< map to find node
+            CacheEntry                               cache[CacheSize]; ///< cache of recently used nodes
+            unsigned                                 current{0}; ///< current node
+
+            /** Returns node for specified scope in current parent */
+            unsigned FindNode(const char *name, const Processor *proc)
+            {
+               Key key{name, proc, current};
+               CacheEntry &entry = cache[KeyHash()(key) % CacheSize];
+               if (!(entry.key == key)) {
+                  entry.key = key;
+                  entry.indx = HierProfiler::FindNode(this, name, proc);
+               }
+               return entry.indx;
+            }
+         };
+
+      protected:
+
+         static std::atomic<bool> gEnabled;   ///< profiling is enabled
+
+         static ThreadData *GetThreadData();
+
+         static unsigned FindNode(ThreadData *data, const char *name, const Processor *proc);
+
+      public:
+
+         static void SetEnabled(bool on = true);
+
+         /** Returns true when profiling is enabled */
+         static bool IsEnabled() { return gEnabled.load(std::memory_order_relaxed); }
+
+         static void Reset();
+
+         static double GetMeasuredTime();
+
+         static std::string Report(bool json = false);
+   };
+
+   /** \brief Scope of base::HierProfiler, normally created with STREAM_PROFILE macro */
+
+   class ProfileScope {
+      HierProfiler::ThreadData *fData{nullptr};   ///< thread data, nullptr when not enabled
+      unsigned                  fNode{0};         ///< node of this scope
+      unsigned                  fPrev{0};         ///< previous node
+      HierProfiler::ticks_t     fStart{0};        ///< start ticks
+
+   public:
+      /** constructor, start measurement */
+      ProfileScope(const char *name, const Processor *proc = nullptr)
+      {
+         if (!HierProfiler::IsEnabled()) return;
+         fData = HierProfiler::GetThreadData();
+         fPrev = fData->current;
+         fNode = fData->current = fData->FindNode(name, proc);
+         fStart = HierProfiler::GetTicks();
+      }
+
+      /** destructor, accumulate measured time */
+      ~ProfileScope()
+      {
+         if (!fData) return;
+         HierProfiler::Node &node = fData->nodes[fNode];
+         node.sum += HierProfiler::GetTicks() - fStart;
+         node.cnt++;
+         fData->current = fPrev;
+      }
+   };
+
+}
+
+#define STREAM_PROFILE_CONCAT2(a, b) a##b
+#define STREAM_PROFILE_CONCAT(a, b) STREAM_PROFILE_CONCAT2(a, b)
+
+#ifdef STREAM_NO_PROFILER
+#define STREAM_PROFILE(name, proc)
+#else
+/** Measure time until end of current scope */
+#define STREAM_PROFILE(name, proc) base::ProfileScope STREAM_PROFILE_CONCAT(_stream_profile_, __LINE__)(name, proc)
+#endif
+
+#endif
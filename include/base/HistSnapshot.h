@@ -0,0 +1,89 @@
+#ifndef BASE_HISTSNAPSHOT_H
+#define BASE_HISTSNAPSHOT_H
+
+#include <vector>
+#include <atomic>
+
+#include "base/defines.h"
+
+namespace base {
+
+   class ProcMgr;
+
+   /** \brief Consistent copy of selected histograms
+    *
+    * \ingroup stream_core_classes
+    *
+    * Histograms in internal format are modified by the event loop without any locking.
+    * Therefore consumer in other thread (like web server) may see partially filled histograms.
+    * Snapshot keeps copies of selected histograms, which are produced by the event loop
+    * at the next event boundary - when no processor fills any histogram.
+    *
+    * Snapshot has two buffers. New copy is always written into back buffer and
+    * only then published as front buffer, therefore consumer can read previous
+    * snapshot while new one is produced. Event loop never waits for the consumer:
+    * if request queue is locked, copy is postponed to the next event boundary.
+    *
+    * Typical usage in consumer thread:
+    *
+    *     base::HistSnapshot snap;
+    *     snap.AddH1(h1);
+    *     snap.AddH2(h2);
+    *     base::ProcMgr::instance()->RequestSnapshot(&snap);
+    *     ...
+    *     if (snap.IsReady()) {
+    *        const double *arr = snap.GetHist(0); // same format as H1handle
+    *     }
+    *
+    * Snapshot should not be destroyed while pending, see base::ProcMgr::CancelSnapshot() */
+
+   class HistSnapshot {
+
+      friend class ProcMgr;
+
+      protected:
+
+         /** histogram entry */
+         struct Entry {
+            void   *hist{nullptr};        ///< histogram handle
+            bool    is2d{false};          ///< is 2D histogram
+         };
+
+         std::vector<Entry>    fHists;         ///<! selected histograms
+         std::vector<double>   fBuf[2];        ///<! front and back buffers with histograms copies
+         std::vector<unsigned> fOffsets[2];    ///<! offset of each histogram in the buffer
+         std::atomic<unsigned> fFront{0};      ///<! index of front buffer
+         std::atomic<unsigned> fVersion{0};    ///<! number of produced snapshots
+         std::atomic<bool>     fPending{false}; ///<! true when snapshot is requested but not yet produced
+
+         static unsigned HistSize(const Entry &entry);
+
+         void Produce();
+
+      public:
+         HistSnapshot() {}
+         virtual ~HistSnapshot() {}
+
+         bool AddH1(H1handle h1);
+         bool AddH2(H2handle h2);
+
+         void Clear();
+
+         /** Returns number of selected histograms */
+         unsigned NumHists() const { return fHists.size(); }
+
+         /** Returns true when snapshot is requested but not yet produced */
+         bool IsPending() const { return fPending.load(std::memory_order_acquire); }
+
+         /** Returns true when at least one snapshot was produced and no new one is pending */
+         bool IsReady() const { return !IsPending() && (GetVersion() > 0); }
+
+         /** Returns number of produced snapshots, can be used to detect new copy */
+         unsigned GetVersion() const { return fVersion.load(std::memory_order_acquire); }
+
+         const double *GetHist(unsigned n) const;
+   };
+
+}
+
+#endif
@@ -50,7 +50,19 @@ namespace base {
       void reset() {}
    };
 
-   typedef RecordsQueue<LocalTimeMarker, false> LocalMarkersQueue;
+   typedef RecordsQueue<LocalTimeMarker, true> LocalMarkersQueue;
+
+   // =========================================================================
+
+   /** hit of coincidence channel, converted to global time */
+
+   struct CoincidenceHit {
+      GlobalTime_t  globaltm;    ///< global time of the hit
+      unsigned      localid;     ///< channel or signal id in the processor
+
+      /** constructor */
+      CoincidenceHit(GlobalTime_t tm = 0., unsigned id = 0) : globaltm(tm), localid(id) {}
+   };
 
    // =========================================================================
 
@@ -88,7 +100,7 @@ namespace base {
       int TestHitTime(const GlobalTime_t& hittime, double* dist = 0);
    };
 
-   typedef RecordsQueue<GlobalMarker, false> GlobalMarksQueue;
+   typedef RecordsQueue<GlobalMarker, true> GlobalMarksQueue;
 
 }
 
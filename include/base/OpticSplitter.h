@@ -6,6 +6,7 @@
 #include "base/defines.h"
 
 #include <map>
+#include <vector>
 
 namespace base {
 
@@ -25,6 +26,9 @@ namespace base {
 
          SysCoreMap fMap;   ///< map of processors
 
+         std::vector<SysCoreProc*> fLookup;  ///<! flat table to find processor for 16-bit board id
+         std::vector<SysCoreProc*> fActive;  ///<! processors, which have data in current buffer
+
          /** Returns true when processor used to select trigger signal
           * TRB3 not yet able to perform trigger selection */
          virtual bool doTriggerSelection() const { return false; }
@@ -18,6 +18,9 @@ namespace base {
    class StreamProc;
    class EventProc;
    class EventStore;
+   class TriggerRule;
+   class HistSnapshot;
+   class ShmHistRegistry;
 
    /** \brief Central data and process manager
     *
@@ -35,6 +38,10 @@ namespace base {
 
          enum { MaxBrdId = 256 };
 
+         class ScanThreads;
+         class SnapshotQueue;
+         class HistArena;
+
          enum {
             NoSyncIndex = 0xfffffffe,
             DummyIndex  = 0xffffffff
@@ -55,6 +62,16 @@ namespace base {
          int                      fDfltStoreKind;      ///<! default store kind for any new created processor
          base::Event             *fTrigEvent{nullptr}; ///<! current event, filled when performing triggered analysis
          int                      fDebug{0};            ///<! debug level
+         std::vector<TriggerRule*> fTrigRules;         ///<! software trigger rules, evaluated in stream analysis
+         unsigned                 fParallelScan{0};    ///<! number of threads to scan processors data, 0 or 1 - no threads
+         ScanThreads             *fScanThreads{nullptr}; ///<! threads for parallel scan
+         std::vector<StreamProc*> fParallelProcs;      ///<! processors, which data scanned in parallel
+         SnapshotQueue           *fSnapshots{nullptr}; ///<! requests for histograms snapshots
+         ShmHistRegistry         *fShmHists{nullptr};  ///<! histograms in shared memory
+         bool                     fLazyHists{true};    ///<! allocate large histograms in lazy memory
+         HistArena               *fHistArena{nullptr}; ///<! lazy memory for large histograms
+         double                   fProfInterval{0.};   ///<! interval for profiler reports
+         std::string              fProfJsonFile;       ///<! file name for profiler report in JSON format
 
          static ProcMgr* fInstance;                     ///<! instance
 
@@ -68,6 +85,14 @@ namespace base {
 
          void DeleteAllProcessors();
 
+         GlobalTime_t ProcessTriggerRules();
+
+         void ScanNewBuffers();
+
+         double *AllocateHist(unsigned kind, const char *name, const char *title, const char *options, unsigned long size, bool &iszero, bool sparse = false);
+
+         void ClearHistBins(double *bins, unsigned long len);
+
       public:
          ProcMgr();
          virtual ~ProcMgr();
@@ -127,6 +152,19 @@ namespace base {
          /** Returns true if histograms folders created in sorted alphabetical order */
          virtual bool IsSortedOrder() { return false; }
 
+         /** Enable/disable lazy memory for large histograms in internal format.
+           * Memory pages of such histograms allocated by system only when histogram is filled,
+           * therefore histograms which are never filled do not consume memory */
+         void SetLazyHistograms(bool on = true) { fLazyHists = on; }
+
+         /** Returns true if large histograms allocated in lazy memory */
+         bool IsLazyHistograms() const { return fLazyHists; }
+
+         bool SetSharedHistograms(const char *name, unsigned long size = 0x10000000, unsigned maxhists = 100000, bool isfile = false);
+
+         /** Returns registry of histograms in shared memory */
+         ShmHistRegistry *GetSharedHistograms() const { return fShmHists; }
+
          virtual H1handle MakeH1(const char* name, const char* title, int nbins, double left, double right, const char* xtitle = 0);
          virtual bool GetH1NBins(H1handle h1, int &nbins);
          virtual void FillH1(H1handle h1, double x, double weight = 1.);
@@ -153,6 +191,10 @@ namespace base {
          /** Clear all histograms */
          virtual void ClearAllHistograms() {}
 
+         bool RequestSnapshot(HistSnapshot *snap);
+         void CancelSnapshot(HistSnapshot *snap);
+         void ProcessSnapshots();
+
          virtual C1handle MakeC1(const char* name, double left, double right, base::H1handle h1 = nullptr);
          virtual void ChangeC1(C1handle c1, double left, double right);
          virtual int TestC1(C1handle c1, double value, double *dist = nullptr);
@@ -194,13 +236,34 @@ namespace base {
          /** Returns true if full timed stream analysis is configured */
          bool IsStreamAnalysis() const { return fAnalysisKind == kind_Stream; }
 
+         void SetParallelScan(unsigned nthreads);
+
+         /** Returns number of threads used for parallel scan of processors data */
+         unsigned GetParallelScan() const { return fParallelScan; }
+
+         void SetProfiling(bool on = true, double interval = 0., const char *jsonfile = nullptr);
+
+         void ProduceProfilerReport(bool reset = false);
+
          /** Set sorting flag for all registered processors */
          void SetTimeSorting(bool on);
 
          /** Specify processor index, which is used as time reference for all others */
          void SetTimeMasterIndex(unsigned indx) { fTimeMasterIndex = indx; }
 
-         void ProvideRawData(const Buffer& buf);
+         bool ProvideRawData(const Buffer& buf);
+
+         bool IsBackpressure() const;
+
+         void PrintQueuesStatistic();
+
+         void AddTriggerRule(TriggerRule *rule);
+
+         /** Returns number of configured trigger rules */
+         unsigned NumTriggerRules() const { return fTrigRules.size(); }
+
+         /** Returns trigger rule */
+         TriggerRule *GetTriggerRule(unsigned n) const { return n < fTrigRules.size() ? fTrigRules[n] : nullptr; }
 
          bool AnalyzeSyncMarkers();
 
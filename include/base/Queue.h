@@ -155,7 +155,9 @@ namespace base {
             T* q = new T [newcapacity];
             if (q==0) return false;
 
-            CopyTo(q);
+            // use assign operator - items like base::Buffer can not be copied with memcpy
+            for (unsigned n = 0; n < fSize; n++)
+               q[n] = item(n);
 
             delete [] fQueue;
 
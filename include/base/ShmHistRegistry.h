@@ -0,0 +1,122 @@
+#ifndef BASE_SHMHISTREGISTRY_H
+#define BASE_SHMHISTREGISTRY_H
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+namespace base {
+
+   /** \brief Registry of histograms in shared memory
+    *
+    * \ingroup stream_core_classes
+    *
+    * Histograms in internal format are allocated in named POSIX shared memory segment.
+    * Segment starts with header and directory of histograms, followed by histograms arrays.
+    * Each directory entry has histogram name, title, axis options, kind and location of array.
+    * Array has exactly same layout as H1handle/H2handle.
+    *
+    * External process (like CLI or web server) can attach segment read-only and poll
+    * histograms contents without any communication with analysis process.
+    * Number of histograms grows only - reader should check NumHists() to discover new entries.
+    * Update counter is incremented by analysis at every event boundary.
+    *
+    * Instead of shared memory, normal file can be used with same layout. When file is closed,
+    * it is truncated to used size and can be attached later to read stored histograms.
+    *
+    * Enabled in analysis with:
+    *
+    *     base::ProcMgr::instance()->SetSharedHistograms("/stream_hists");
+    *
+    * Reader:
+    *
+    *     base::ShmHistRegistry reg;
+    *     if (reg.Attach("/stream_hists")) {
+    *        int indx = reg.FindHist("TDC_1000/TDC_1000_Channels");
+    *        const double *arr = reg.GetHist(indx);
+    *     }
+    */
+
+   class ShmHistRegistry {
+      public:
+
+         enum { NameLength = 128 };
+
+         /** directory entry of single histogram */
+         struct Entry {
+            char      name[NameLength];     ///< histogram name
+            char      title[NameLength];    ///< histogram title
+            char      options[NameLength];  ///< axis title or options
+            uint32_t  kind;                 ///< 1 - H1, 2 - H2
+            uint32_t  reserved;             ///< not used
+            uint64_t  offset;               ///< offset of histogram array from segment begin in bytes
+            uint64_t  size;                 ///< number of doubles in histogram array
+         };
+
+         /** header of shared memory segment */
+         struct Header {
+            char                   magic[8];     ///< "STRMHIST"
+            uint32_t               format;       ///< format version
+            uint32_t               maxhists;     ///< maximal number of histograms
+            uint64_t               segsize;      ///< total size of segment
+            uint64_t               used;         ///< used bytes in data area
+            std::atomic<uint64_t>  numhists;     ///< number of published histograms
+            std::atomic<uint64_t>  updatecnt;    ///< incremented by analysis at event boundary
+         };
+
+      protected:
+         std::string  fName;                 ///<! segment name
+         char        *fMem{nullptr};         ///<! mapped memory
+         uint64_t     fSize{0};              ///<! mapped size
+         bool         fOwner{false};         ///<! segment created by this instance
+         bool         fUnlink{true};         ///<! remove segment name when owner closes it
+         bool         fIsFile{false};        ///<! normal file is used instead of shared memory
+
+         /** Returns segment header */
+         Header *hdr() const { return (Header *) fMem; }
+
+         /** Returns directory entry */
+         Entry *entry(unsigned n) const { return (Entry *) (fMem + sizeof(Header)) + n; }
+
+      public:
+         ShmHistRegistry() {}
+         virtual ~ShmHistRegistry();
+
+         bool Create(const char *name, uint64_t size, unsigned maxhists, bool isfile = false);
+
+         bool Attach(const char *name, bool isfile = false);
+
+         void Close();
+
+         /** Returns true when segment is mapped */
+         bool IsOpened() const { return fMem != nullptr; }
+
+         /** Returns true when normal file is used */
+         bool IsFile() const { return fIsFile; }
+
+         /** Keep segment name after close, reader can attach it after analysis is finished */
+         void SetUnlinkOnClose(bool on = true) { fUnlink = on; }
+
+         double *Allocate(unsigned kind, const char *name, const char *title, const char *options, uint64_t size);
+
+         /** Increment update counter, called at event boundary */
+         void MarkUpdate() { if (fMem && fOwner) hdr()->updatecnt.fetch_add(1, std::memory_order_release); }
+
+         /** Returns update counter */
+         uint64_t GetUpdateCnt() const { return fMem ? hdr()->updatecnt.load(std::memory_order_acquire) : 0; }
+
+         /** Returns number of published histograms */
+         unsigned NumHists() const { return fMem ? hdr()->numhists.load(std::memory_order_acquire) : 0; }
+
+         /** Returns directory entry */
+         const Entry *GetEntry(unsigned n) const { return n < NumHists() ? entry(n) : nullptr; }
+
+         /** Returns histogram array in internal format */
+         const double *GetHist(unsigned n) const { return n < NumHists() ? (const double *) (fMem + entry(n)->offset) : nullptr; }
+
+         int FindHist(const char *name) const;
+   };
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define BASE_STREAMPROC_H
 
 #include <string>
+#include <vector>
 
 #include "base/Processor.h"
 
@@ -34,11 +35,14 @@ namespace base {
 
       protected:
 
-         /** buffers queue */
-         typedef RecordsQueue<base::Buffer, false> BuffersQueue;
+         /** buffers queue, can be expanded */
+         typedef RecordsQueue<base::Buffer, true> BuffersQueue;
 
-         /** sync markers queue */
-         typedef RecordsQueue<base::SyncMarker, false> SyncMarksQueue;
+         /** sync markers queue, can be expanded */
+         typedef RecordsQueue<base::SyncMarker, true> SyncMarksQueue;
+
+         /** coincidence hits queue, can be expanded */
+         typedef RecordsQueue<base::LocalTimeMarker, true> CoincHitsQueue;
 
          BuffersQueue fQueue;                     ///<! buffers queue
 
@@ -68,8 +72,21 @@ namespace base {
 
          base::C1handle fTriggerWindow;   ///<  window used for data selection
 
-         static unsigned fMarksQueueCapacity;   ///< maximum number of items in the marksers queue
-         static unsigned fBufsQueueCapacity;   ///< maximum number of items in the queue
+         std::vector<bool> fCoincChannels;  ///< channels which are used in trigger rules
+         CoincHitsQueue  fCoincHits;        ///< hits of coincidence channels in local time
+         GlobalTime_t    fCoincReadyTm;     ///< global time until which all coincidence hits were delivered
+
+         unsigned long   fQueueBytes{0};          ///< total size of buffers in the queue
+         unsigned long   fQueueBytesHighWater{0}; ///< maximal size of buffers in the queue
+         unsigned        fQueueHighWater{0};      ///< maximal number of buffers in the queue
+         unsigned        fMarksHighWater{0};      ///< maximal number of items in markers queues
+         long unsigned   fNumOverLimitBufs{0};    ///< number of buffers added when memory limit was exceeded
+         bool            fBackpressure{false};    ///< when true, input should be paused until queues are processed
+
+         static unsigned fMarksQueueCapacity;   ///< initial number of items in the markers queue
+         static unsigned fBufsQueueCapacity;    ///< initial number of items in the buffers queue
+         static unsigned fMarksQueueLimit;      ///< number of items in the markers queue which causes backpressure
+         static unsigned long fQueueMemoryLimit; ///< size of buffers in the queue of single processor which causes backpressure
 
          /** Make constructor protected - no way to create base class instance */
          StreamProc(const char* name = "", unsigned brdid = DummyBrdId, bool basehist = true);
@@ -89,6 +106,11 @@ namespace base {
            *  and have minimal distance to previous trigger */
          bool AddTriggerMarker(LocalTimeMarker& marker, double tm_range = 0.);
 
+         /** Returns true if channel is used as input or veto of any trigger rule */
+         bool IsCoincidenceChannel(unsigned chid) const { return (chid < fCoincChannels.size()) && fCoincChannels[chid]; }
+
+         void AddCoincidenceHit(unsigned chid, GlobalTime_t localtm);
+
          GlobalTime_t LocalToGlobalTime(GlobalTime_t localtm, unsigned* sync_index = 0);
 
          /** Method return true when sync_index is means interpolation of time */
@@ -127,6 +149,8 @@ namespace base {
             ev->AddMsg(msg);
          }
 
+         void UpdateQueueStat();
+
          /** Removes sync at specified position */
          bool eraseSyncAt(unsigned indx);
 
@@ -189,6 +213,16 @@ namespace base {
           *  \returns true when any new data was scanned */
          virtual bool ScanNewBuffers();
 
+         /** Returns true when queue has buffers which were not yet scanned */
+         bool HasNewBuffers() const { return fQueueScanIndex < fQueue.size(); }
+
+         /** Returns true when data of processor can be scanned in parallel with other processors.
+          * Such processor should not modify any shared data in FirstBufferScan */
+         virtual bool CanParallelScan() const { return false; }
+
+         /** Called in main thread after parallel scan of all processors is completed */
+         virtual void AfterParallelScan() {}
+
          /** With new calibration set (where possible) time of buffers */
          virtual bool ScanNewBuffersTm();
 
@@ -209,6 +243,17 @@ namespace base {
          /** Method to deliver detected triggers from processor to central manager */
          virtual bool CollectTriggers(GlobalMarksQueue& queue);
 
+         /** Enable channel as input for trigger rules */
+         void EnableCoincidenceChannel(unsigned chid);
+
+         /** Returns true if any channel used in trigger rules */
+         bool HasCoincidenceChannels() const { return !fCoincChannels.empty(); }
+
+         /** Returns global time until which all coincidence hits were delivered */
+         GlobalTime_t GetCoincidenceReadyTime() const { return fCoincReadyTm; }
+
+         virtual bool CollectCoincidenceHits(std::vector<CoincidenceHit> &hits);
+
          /** This is method to get back identified triggers from central manager */
          virtual bool DistributeTriggers(const GlobalMarksQueue& queue);
 
@@ -244,10 +289,36 @@ namespace base {
           * which are mapped to the branch */
          virtual void ResetStore() {}
 
-         /** Set markers queue capacity */
+         /** Returns true when processor cannot accept more data and input should be paused */
+         bool IsBackpressure() const { return fBackpressure; }
+
+         /** Returns total size of buffers in the queue */
+         unsigned long GetQueueBytes() const { return fQueueBytes; }
+
+         /** Returns maximal size of buffers in the queue */
+         unsigned long GetQueueBytesHighWater() const { return fQueueBytesHighWater; }
+
+         /** Returns maximal number of buffers in the queue */
+         unsigned GetQueueHighWater() const { return fQueueHighWater; }
+
+         /** Returns maximal number of items in markers queues */
+         unsigned GetMarksHighWater() const { return fMarksHighWater; }
+
+         /** Returns number of buffers added when memory limit was exceeded */
+         long unsigned GetNumOverLimitBuffers() const { return fNumOverLimitBufs; }
+
+         unsigned long GetQueuesMemory() const;
+
+         void ResetHighWaterMarks();
+
+         /** Set initial markers queue capacity */
          static void SetMarksQueueCapacity(unsigned sz) { fMarksQueueCapacity = sz; }
-         /** Set buffers queue capacity */
+         /** Set initial buffers queue capacity */
          static void SetBufsQueueCapacity(unsigned sz) { fBufsQueueCapacity = sz; }
+         /** Set number of items in markers queues which causes backpressure, queues are never limited */
+         static void SetMarksQueueLimit(unsigned sz) { fMarksQueueLimit = sz; }
+         /** Set size of buffers queue of single processor in bytes which causes backpressure, buffers are never dropped */
+         static void SetQueueMemoryLimit(unsigned long sz) { fQueueMemoryLimit = sz; }
 
    };
 
@@ -28,8 +28,30 @@ namespace base {
          /** Method returns event multiplicity - that ever it means */
          virtual unsigned Multiplicity() const { return 0; }
 
+         /** Returns true when messages provide global time stamp, required for time merging */
+         virtual bool HasGlobalTime() const { return false; }
+
+         /** Returns global time of message with specified index */
+         virtual double GetMsgGlobalTime(unsigned) const { return 0.; }
+
    };
 
+   /** Extract global time of message, used when message class has GetGlobalTime() method */
+   template<class MsgClass>
+   inline auto GetMsgGlobalTime(const MsgClass &msg, double &tm, int) -> decltype(msg.GetGlobalTime(), bool())
+   {
+      tm = msg.GetGlobalTime();
+      return true;
+   }
+
+   /** Fallback for messages without global time */
+   template<class MsgClass>
+   inline bool GetMsgGlobalTime(const MsgClass &, double &tm, long)
+   {
+      tm = 0.;
+      return false;
+   }
+
    /** Extended message - any message plus global time stamp */
 
    template<class MsgClass>
@@ -124,10 +146,60 @@ namespace base {
          /** Clear subevent - remove all messages */
          virtual void Clear() { fExtMessages.clear(); }
 
-         /** Do time sorting of messages */
+         /** Do time sorting of messages
+          * Data typically consists of few already sorted runs - like hits of different channels.
+          * Such runs are detected and merged, std::sort only used when data is mostly unordered */
          virtual void Sort()
          {
-            std::sort(fExtMessages.begin(), fExtMessages.end());
+            unsigned sz = fExtMessages.size(), ndesc = 0;
+
+            for (unsigned n = 1; n < sz; n++)
+               if (fExtMessages[n] < fExtMessages[n-1]) ndesc++;
+
+            // already sorted
+            if (ndesc == 0) return;
+
+            if (ndesc > sz/4) {
+               std::sort(fExtMessages.begin(), fExtMessages.end());
+               return;
+            }
+
+            // boundaries of sorted runs
+            std::vector<unsigned> bounds;
+            bounds.reserve(ndesc + 2);
+            bounds.emplace_back(0);
+            for (unsigned n = 1; n < sz; n++)
+               if (fExtMessages[n] < fExtMessages[n-1]) bounds.emplace_back(n);
+            bounds.emplace_back(sz);
+
+            // merge neighboring runs until single run remains
+            while (bounds.size() > 2) {
+               unsigned k = 0, nb = bounds.size();
+               for (unsigned n = 0; n + 2 < nb; n += 2) {
+                  std::inplace_merge(fExtMessages.begin() + bounds[n], fExtMessages.begin() + bounds[n+1], fExtMessages.begin() + bounds[n+2]);
+                  bounds[k++] = bounds[n];
+               }
+               // odd number of runs - last run remains as is
+               if (nb % 2 == 0) bounds[k++] = bounds[nb-2];
+               bounds[k++] = bounds[nb-1];
+               bounds.resize(k);
+            }
+         }
+
+         /** Returns true when messages provide global time stamp */
+         virtual bool HasGlobalTime() const
+         {
+            double tm;
+            return base::GetMsgGlobalTime(MsgClass(), tm, 0);
+         }
+
+         /** Returns global time of message with specified index */
+         virtual double GetMsgGlobalTime(unsigned indx) const
+         {
+            double tm = 0.;
+            if (indx < fExtMessages.size())
+               base::GetMsgGlobalTime(fExtMessages[indx], tm, 0);
+            return tm;
          }
 
    };
@@ -38,6 +38,9 @@ namespace base {
          // this part is dedicated for OpticSplitter and should not be touched
          Buffer    fSplitBuf;         ///<! temporary buffer for splitting
          uint64_t* fSplitPtr;         ///<! current position for split data
+         unsigned  fSplitCnt;         ///<! number of messages for the board in current buffer
+
+         unsigned  fMsgPerBrdCnt{0};  ///<! messages counter, filled into common histogram after parallel scan
 
 
          /** Returns true when processor used to select trigger signal
@@ -46,8 +49,7 @@ namespace base {
 
          void CreateBasicHistograms();
 
-         /** fill histogram */
-         void FillMsgPerBrdHist(unsigned cnt) { FillH1(fMsgPerBrd, GetID(), cnt); }
+         void FillMsgPerBrdHist(unsigned cnt);
 
          bool CheckPrint(double msgtm, double safetymargin = 1e-6);
 
@@ -56,6 +58,12 @@ namespace base {
          SysCoreProc(const char* name, unsigned brdid, OpticSplitter* spl = 0);
          virtual ~SysCoreProc();
 
+         /** Each SysCore board has independent clock, iterators and histograms,
+          * therefore data of several boards can be scanned in parallel */
+         virtual bool CanParallelScan() const { return true; }
+
+         virtual void AfterParallelScan();
+
          /** Set signal id, used for time synchronization
           *  One could use SYNC0 (id=0) or SYNC1 (id=1) for synchronization with other components
           *  if other id specified, local time stamp will be used and no any sync will be used */
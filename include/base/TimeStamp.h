@@ -3,6 +3,7 @@
 
 
 #include <cstdint>
+#include <cmath>
 
 
 namespace base {
@@ -27,6 +28,18 @@ namespace base {
    typedef double GlobalTime_t;
 
 
+   /** type for integer time representation in picoseconds
+     * 63 bits are enough for more than 100 days without wrap,
+     * differences of such values keep full precision for any run length */
+   typedef int64_t PicoTime_t;
+
+   /** convert time in seconds into integer picoseconds */
+   inline PicoTime_t SecondsToPico(double tm) { return (PicoTime_t) std::llround(tm*1e12); }
+
+   /** convert integer picoseconds into time in seconds */
+   inline double PicoToSeconds(PicoTime_t tm) { return tm*1e-12; }
+
+
    /** LocalStampConverter class should perform
     *  conversion of time stamps to time in seconds.
     *  Main problem to solve - handle correctly time stamp wraps.
@@ -45,6 +58,15 @@ namespace base {
 
          double fCoef;          ///<! time coefficient to convert to seconds
 
+         int64_t fPsNum;        ///<! numerator of coefficient to convert to picoseconds
+         int64_t fPsDen;        ///<! denominator of coefficient to convert to picoseconds
+
+         /** Scale wrap-extended stamp to picoseconds without overflow of intermediate values */
+         PicoTime_t ScaleToPico(int64_t full) const
+         {
+            return (full / fPsDen) * fPsNum + ((full % fPsDen) * fPsNum) / fPsDen;
+         }
+
       public:
 
          /** constructor */
@@ -56,7 +78,9 @@ namespace base {
             fCurrentWrap(0),
             fRef(0),
             fConvRef(0),
-            fCoef(1.)
+            fCoef(1.),
+            fPsNum(1000000000000LL),
+            fPsDen(1)
          {
          }
 
@@ -74,6 +98,20 @@ namespace base {
             fValueMask = fWrapSize - 1;
             fCoef = coef;
 
+            // find rational representation of coefficient in ps,
+            // like 5000/1 for 5 ns or 25000/7 for 280 MHz clock
+            double coefps = coef*1e12;
+            fPsDen = 1;
+            fPsNum = std::llround(coefps);
+            for (int64_t den = 1; den <= 1000; den++) {
+               int64_t num = std::llround(coefps*den);
+               if (std::fabs(num - coefps*den) < 1e-6*den) {
+                  fPsNum = num;
+                  fPsDen = den;
+                  break;
+               }
+            }
+
             // TODO: should it be done here???
             MoveRef(0);
          }
@@ -109,6 +147,20 @@ namespace base {
             return (fConvRef + dist) * fCoef;
          }
 
+         /** Returns wrap-extended stamp - counter value without any overflows since begin */
+         int64_t ToFullStamp(LocalStamp_t stamp) const
+         {
+            return fConvRef + distance(fRef, stamp);
+         }
+
+         /** Method convert time stamp to integer picoseconds,
+          * taking into account probable wrap relative to fRef value.
+          * Conversion is exact when clock period is integer or simple fraction of ps */
+         PicoTime_t ToPicoSeconds(LocalStamp_t stamp) const
+         {
+            return ScaleToPico(fConvRef + distance(fRef, stamp));
+         }
+
          /** Move reference to the new position */
          void MoveRef(LocalStamp_t newref)
          {
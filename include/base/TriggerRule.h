@@ -0,0 +1,131 @@
+#ifndef BASE_TRIGGERRULE_H
+#define BASE_TRIGGERRULE_H
+
+#include <string>
+#include <vector>
+
+#include "base/Markers.h"
+
+namespace base {
+
+   class StreamProc;
+   class ProcMgr;
+
+   /** \brief Declarative software trigger, evaluated on time-sorted hit stream
+    *
+    * \ingroup stream_core_classes
+    *
+    * Rule defines coincidence of N-of-M input channels, which may belong to
+    * different stream processors, within specified time window.
+    * In addition, minimal total multiplicity in the window can be required and
+    * veto channels can be configured - any veto hit around the window rejects the trigger.
+    *
+    * Typical usage in first.C:
+    *
+    *     base::TriggerRule *rule = new base::TriggerRule("Coinc", 20e-9);
+    *     rule->AddInput("TDC_1000", 1);
+    *     rule->AddInput("TDC_1001", 1);
+    *     rule->AddInput("TDC_1002", 1);
+    *     rule->AddVeto("TDC_1003", 5);
+    *     rule->SetMinInputs(2); // 2 of 3 coincidence
+    *     base::ProcMgr::instance()->AddTriggerRule(rule);
+    *
+    * Rule is evaluated in base::ProcMgr::CollectNewTriggers() with sliding window algorithm,
+    * produced triggers are used in the same way as AUX/SYNC/ch0 triggers from single processor.
+    * Time units are same as global time units of processors. */
+
+   class TriggerRule {
+
+      friend class ProcMgr;
+
+      protected:
+
+         /** trigger input description */
+         struct Input {
+            std::string procname;          ///< name of stream processor
+            StreamProc *proc{nullptr};     ///< resolved processor
+            unsigned    chid{0};           ///< channel or signal id in the processor
+            bool        isveto{false};     ///< is veto channel
+         };
+
+         /** hit in global time, assigned to rule input */
+         struct Hit {
+            GlobalTime_t tm;               ///< global time
+            unsigned     indx;             ///< input index
+            /** constructor */
+            Hit(GlobalTime_t _tm = 0., unsigned _indx = 0) : tm(_tm), indx(_indx) {}
+            /** compare operator, used for sorting */
+            bool operator<(const Hit &h) const { return tm < h.tm; }
+         };
+
+         std::string          fName;              ///< rule name
+         std::vector<Input>   fInputs;            ///< all inputs and vetoes
+         GlobalTime_t         fWindow{0.};        ///< coincidence window
+         GlobalTime_t         fVetoMargin{0.};    ///< extra margin around window for veto check
+         GlobalTime_t         fDeadTime{-1.};     ///< minimal distance between two triggers, window size when negative
+         unsigned             fMinInputs{1};      ///< minimal number of different inputs in coincidence (N of M)
+         unsigned             fMinMultipl{0};     ///< minimal number of all input hits in the window
+
+         std::vector<Hit>     fHits;              ///< time-sorted input hits, not yet evaluated
+         std::vector<GlobalTime_t> fVetoHits;     ///< time-sorted veto hits
+         std::vector<unsigned> fCounts;           ///< number of hits per input in current window
+         GlobalTime_t         fLastTriggerTm{0.}; ///< time of last produced trigger
+         GlobalTime_t         fScannedTm{0.};     ///< all windows started before this time were evaluated
+
+         long unsigned        fNumTriggers{0};    ///< number of produced triggers
+         long unsigned        fNumVetoed{0};      ///< number of coincidences rejected by veto
+
+         bool ResolveInputs(ProcMgr *mgr);
+
+         void AddHits(StreamProc *proc, const std::vector<CoincidenceHit> &hits);
+
+         GlobalTime_t ReadyTime() const;
+
+         bool IsVetoed(GlobalTime_t left, GlobalTime_t right) const;
+
+         unsigned Evaluate(std::vector<GlobalTime_t> &triggers);
+
+      public:
+
+         TriggerRule(const char *name = "Trigger", GlobalTime_t window = 0.);
+         virtual ~TriggerRule() {}
+
+         /** Returns rule name */
+         const char *GetName() const { return fName.c_str(); }
+
+         /** Set coincidence window */
+         void SetWindow(GlobalTime_t window) { fWindow = window; }
+         /** Returns coincidence window */
+         GlobalTime_t GetWindow() const { return fWindow; }
+
+         /** Set extra time margin before and after window where veto hits are checked */
+         void SetVetoMargin(GlobalTime_t margin) { fVetoMargin = margin; }
+
+         /** Set minimal distance between two triggers, by default equal to window */
+         void SetDeadTime(GlobalTime_t tm) { fDeadTime = tm; }
+
+         /** Set minimal number of different inputs which should fire in window - N in N-of-M */
+         void SetMinInputs(unsigned n) { fMinInputs = n; }
+
+         /** Set minimal total number of hits from all inputs in the window */
+         void SetMinMultiplicity(unsigned n) { fMinMultipl = n; }
+
+         unsigned AddInput(const char *procname, unsigned chid);
+
+         unsigned AddVeto(const char *procname, unsigned chid);
+
+         /** Returns number of configured inputs (without vetoes) */
+         unsigned NumInputs() const;
+
+         /** Returns number of produced triggers */
+         long unsigned NumTriggers() const { return fNumTriggers; }
+
+         /** Returns number of coincidences rejected by veto */
+         long unsigned NumVetoed() const { return fNumVetoed; }
+
+         void Print() const;
+   };
+
+}
+
+#endif
@@ -140,6 +140,29 @@ namespace get4 {
             return 0;
          }
 
+         /** Method return consistent time in integer picoseconds */
+         base::PicoTime_t getMsgTimePs() const
+         {
+            switch (fMsg.getMessageType()) {
+               case base::MSG_EPOCH:
+                  return fConvRoc.ToPicoSeconds(FullTimeStamp(fMsg.getEpochNumber(), 0));
+               case base::MSG_SYNC:
+                  return fConvRoc.ToPicoSeconds(FullTimeStamp((fMsg.getSyncEpochLSB() == (fEpoch & 0x1)) ? fEpoch : fEpoch - 1, fMsg.getSyncTs()));
+               case base::MSG_AUX:
+                  return fConvRoc.ToPicoSeconds(FullTimeStamp((fMsg.getAuxEpochLSB() == (fEpoch & 0x1)) ? fEpoch : fEpoch - 1, fMsg.getAuxTs()));
+               case base::MSG_EPOCH2:
+                  return fConvGet4.ToPicoSeconds(FullTimeStamp2(fMsg.getEpoch2Number(), 0));
+               case base::MSG_GET4:
+                  return fConvGet4.ToPicoSeconds(FullTimeStamp2(fEpoch2[fMsg.getGet4Number() & 0xf], fMsg.getGet4Ts()));
+               case base::MSG_SYS:
+                  if (fMsg.isGet4V10R32())
+                     return fConvGet4.ToPicoSeconds(getMsgStamp2());
+                  else
+                     return fConvRoc.ToPicoSeconds(FullTimeStamp(fEpoch, 0));
+            }
+            return 0;
+         }
+
          void printMessage(unsigned kind = base::msg_print_Prefix | base::msg_print_Data);
 
          void printMessages(unsigned cnt = 100, unsigned kind = base::msg_print_Prefix | base::msg_print_Data);
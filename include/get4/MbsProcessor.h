@@ -9,6 +9,19 @@ namespace get4 {
           BinWidthPs = 50,
           FineCounterBins = 0x80 };
 
+   /** GET4 hit, produced by batched decoding of MBS buffer */
+   struct Get4MbsHit {
+      uint64_t stamp;    ///< epoch-extended stamp in 50 ps bins, 0 when epoch is not known
+      double   tm;       ///< time in ps, calibrated when calibration is used
+      unsigned fine;     ///< fine counter
+      unsigned tot;      ///< ToT in bins, only in 32-bit mode
+      bool     rising;   ///< true for rising edge
+
+      /** constructor */
+      Get4MbsHit(uint64_t _stamp = 0, unsigned _fine = 0, unsigned _tot = 0, bool _rising = true) :
+         stamp(_stamp), tm(0.), fine(_fine), tot(_tot), rising(_rising) {}
+   };
+
    struct Get4MbsChRec {
       base::H1handle fRisFineTm;   ///< histograms of rising stamp for each channel
       base::H1handle fRisCal;      ///< calibration of rising edge
@@ -26,6 +39,8 @@ namespace get4 {
       long falling_stat[FineCounterBins];
       double falling_calibr[FineCounterBins];
 
+      std::vector<Get4MbsHit> hits;   ///< hits of the channel in current buffer
+
       void clearTimes()
       {
          firstr = 0.;
@@ -63,13 +78,15 @@ namespace get4 {
 
       base::H1handle fChannels;  ///<! histogram with channels
       base::H1handle fErrors;  ///<! errors kinds
+      unsigned nmsgs;          ///<! number of messages in current buffer
 
       Get4MbsChRec CH[NumGet4Channels]; ///<! channels-relevant data
 
       Get4MbsRec() :
          used(false),
          fChannels(0),
-         fErrors(0)
+         fErrors(0),
+         nmsgs(0)
       {
          for(unsigned n=0;n<NumGet4Channels;n++) CH[n].init();
       }
@@ -78,6 +95,12 @@ namespace get4 {
       {
          for(unsigned n=0;n<NumGet4Channels;n++) CH[n].clearTimes();
       }
+
+      void clearHits()
+      {
+         nmsgs = 0;
+         for(unsigned n=0;n<NumGet4Channels;n++) CH[n].hits.clear();
+      }
    };
 
    struct Get4MbsRef {
@@ -125,6 +148,14 @@ namespace get4 {
 
          void StoreCalibration(const std::string& fname);
 
+         bool DecodeBuffer(const base::Buffer& buf);
+
+         void CalibrateHits();
+
+         void FillHitsHistograms();
+
+         void FillRefHistograms();
+
 
       public:
 
@@ -0,0 +1,126 @@
+#ifndef HADAQ_CALIBRDB_H
+#define HADAQ_CALIBRDB_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+namespace hadaq {
+
+   enum { CalibrDbVersion = 1 };
+
+   /** Header of calibration database file */
+   struct CalibrDbHeader {
+      char     magic[8];       ///< file signature "HADCALDB"
+      uint32_t version;        ///< format version
+      uint32_t numtdc;         ///< number of TDCs in the index
+      uint64_t filesize;       ///< full size of the file in bytes
+      uint32_t indexcrc;       ///< CRC32 of TDCs index
+      uint32_t headercrc;      ///< CRC32 of all previous header fields
+   };
+
+   /** Entry in TDCs index, index placed after header and sorted by TDC id */
+   struct CalibrDbIndex {
+      uint32_t tdcid;          ///< TDC id
+      uint32_t size;           ///< size of TDC block in bytes
+      uint64_t offset;         ///< offset of TDC block from begin of the file
+      uint32_t crc;            ///< CRC32 of TDC block
+      uint32_t reserved;       ///< reserved, always 0
+   };
+
+   /** Header of TDC block, followed by channels records and calibration curves of all channels */
+   struct CalibrDbTdc {
+      uint32_t tdcid;          ///< TDC id
+      uint32_t numch;          ///< number of channels
+      uint32_t numfine;        ///< number of fine counter bins
+      uint32_t flags;          ///< flags, bit 0 - TDC v4
+      float    temp;           ///< temperature when calibration was performed
+      float    tempcoef;       ///< temperature coefficient
+   };
+
+   /** Channel record in TDC block */
+   struct CalibrDbChannel {
+      uint32_t rising_len;           ///< number of values in rising calibration
+      uint32_t falling_len;          ///< number of values in falling calibration
+      uint32_t stat_rising;          ///< statistic used for rising calibration
+      uint32_t stat_falling;         ///< statistic used for falling calibration
+      float    quality_rising;       ///< quality of rising calibration
+      float    quality_falling;      ///< quality of falling calibration
+      float    tot_shift;            ///< calibrated ToT shift
+      float    tot_dev;              ///< ToT shift deviation
+      float    time_shift_per_grad;  ///< delay caused by temperature change
+      float    trig0d_coef;          ///< scaling coefficient for 0xD trigger calibration
+   };
+
+   /** \brief Calibration database
+     *
+     * \ingroup stream_hadaq_classes
+     *
+     * Single file with calibrations of many TDCs. File contains header with version,
+     * index of TDCs sorted by id and contiguous blocks with calibration of each TDC.
+     * Header, index and every block are protected with CRC32.
+     * File is mapped into memory at once and blocks are read directly from mapped memory.
+     *
+     * Updated blocks collected in memory and written together with all other blocks
+     * into new file, which then replaces old one. Old mapping stays valid during update.
+     * Same database instance shared by all TDCs with the same file name, see CalibrDb::Get().
+     * Blocks are written when all attached TDCs provided their update or detached. */
+
+   class CalibrDb {
+      protected:
+         std::string fFileName;                              ///<! file name
+         char       *fMapped{nullptr};                       ///<! mapped file content
+         uint64_t    fMappedSize{0};                         ///<! size of mapped memory
+         const CalibrDbIndex *fIndex{nullptr};               ///<! index in mapped file
+         unsigned    fNumTdc{0};                             ///<! number of TDCs in mapped file
+         std::map<unsigned, std::vector<char>> fUpdates;     ///<! updated TDC blocks, not yet written
+         unsigned    fWriters{0};                            ///<! number of attached writers
+         unsigned    fDetached{0};                           ///<! number of detached writers
+
+         const CalibrDbIndex *FindIndex(unsigned tdcid) const;
+
+      public:
+         CalibrDb(const std::string &fname = "") : fFileName(fname) {}
+         virtual ~CalibrDb();
+
+         /** Returns file name */
+         const std::string &GetFileName() const { return fFileName; }
+
+         bool Open(const std::string &fname = "");
+
+         void Close();
+
+         /** Returns true when file is mapped */
+         bool IsOpened() const { return fMapped != nullptr; }
+
+         /** Returns number of TDCs in mapped file */
+         unsigned NumTdcs() const { return fNumTdc; }
+
+         const CalibrDbTdc *FindTdc(unsigned tdcid, uint32_t *blksize = nullptr) const;
+
+         void SetTdcBlock(unsigned tdcid, std::vector<char> &blk);
+
+         /** Returns number of not yet written blocks */
+         unsigned NumUpdates() const { return fUpdates.size(); }
+
+         bool Write(const std::string &fname = "");
+
+         bool WriteWhenReady();
+
+         /** Register writer, blocks not written until all writers provide update or detach */
+         void Attach() { fWriters++; }
+
+         void Detach();
+
+         static uint32_t Checksum(const void *data, uint64_t size, uint32_t crc = 0);
+
+         static bool IsDbName(const std::string &fname);
+
+         static std::shared_ptr<CalibrDb> Get(const std::string &fname);
+   };
+
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef HADAQ_HLDGENERATOR_H
+#define HADAQ_HLDGENERATOR_H
+
+#include <cstdint>
+#include <vector>
+
+namespace base {
+   class ProcMgr;
+}
+
+namespace hadaq {
+
+   /** \brief Generator of synthetic TRB3/TDC HLD data
+     *
+     * \ingroup stream_hadaq_classes
+     *
+     * Produces valid hadaqs::RawEvent with one subevent per TRB. TDC data can be placed
+     * directly into TRB subevent or inside HUB sub-subevents. Each TDC block contains
+     * header, epochs and hits (or HDR, EPOC, TMDR, TMDT, TRL messages for TDC v4).
+     * Trigger type 0xD events contain hits in all channels like internal pulser,
+     * which can be used for calibration. Time runs continuously with configured trigger period,
+     * therefore epoch counter can be forced to wrap with SetEpoch().
+     * Optionally errors are injected and data is written in swapped byte order.
+     * Same seed always produces same data.
+     *
+     * Data can be written to file:
+     *
+     *     hadaq::HldGenerator gen;
+     *     gen.SetLayout(2, 1, 4, 33);  // 2 TRBs, 1 HUB, 4 TDCs, 33 channels
+     *     gen.WriteFile("test.hld", 10000);
+     *
+     * or delivered directly to the analysis:
+     *
+     *     while (gen.ProvideEvent(mgr)) {
+     *        if (mgr->AnalyzeNewData(evt))
+     *           mgr->ProcessEvent(evt);
+     *        while (mgr->IsBackpressure() && mgr->ProduceNextEvent(evt))
+     *           mgr->ProcessEvent(evt);
+     *     }
+     */
+
+   class HldGenerator {
+      public:
+
+         /** kinds of injected errors */
+         enum ErrorKinds {
+            err_NoHeader = 0x01,   ///< TDC header missing
+            err_Channel  = 0x02,   ///< hit with channel number out of range
+            err_Fine     = 0x04,   ///< hit with invalid fine counter
+            err_Length   = 0x08,   ///< wrong length of TDC block
+            err_Status   = 0x10,   ///< error bits in subevent status word
+            err_All      = 0x1F    ///< all kinds of errors
+         };
+
+      protected:
+         unsigned fNumTrb{1};             ///<! number of TRB subevents
+         unsigned fNumHub{0};             ///<! number of HUBs in each TRB, 0 - TDCs placed directly
+         unsigned fNumTdc{4};             ///<! number of TDCs in TRB or in HUB
+         unsigned fNumCh{33};             ///<! number of TDC channels, including channel 0
+         unsigned fTrbId{0x8000};         ///<! id of first TRB
+         unsigned fHubId{0x8100};         ///<! id of first HUB
+         unsigned fTdcId{0x0900};         ///<! id of first TDC
+         bool     fVer4{false};           ///<! produce TDC v4 data
+         double   fHitProb{0.3};          ///<! probability that channel has hits
+         unsigned fMaxHits{2};            ///<! maximal number of hits per channel
+         bool     fFalling{true};         ///<! produce falling edges
+         unsigned fFineMin{31};           ///<! minimal fine counter value
+         unsigned fFineMax{491};          ///<! maximal fine counter value
+         double   fTrigPeriod{1000.};     ///<! time between triggers in ns
+         double   fCalibrFraction{0.1};   ///<! fraction of 0xD triggers
+         uint32_t fStartEpoch{0};         ///<! epoch counter of first event
+         double   fErrorRate{0.};         ///<! probability of error in TDC block
+         unsigned fErrorMask{err_All};    ///<! kinds of errors to inject
+         bool     fSwapped{false};        ///<! write data in swapped byte order
+         uint32_t fRunId{1};              ///<! run id
+         uint64_t fSeed{1};               ///<! seed of random generator
+
+         uint64_t fRnd{1};                ///<! random generator state
+         uint32_t fEventCnt{0};           ///<! number of generated events
+         unsigned long fNumErrors{0};     ///<! number of injected errors
+         unsigned long fNumHits{0};       ///<! number of generated hit messages
+         unsigned long fMaxEvents{0};     ///<! maximal number of events for ProvideEvent, 0 - unlimited
+         std::vector<uint32_t> fBuf;      ///<! buffer for produced event
+
+         /** 64-bit random value, splitmix64 */
+         uint64_t Random()
+         {
+            uint64_t z = (fRnd += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+         }
+
+         /** random value in [0,1) */
+         double Uniform() { return (Random() >> 11) * (1./9007199254740992.); }
+
+         /** random value in [0,n) */
+         unsigned Integer(unsigned n) { return n > 0 ? Random() % n : 0; }
+
+         unsigned FillTdc(uint32_t *ptr, unsigned &errkind, unsigned trigtype, double trigtm);
+
+      public:
+         HldGenerator() { SetSeed(1); }
+         virtual ~HldGenerator() {}
+
+         /** Configure number of TRBs, HUBs per TRB, TDCs per TRB or HUB and channels per TDC */
+         void SetLayout(unsigned numtrb, unsigned numhub, unsigned numtdc, unsigned numch)
+         {
+            fNumTrb = numtrb; fNumHub = numhub; fNumTdc = numtdc; fNumCh = numch < 2 ? 2 : numch;
+         }
+
+         /** Configure ids of first TRB, HUB and TDC, others get consequent ids */
+         void SetIds(unsigned trbid, unsigned hubid, unsigned tdcid) { fTrbId = trbid; fHubId = hubid; fTdcId = tdcid; }
+
+         /** Produce TDC v4 data */
+         void SetVer4(bool on = true) { fVer4 = on; }
+
+         /** Configure hits: probability of channel to have hits, maximal hits per channel and falling edges */
+         void SetHits(double prob, unsigned maxhits = 1, bool falling = true)
+         {
+            fHitProb = prob; fMaxHits = maxhits < 1 ? 1 : maxhits; fFalling = falling;
+         }
+
+         /** Configure range of fine counter values */
+         void SetFineLimits(unsigned min, unsigned max) { fFineMin = min; fFineMax = max > min ? max : min + 1; }
+
+         /** Configure time between triggers in ns and fraction of 0xD calibration triggers */
+         void SetTriggers(double period, double calibr_fraction) { fTrigPeriod = period; fCalibrFraction = calibr_fraction; }
+
+         /** Configure epoch counter of first event, epoch values close to 0xFFFFFFF produce epoch wrap */
+         void SetEpoch(uint32_t epoch) { fStartEpoch = epoch & 0xFFFFFFF; }
+
+         /** Configure probability of error in TDC block and kinds of errors, see ErrorKinds */
+         void SetErrors(double rate, unsigned mask = err_All) { fErrorRate = rate; fErrorMask = mask; }
+
+         /** Write data in swapped byte order */
+         void SetSwapped(bool on = true) { fSwapped = on; }
+
+         /** Configure run id */
+         void SetRunId(uint32_t runid) { fRunId = runid; }
+
+         /** Set maximal number of events delivered by ProvideEvent(), 0 - unlimited */
+         void SetMaxEvents(unsigned long max) { fMaxEvents = max; }
+
+         void SetSeed(uint64_t seed);
+
+         /** Returns number of generated events */
+         uint32_t GetNumEvents() const { return fEventCnt; }
+
+         /** Returns number of injected errors */
+         unsigned long GetNumErrors() const { return fNumErrors; }
+
+         /** Returns number of generated hit messages, including reference channel */
+         unsigned long GetNumHits() const { return fNumHits; }
+
+         /** Returns number of TDCs in single event */
+         unsigned GetNumTdcs() const { return fNumTrb * (fNumHub > 0 ? fNumHub : 1) * fNumTdc; }
+
+         unsigned MaxEventSize() const;
+
+         unsigned GenerateEvent(void *buf, unsigned bufsize);
+
+         bool WriteFile(const char *fname, unsigned long numevents);
+
+         bool ProvideEvent(base::ProcMgr *mgr);
+   };
+
+}
+
+#endif
@@ -96,6 +96,17 @@ namespace hadaq {
 
       protected:
 
+         class TransformThreads;
+
+         /** portion of events transformed by single thread */
+         struct TransformPortion {
+            unsigned first{0};             ///< first event
+            unsigned last{0};              ///< after last event
+            std::vector<uint32_t> out;     ///< buffer for transformed events
+            unsigned outlen{0};            ///< size of transformed events in bytes
+            bool failed{false};            ///< true when transformation failed
+         };
+
          TrbProcMap fMap;            ///< map of trb processors
 
          unsigned  fEventTypeSelect; ///< selection for event type (lower 4 bits in event id)
@@ -130,6 +141,11 @@ namespace hadaq {
 
          long fLastHadesTm;               ///<! last hades time
 
+         TransformThreads *fTransformThreads{nullptr};        ///<! threads for parallel transformation
+         std::vector<hadaqs::RawEvent*> fTransformEvents;     ///<! events of current batch
+         std::vector<TransformPortion> fTransformPortions;    ///<! portions of events, one per thread
+         bool fTransformInPlace{false};                       ///<! transform portions in place
+
          /** Returns true when processor used to select trigger signal
           * TRB3 not yet able to perform trigger selection */
          virtual bool doTriggerSelection() const { return false; }
@@ -148,6 +164,12 @@ namespace hadaq {
 
          void SetCrossProcess(bool on);
 
+         unsigned TransformSingleEvent(hadaqs::RawEvent *evnt, unsigned len, void *tgt, unsigned tgtlen, int shard);
+
+         void TransformPortionOfEvents(unsigned n);
+
+         bool TransformParallel(void *src, unsigned len, bool inplace);
+
       public:
 
          HldProcessor(bool auto_create = false, const char* after_func = "");
@@ -168,6 +190,8 @@ namespace hadaq {
 
          void ConfigureCalibration(const std::string& fileprefix, long period, unsigned trig = 0xFFFF);
 
+         bool StoreCalibrations(const std::string& fname);
+
          /** Set event type, only used in the analysis */
          void SetEventTypeSelect(unsigned evid) { fEventTypeSelect = evid; }
 
@@ -187,6 +211,14 @@ namespace hadaq {
 
          unsigned TransformEvent(void* src, unsigned len, void* tgt = 0, unsigned tgtlen = 0);
 
+         unsigned TransformEvents(void* buf, unsigned len);
+
+         unsigned TransformBuffer(void* src, unsigned len, void* tgt, unsigned tgtlen);
+
+         void SetTransformThreads(unsigned nthreads);
+
+         unsigned GetTransformThreads() const;
+
          virtual void UserPreLoop();
 
          /** Return reference on last event header structure */
@@ -0,0 +1,158 @@
+#ifndef HADAQ_TDCCALIBRSTAT_H
+#define HADAQ_TDCCALIBRSTAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace hadaq {
+
+   /** \brief Calibration statistic of all TDC channels
+     *
+     * \ingroup stream_hadaq_classes
+     *
+     * Fine counter statistic kept in single contiguous block with layout [channel][edge][fine],
+     * edge 0 is rising and 1 is falling. Counters are 16-bit, upper bits are promoted
+     * into separate overflow block, allocated only when first counter overflows.
+     * Block can be copied with CopyTo() without memory allocation */
+
+   class TdcCalibrStat {
+      protected:
+         unsigned fNumCh{0};               ///<! number of channels
+         unsigned fNumFine{0};             ///<! number of fine bins
+         std::vector<uint16_t> fCounts;    ///<! lower 16 bits of counters [ch][edge][fine]
+         std::vector<uint16_t> fOverflow;  ///<! upper 16 bits of counters, allocated when required
+         std::vector<long> fAll;           ///<! sum of all counters [ch][edge]
+
+         /** Add carry to upper part of counter */
+         void Promote(unsigned indx, uint32_t carry)
+         {
+            if (fOverflow.empty()) fOverflow.assign(fCounts.size(), 0);
+            fOverflow[indx] += carry;
+         }
+
+      public:
+
+         /** Allocate statistic for specified number of channels and fine bins, clear all counters */
+         void Init(unsigned numch, unsigned numfine)
+         {
+            fNumCh = numch;
+            fNumFine = numfine;
+            fCounts.assign(numch*2*numfine, 0);
+            fOverflow.clear();
+            fAll.assign(numch*2, 0);
+         }
+
+         /** Returns number of channels */
+         unsigned NumChannels() const { return fNumCh; }
+
+         /** Returns number of fine bins */
+         unsigned NumFine() const { return fNumFine; }
+
+         /** Increment counter for single hit */
+         inline void Inc(unsigned ch, unsigned edge, unsigned fine)
+         {
+            unsigned indx = (ch*2 + edge)*fNumFine + fine;
+            if (++fCounts[indx] == 0) Promote(indx, 1);
+            fAll[ch*2 + edge]++;
+         }
+
+         /** Add value to the counter */
+         void Add(unsigned ch, unsigned edge, unsigned fine, uint32_t value)
+         {
+            unsigned indx = (ch*2 + edge)*fNumFine + fine;
+            uint32_t sum = fCounts[indx] + value;
+            fCounts[indx] = sum & 0xFFFF;
+            if (sum >> 16) Promote(indx, sum >> 16);
+            fAll[ch*2 + edge] += value;
+         }
+
+         /** Returns counter value */
+         uint32_t Get(unsigned ch, unsigned edge, unsigned fine) const
+         {
+            unsigned indx = (ch*2 + edge)*fNumFine + fine;
+            return fOverflow.empty() ? fCounts[indx] : ((uint32_t) fOverflow[indx] << 16) | fCounts[indx];
+         }
+
+         /** Returns sum of all counters for channel and edge */
+         long GetAll(unsigned ch, unsigned edge) const { return fAll[ch*2 + edge]; }
+
+         /** Copy counters of channel and edge into vector */
+         void Fill(unsigned ch, unsigned edge, std::vector<uint32_t> &stat) const
+         {
+            stat.resize(fNumFine);
+            for (unsigned fine = 0; fine < fNumFine; ++fine)
+               stat[fine] = Get(ch, edge, fine);
+         }
+
+         /** Add statistic of falling edge to rising edge and clear falling edge */
+         void MergeEdges(unsigned ch)
+         {
+            for (unsigned fine = 0; fine < fNumFine; ++fine) {
+               uint32_t value = Get(ch, 1, fine);
+               if (value) Add(ch, 0, fine, value);
+            }
+            ClearEdge(ch, 1);
+         }
+
+         /** Clear counters of channel and edge */
+         void ClearEdge(unsigned ch, unsigned edge)
+         {
+            unsigned indx = (ch*2 + edge)*fNumFine;
+            memset(fCounts.data() + indx, 0, fNumFine*sizeof(uint16_t));
+            if (!fOverflow.empty())
+               memset(fOverflow.data() + indx, 0, fNumFine*sizeof(uint16_t));
+            fAll[ch*2 + edge] = 0;
+         }
+
+         /** Clear counters of channel */
+         void ClearChannel(unsigned ch)
+         {
+            ClearEdge(ch, 0);
+            ClearEdge(ch, 1);
+         }
+
+         /** Clear all counters, overflow block is released */
+         void Clear()
+         {
+            memset(fCounts.data(), 0, fCounts.size()*sizeof(uint16_t));
+            fOverflow.clear();
+            for (auto &v : fAll) v = 0;
+         }
+
+         /** Returns true when channel has statistic */
+         bool HasChannelStat(unsigned ch) const { return (fAll[ch*2] > 0) || (fAll[ch*2 + 1] > 0); }
+
+         /** Add statistic of channel from other block and clear it there */
+         void MoveChannelFrom(TdcCalibrStat &src, unsigned ch)
+         {
+            for (unsigned edge = 0; edge < 2; ++edge) {
+               if (src.GetAll(ch, edge) == 0) continue;
+               for (unsigned fine = 0; fine < fNumFine; ++fine) {
+                  uint32_t value = src.Get(ch, edge, fine);
+                  if (value) Add(ch, edge, fine, value);
+               }
+               src.ClearEdge(ch, edge);
+            }
+         }
+
+         /** Copy complete statistic into other block, memory is reused */
+         void CopyTo(TdcCalibrStat &tgt) const
+         {
+            tgt.fNumCh = fNumCh;
+            tgt.fNumFine = fNumFine;
+            tgt.fCounts.resize(fCounts.size());
+            memcpy(tgt.fCounts.data(), fCounts.data(), fCounts.size()*sizeof(uint16_t));
+            if (fOverflow.empty()) {
+               tgt.fOverflow.clear();
+            } else {
+               tgt.fOverflow.resize(fOverflow.size());
+               memcpy(tgt.fOverflow.data(), fOverflow.data(), fOverflow.size()*sizeof(uint16_t));
+            }
+            tgt.fAll = fAll;
+         }
+   };
+
+}
+
+#endif
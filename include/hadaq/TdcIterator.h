@@ -127,6 +127,10 @@ namespace hadaq {
          inline double getMsgTimeCoarse() const
          { return fConv.ToSeconds(getMsgStamp()); }
 
+         /** get coarse time for the current message in integer picoseconds */
+         inline base::PicoTime_t getMsgTimeCoarsePs() const
+         { return fConv.ToPicoSeconds(getMsgStamp()); }
+
          /** return fine time value for current message */
          inline double getMsgTimeFine() const
          {
@@ -6,10 +6,12 @@
 #include "hadaq/TdcMessage.h"
 #include "hadaq/TdcIterator.h"
 #include "hadaq/TdcSubEvent.h"
+#include "hadaq/TdcCalibrStat.h"
 
 #include <vector>
 #include <cmath>
 #include <string>
+#include <memory>
 
 namespace hadaq {
 
@@ -29,6 +31,8 @@ namespace hadaq {
     * - 3 - basic per-channel histograms with IDs
     * - 4 - per-channel histograms with references **/
 
+   class CalibrDb;
+
    class TdcProcessor : public SubProcessor {
 
       friend class TrbProcessor;
@@ -63,6 +67,7 @@ namespace hadaq {
             int rising_cnt;                ///<! number of rising hits in last event
             int falling_cnt;               ///<! number of falling hits in last event
             double rising_hit_tm;          ///<! leading edge time, used in correlation analysis. can be first or last time
+            base::PicoTime_t rising_hit_ps; ///<! leading edge time in ps, used for reference channel differences
             double rising_last_tm;         ///<! last leading edge time
             bool rising_new_value;         ///<! used to calculate TOT and avoid errors after single leading and double trailing edge
             double rising_ref_tm;          ///<! rising ref time
@@ -71,11 +76,7 @@ namespace hadaq {
             unsigned rising_fine;          ///<! rising fine
             unsigned last_rising_fine;     ///<! last rising fine
             unsigned last_falling_fine;    ///<! last falling fine
-            long all_rising_stat;          ///<! all rising stat
-            long all_falling_stat;         ///<! all falling stat
-            std::vector<uint32_t> rising_stat;  ///<! rising stat
             std::vector<float> rising_calibr;   ///<! rising calibr
-            std::vector<uint32_t> falling_stat;  ///<! falling stat
             std::vector<float> falling_calibr;   ///<! falling calibr
             float last_tot;                 ///<! last tot
             long tot0d_cnt;                 ///<! counter of tot0d statistic for calibration
@@ -118,6 +119,7 @@ namespace hadaq {
                rising_cnt(0),
                falling_cnt(0),
                rising_hit_tm(0.),
+               rising_hit_ps(0),
                rising_last_tm(0),
                rising_new_value(false),
                rising_ref_tm(0.),
@@ -126,11 +128,7 @@ namespace hadaq {
                rising_fine(0),
                last_rising_fine(0),
                last_falling_fine(0),
-               all_rising_stat(0),
-               all_falling_stat(0),
-               rising_stat(),
                rising_calibr(),
-               falling_stat(),
                falling_calibr(),
                last_tot(0.),
                tot0d_cnt(0),
@@ -150,18 +148,12 @@ namespace hadaq {
             /** create calibration structures */
             void CreateCalibr(unsigned numfine, double coarse_unit = -1.)
             {
-               rising_stat.resize(numfine);
-               falling_stat.resize(numfine);
-
                FillCalibr(numfine, coarse_unit);
             }
 
             /** Initialize claibration with default values */
-            void FillCalibr(unsigned numfine, double coarse_unit = -1.)
+            void FillCalibr(unsigned /* numfine */, double coarse_unit = -1.)
             {
-               for (unsigned n=0;n<numfine;n++)
-                  falling_stat[n] = rising_stat[n] = 0;
-
                SetLinearCalibr(hadaq::TdcMessage::GetFineMinValue(), hadaq::TdcMessage::GetFineMaxValue(), coarse_unit);
             }
 
@@ -190,9 +182,7 @@ namespace hadaq {
             /** Release memory used by calibration structures */
             void ReleaseCalibr()
             {
-               rising_stat.clear();
                rising_calibr.clear();
-               falling_stat.clear();
                falling_calibr.clear();
             }
 
@@ -212,6 +202,41 @@ namespace hadaq {
             }
          };
 
+         /** Statistic of data transformation, performed in worker thread.
+           * Calibration functions and configuration of processor are only read,
+           * statistic merged into processor when all threads are finished */
+         struct TransformShard {
+            TdcCalibrStat stat;                   ///<! calibration statistic of all channels
+            std::vector<double> rising_last_tm;   ///<! last leading edge time per channel
+            std::vector<char> rising_new_value;   ///<! new leading edge per channel, used for ToT
+            std::vector<float> last_tot;          ///<! last ToT per channel
+            std::vector<uint32_t> tot0d_hist;     ///<! ToT from 0xD trigger [ch*TotBins + bin], allocated only when required
+            std::vector<uint32_t> rising_fine;    ///<! all rising fine counters for histograms [ch*numfine + fine]
+            std::vector<uint32_t> falling_fine;   ///<! all falling fine counters for histograms [ch*numfine + fine]
+            std::vector<uint32_t> coarse;         ///<! all coarse counters for histograms [ch*2048 + coarse]
+            long msgs_kind[8];                    ///<! number of messages of each kind
+            long msgcnt{0};                       ///<! number of messages
+            long hitcnt{0};                       ///<! number of hits
+            long errcnt{0};                       ///<! number of errors
+            long calibr_cnt{0};                   ///<! number of data blocks used for calibration
+            long dtrig_cnt{0};                    ///<! number of detected 0xD triggers
+            double temp_sum0{0.};                 ///<! sum0 of temperature
+            double temp_sum1{0.};                 ///<! sum1 of temperature
+            double temp_sum2{0.};                 ///<! sum2 of temperature
+            int hwtype{-1};                       ///<! hardware type from TDC header, -1 if not seen
+            bool used{false};                     ///<! if any data was transformed
+
+            /** Reset counters, arrays are cleared during merge */
+            void ResetCounters()
+            {
+               for (int n = 0; n < 8; n++) msgs_kind[n] = 0;
+               msgcnt = hitcnt = errcnt = calibr_cnt = dtrig_cnt = 0;
+               temp_sum0 = temp_sum1 = temp_sum2 = 0.;
+               hwtype = -1;
+               used = false;
+            }
+         };
+
          bool fVersion4{false};         ///< if version4 TDC is analyzed
 
          TdcIterator fIter1;         ///<! iterator for the first scan
@@ -250,6 +275,7 @@ namespace hadaq {
          unsigned                 fNumChannels;       ///<! number of channels
          unsigned                 fNumFineBins;       ///<! number of fine-counter bins
          std::vector<ChannelRec>  fCh;                ///<! full description for each channels
+         TdcCalibrStat            fCalibrStat;        ///<! calibration statistic for all channels, kept apart from channels configuration
          float                    fCalibrTemp;        ///<! temperature when calibration was performed
          float                    fCalibrTempCoef;    ///<! coefficient to scale calibration curve (real value -1)
          bool                     fCalibrUseTemp;     ///<! when true, use temperature adjustment for calibration
@@ -304,6 +330,7 @@ namespace hadaq {
 
          std::string fWriteCalibr;    ///<! file which should be written at the end of data processing
          bool        fWriteEveryTime; ///<! write calibration every time automatic calibration performed
+         std::shared_ptr<CalibrDb> fCalibrDb; ///<! calibration database, used when file name has .caldb suffix
          bool        fUseLinear;      ///<! create linear calibrations for the channel
          int         fLinearNumPoints; ///<! number of linear points
 
@@ -331,6 +358,16 @@ namespace hadaq {
 
          std::vector<std::string> fCalibrLog; ///<! error log messages during calibration
 
+         std::vector<TransformShard> fShards; ///<! statistic of parallel transformation, one per thread
+
+         std::vector<uint16_t>    fHit2Table;      ///<! Hit2 fine and coarse correction for [ch][edge][fine], used for in-place transformation
+         bool                     fHit2TableReady{false}; ///<! true when table matches current calibrations
+
+         long                     fRollingBlock{0};      ///<! rolling calibration - hits in channel between updates, 0 - disabled
+         float                    fRollingDecay{0.5};    ///<! rolling calibration - weight of previous statistic at every update
+         std::vector<double>      fRollingIntegral;      ///<! rolling calibration - decayed cumulative fine counter statistic [ch][edge][fine]
+         std::vector<float>       fRollingCalibr;        ///<! rolling calibration - new curve, swapped with channel curve when accepted
+
          /** Returns true when processor used to select trigger signal
           * TDC not yet able to perform trigger selection */
          virtual bool doTriggerSelection() const { return false; }
@@ -372,6 +409,7 @@ namespace hadaq {
          long CheckChannelStat(unsigned ch);
 
          double CalibrateChannel(unsigned nch, bool rising, const std::vector<uint32_t> &statistic, std::vector<float> &calibr, bool use_linear = false, bool preliminary = false);
+         double CalibrateIntegral(unsigned nch, bool rising, const double *integral, std::vector<float> &calibr, bool use_linear = false, bool preliminary = false);
          void CopyCalibration(const std::vector<float> &calibr, base::H1handle hcalibr, unsigned ch = 0, base::H2handle h2calibr = 0);
 
          bool CalibrateTot(unsigned ch, std::vector<uint32_t> &hist, float &tot_shift, float &tot_dev, float cut = 0.);
@@ -384,8 +422,25 @@ namespace hadaq {
 
          bool PerformAutoCalibrate();
 
+         bool RollChannelCalibration(unsigned ch, unsigned edge);
+
+         void CheckRollingCalibration();
+
+         void AttachCalibrDb(const std::string &fname);
+
+         void DetachCalibrDb();
+
+         void CheckCalibrProgress();
+
          void ClearChannelStat(unsigned ch);
 
+         uint32_t CalcHit2Fine(const ChannelRec &rec, double corr, bool isrising, unsigned &corr_coarse);
+
+         bool PrepareHit2Table();
+
+         /** Invalidate Hit2 table, must be called when calibrations or ToT shifts are changed */
+         void ResetHit2Table() { fHit2TableReady = false; }
+
          float ExtractCalibr(const std::vector<float> &func, unsigned bin);
 
          /** extract calibration value */
@@ -607,11 +662,7 @@ namespace hadaq {
             if (ch < fCh.size()) fCh[ch].time_shift_per_grad = shift_per_grad;
          }
 
-         /** Set channel TOT shift in nano-seconds, typical value is around 30 ns */
-         void SetChannelTotShift(unsigned ch, float tot_shift)
-         {
-            if (ch < fCh.size()) fCh[ch].tot_shift = tot_shift;
-         }
+         void SetChannelTotShift(unsigned ch, float tot_shift);
 
          void DisableCalibrationFor(unsigned firstch, unsigned lastch = 0);
 
@@ -644,6 +695,11 @@ namespace hadaq {
          /** configure auto calibration */
          void SetAutoCalibration(long cnt = 100000) { fCalibrCounts = cnt % 1000000000L; fAutoCalibrOnce = (cnt>1000000000L); fAutoCalibr = (cnt >= 0); }
 
+         void SetRollingCalibration(long block = 100000, float decay = 0.5);
+
+         /** Returns true when rolling calibration is enabled */
+         bool IsRollingCalibration() const { return fRollingBlock > 0; }
+
          /** Configure mode, when calibration should be start/stop explicitly */
          void UseExplicitCalibration() { fAllCalibrMode = 0; }
 
@@ -733,11 +789,19 @@ namespace hadaq {
 
          void StoreCalibration(const std::string& fname, unsigned fileid = 0);
 
+         void StoreCalibrationDb(CalibrDb &db);
+
+         bool LoadCalibrationDb(const CalibrDb &db);
+
          virtual void Store(base::Event*);
 
          virtual void ResetStore();
 
-         unsigned TransformTdcData(hadaqs::RawSubevent* sub, uint32_t *rawdata, unsigned indx, unsigned datalen, hadaqs::RawSubevent* tgt = 0, unsigned tgtindx = 0);
+         unsigned TransformTdcData(hadaqs::RawSubevent* sub, uint32_t *rawdata, unsigned indx, unsigned datalen, hadaqs::RawSubevent* tgt = 0, unsigned tgtindx = 0, int shard = -1);
+
+         void PrepareTransformShards(unsigned numshards);
+
+         void MergeTransformShards();
 
          void EmulateTransform(int dummycnt);
 
@@ -68,6 +68,8 @@ namespace hadaq {
 
       /**  stamp */
       double getStamp() const { return stamp; }
+      /**  full time stamp, used for time merging of subevents */
+      double GetGlobalTime() const { return stamp; }
       /**  channel */
       uint8_t getCh() const { return ch & 0x7F; }
       /**  edge 0 - rising, 1 - falling */
@@ -2,7 +2,6 @@
 #define HADAQ_TRBPROCESSOR_H
 
 #include "base/StreamProc.h"
-//#include "base/Profiler.h"
 #include "hadaq/definess.h"
 #include "hadaq/TdcProcessor.h"
 #include "hadaq/SubProcessor.h"
@@ -94,11 +93,19 @@ namespace hadaq {
          TrbMessage  fMsg;            ///< used for TTree store
          TrbMessage* pMsg{nullptr};    ///< used for TTree store
 
-//         base::Profiler  fProfiler;   ///< profiler
+         /** entry of dispatch table for 16-bit id of sub-sub-event */
+         struct DispatchEntry {
+            TdcProcessor *tdc{nullptr};       ///< TDC processor
+            SubProcessor *sub{nullptr};       ///< other sub-processor
+            SubProcessor *attached{nullptr};  ///< TDC attached to other sub-processor, registered with id | 0xff0000
+            bool hub{false};                  ///< id of HUB
+         };
 
-         unsigned fMinTdc;         ///< minimal id of TDC
-         unsigned fMaxTdc;         ///< maximal id of TDC
-         std::vector<hadaq::TdcProcessor*> fTdcsVect; ///< array of TDCs
+         std::vector<DispatchEntry> fDispatch; ///<! pages of dispatch table, 256 entries each, first page always empty
+         uint16_t fDispatchPage[256];          ///<! page index for upper byte of id
+         bool fDispatchReady{false};           ///<! dispatch table is build
+
+         base::Buffer fDirectBuf;          ///<! reusable buffer descriptor for direct scan of sub-processors data
 
          hadaqs::RawSubevent   fLastSubevHdr; ///<! copy of last subevent header (without data)
          unsigned fCurrentRunId;           ///<! current runid
@@ -107,6 +114,7 @@ namespace hadaq {
          static unsigned gNumChannels;     ///< default number of channels
          static unsigned gEdgesMask;       ///< default edges mask
          static bool gIgnoreSync;          ///< ignore sync in analysis, very rare used for sync with other data sources
+         static bool gDirectScan;          ///< scan data of sub-processors directly when no stream analysis is performed
 
          static unsigned gTDCMin;          ///< min TDC id when doing autoscan
          static unsigned gTDCMax;          ///< max TDC id when doing autoscan
@@ -131,7 +139,14 @@ namespace hadaq {
          void AfterEventScan();
          void AfterEventFill();
 
-         void BuildFastTDCVector();
+         void BuildDispatchTable();
+
+         /** Returns dispatch entry for sub-sub-event id, table build when necessary */
+         const DispatchEntry &FindDispatch(unsigned id)
+         {
+            if (!fDispatchReady) BuildDispatchTable();
+            return fDispatch[fDispatchPage[(id >> 8) & 0xff]*256 + (id & 0xff)];
+         }
 
          virtual void CreateBranch(TTree* t);
 
@@ -152,10 +167,10 @@ namespace hadaq {
          void SetAutoCreate(bool on = true) { fAutoCreate = on; }
 
          /** Set id of CTS sub-sub event */
-         void SetHadaqCTSId(unsigned id) { fHadaqCTSId = id; }
+         void SetHadaqCTSId(unsigned id) { fHadaqCTSId = id; fDispatchReady = false; }
 
          /** Add HUB id */
-         void AddHadaqHUBId(unsigned id) { fHadaqHUBId.emplace_back(id); }
+         void AddHadaqHUBId(unsigned id) { fHadaqHUBId.emplace_back(id); fDispatchReady = false; }
 
          /** Set up to 4 different HUB ids */
          void SetHadaqHUBId(unsigned id1, unsigned id2=0, unsigned id3=0, unsigned id4=0)
@@ -268,12 +283,25 @@ namespace hadaq {
                unsigned ix,
                unsigned datalen);
 
+         bool DirectScanTDC(
+               hadaqs::RawSubevent* sub,
+               hadaq::SubProcessor* tdcproc,
+               unsigned ix,
+               unsigned datalen);
+
          TdcProcessor* FindTDC(unsigned tdcid) const;
 
          static void SetDefaults(unsigned numch=65, unsigned edges=0x1, bool ignore_sync = true);
 
          static unsigned GetDefaultNumCh();
 
+         /** Enable/disable direct scan of sub-processors data in triggered or raw analysis.
+          * When enabled, data are scanned immediately without intermediate buffers queue */
+         static void SetDirectScan(bool on = true) { gDirectScan = on; }
+
+         /** Returns true if direct scan of sub-processors data is enabled */
+         static bool IsDirectScan() { return gDirectScan; }
+
          /** Define range for TDCs, used when auto mode is enabled */
          static void SetTDCRange(unsigned min, unsigned max)
          {
@@ -297,6 +325,8 @@ namespace hadaq {
 
          void SetAutoCalibrations(long cnt = 100000);
 
+         void SetRollingCalibrations(long block = 100000, float decay = 0.5);
+
          void SetWriteCalibrations(const char* fileprefix, bool every_time = false, bool use_linear = false);
 
          bool LoadCalibrations(const char* fileprefix);
@@ -309,7 +339,11 @@ namespace hadaq {
 
          void ClearFastTDCVector();
 
-         unsigned TransformSubEvent(hadaqs::RawSubevent *sub, void *tgtbuf = nullptr, unsigned tgtlen = 0, bool only_hist = false, std::vector<unsigned> *newids = nullptr);
+         unsigned TransformSubEvent(hadaqs::RawSubevent *sub, void *tgtbuf = nullptr, unsigned tgtlen = 0, bool only_hist = false, std::vector<unsigned> *newids = nullptr, int shard = -1);
+
+         void PrepareTransformShards(unsigned numshards);
+
+         void MergeTransformShards();
 
          unsigned EmulateTransform(hadaqs::RawSubevent *sub, int dummycnt, bool only_hist = false);
 
@@ -0,0 +1,147 @@
+#ifndef MBS_LMDFILE_H
+#define MBS_LMDFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "base/Buffer.h"
+
+namespace base {
+   class ProcMgr;
+}
+
+namespace mbs {
+
+   enum {
+      MbsTypeLong = 0x0001000a,        ///< type 10, subtype 1 - event and subevent
+      MbsTypeFileHeader = 0x00010065   ///< type 101, subtype 1 - LMD file header
+   };
+
+   /** Common header of all MBS elements */
+   struct Header {
+      uint32_t iWords;     ///< data length + 4 in 16-bit words
+      uint32_t iType;      ///< type in low 16 bits, subtype in high 16 bits
+
+      /** Full size of element in bytes, including header */
+      uint32_t FullSize() const { return (iWords + 4) * 2; }
+
+      /** Element type */
+      uint16_t Type() const { return iType & 0xffff; }
+
+      /** Element subtype */
+      uint16_t SubType() const { return iType >> 16; }
+   };
+
+   /** MBS subevent header, type 10 subtype 1 */
+   struct SubeventHeader : public Header {
+      int8_t   iControl;     ///< processor type code
+      int8_t   iSubcrate;    ///< subcrate number
+      int16_t  iProcId;      ///< processor id
+
+      /** Subevent data */
+      void *RawData() const { return (char*) this + sizeof(SubeventHeader); }
+
+      /** Size of subevent data in bytes */
+      uint32_t RawDataSize() const { return FullSize() - sizeof(SubeventHeader); }
+   };
+
+   /** MBS event header, type 10 subtype 1 */
+   struct EventHeader : public Header {
+      uint16_t iDummy;       ///< not used
+      uint16_t iTrigger;     ///< trigger number
+      uint32_t iEventNumber; ///< event number
+
+      /** Returns first subevent */
+      SubeventHeader *FirstSubevent() const { return NextSubevent(nullptr); }
+
+      /** Returns next subevent, nullptr at the end */
+      SubeventHeader *NextSubevent(SubeventHeader *prev) const
+      {
+         char *pos = prev ? (char*) prev + prev->FullSize() : (char*) this + sizeof(EventHeader),
+              *end = (char*) this + FullSize();
+         if (pos + sizeof(SubeventHeader) > end) return nullptr;
+         SubeventHeader *sub = (SubeventHeader*) pos;
+         return (pos + sub->FullSize() <= end) ? sub : nullptr;
+      }
+   };
+
+   /** Header of LMD file, type 101 subtype 1 */
+   struct FileHeader {
+      uint32_t iMaxWords;        ///< maximal size in words
+      uint32_t iType;            ///< type and subtype
+      uint64_t iTableOffset;     ///< offset to the table of events in 4-byte words, 0 when no table
+      uint32_t iElements;        ///< number of elements
+      uint32_t iOffsetSize;      ///< size of offsets in table
+      uint32_t iTimeSpecSec;     ///< file creation time, seconds
+      uint32_t iTimeSpecNanoSec; ///< file creation time, nanoseconds
+      uint32_t iEndian;          ///< endian code
+      uint32_t iWrittenEndian;   ///< endian code of writer
+      uint32_t iVersion;         ///< version
+      uint32_t iUsedWords;       ///< number of 16-bit words of extra header data, which follows this structure
+   };
+
+   /** \brief Reader of MBS list-mode data (LMD) files
+    *
+    * File is mapped into memory, subevents are delivered as base::Buffer
+    * referencing mapped data without copying. Therefore file must be kept open until
+    * all buffers are processed - or data must be copied with ProvideEvent(evnt, mgr, true),
+    * as required in stream analysis when file is closed before all events are produced.
+    * When file cannot be mapped (like pipes),
+    * it is read event by event and subevents data are copied.
+    * Only files with native byte order and without old-style fixed-size buffers are supported.
+    *
+    * Typical usage:
+    *
+    *     mbs::LmdFile f;
+    *     if (f.OpenRead("file.lmd"))
+    *        while (auto evnt = f.NextEvent()) {
+    *           f.ProvideEvent(evnt, base::ProcMgr::instance());
+    *           mgr->AnalyzeNewData(outevent);
+    *        }
+    */
+
+   class LmdFile {
+      protected:
+         std::string  fFileName;          ///<! file name
+         FILE        *fFile{nullptr};     ///<! file handle when mapping is not possible
+         char        *fMapped{nullptr};   ///<! mapped file content
+         uint64_t     fMappedSize{0};     ///<! size of mapped memory
+         uint64_t     fPos{0};            ///<! current position in mapped file
+         uint64_t     fEnd{0};            ///<! end of events data in mapped file
+         base::Buffer fEventBuf;          ///<! buffer for event when file is read without mapping
+         Header       fNextHdr;           ///<! header of next event, already read from the file
+         bool         fHasNextHdr{false}; ///<! true when header of next event was read
+         bool         fEOF{true};         ///<! end of file is reached
+         long unsigned fNumEvents{0};     ///<! number of read events
+
+         EventHeader *ReadNextEvent();
+
+      public:
+         LmdFile() {}
+         virtual ~LmdFile();
+
+         bool OpenRead(const char *fname);
+
+         void Close();
+
+         /** Returns true when file is opened */
+         bool IsOpened() const { return fMapped || fFile; }
+
+         /** Returns true when file is mapped into memory */
+         bool IsMapped() const { return fMapped != nullptr; }
+
+         /** Returns true when end of file was reached */
+         bool eof() const { return fEOF; }
+
+         /** Returns number of read events */
+         long unsigned NumEvents() const { return fNumEvents; }
+
+         EventHeader *NextEvent();
+
+         unsigned ProvideEvent(EventHeader *evnt, base::ProcMgr *mgr, bool copy = false);
+   };
+
+}
+
+#endif
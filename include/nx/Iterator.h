@@ -11,6 +11,29 @@
 
 namespace nx {
 
+   /** Arrays of nXYTER hits, produced by nx::Iterator::nextHits()
+     * Batch has fixed capacity, all messages in batch belong to same ROC */
+
+   struct HitsBatch {
+      enum {
+         MaxSize = 256,             ///< capacity of the batch
+         LastEpochFlag = 0x20       ///< last-epoch bit in flags
+      };
+
+      unsigned  size{0};                ///< number of hits
+      unsigned  numepochs{0};           ///< number of epoch messages between hits
+      bool      endsepoch{false};       ///< last decoded message is epoch
+      uint16_t  roc{0};                 ///< ROC number of all messages
+      uint8_t   nx[MaxSize];            ///< nXYTER number
+      uint8_t   ch[MaxSize];            ///< channel number
+      uint16_t  adc[MaxSize];           ///< ADC value
+      uint8_t   flags[MaxSize];         ///< bits 0-2 - LTS MSB, bit 3 - pileup, bit 4 - overflow, bit 5 - last-epoch
+      int8_t    verify[MaxSize];        ///< result of last-epoch verification, filled only when correction enabled
+      uint64_t  stamp[MaxSize];         ///< full 46-bit stamp, last-epoch flag is applied, lower 14 bits are nXYTER time stamp
+      uint32_t  epoch[MaxSize];         ///< numbers of decoded epoch messages
+      nx::Message msg[MaxSize];         ///< decoded hit messages, source for other arrays
+   };
+
    class Iterator : public base::Iterator {
       protected:
 
@@ -30,6 +53,60 @@ namespace nx {
 
          void VerifyMessage();
 
+         void CorrectHits(HitsBatch &batch);
+
+         /** Decode hit and epoch messages for specified format, format is known at compile time
+           * Loop only copies hit messages and epoch part of hit stamps into batch, fields extracted later with simple loops.
+           * Loop is without branches for hit and epoch messages - both are always written into batch
+           * and only counter of matching kind is incremented */
+         template<int fmt>
+         void decodeHits(HitsBatch &batch)
+         {
+            nx::Message msg(fMsg); // keeps ROC number for formats without it
+            // local copies of iterator members, otherwise they are reloaded after each store
+            uint8_t *ptr = (uint8_t*) fBuffer + fBufferPos, *end = (uint8_t*) fBuffer + fBufferLen;
+            unsigned msgsize = fMsgSize, n = 0, nepochs = 0;
+            uint32_t epoch = fEpoch;
+            bool ishit = true;
+
+            if (ptr + msgsize <= end) {
+               msg.assign(ptr, fmt);
+               batch.roc = msg.getRocNumber();
+            }
+
+            while ((ptr + msgsize <= end) && (n + nepochs < HitsBatch::MaxSize)) {
+               msg.assign(ptr, fmt);
+
+               uint8_t typ = msg.getMessageType();
+               if (((typ != base::MSG_HIT) && (typ != base::MSG_EPOCH)) || (msg.getRocNumber() != batch.roc))
+                  break;
+
+               ishit = (typ == base::MSG_HIT);
+
+               batch.msg[n] = msg;
+               batch.stamp[n] = FullTimeStamp(epoch, 0);
+               batch.epoch[nepochs] = msg.getEpochNumber();
+
+               // masks instead of conditions, otherwise compiler produces branches again
+               unsigned hitmask = ishit ? 1 : 0;
+               epoch ^= (epoch ^ msg.getEpochNumber()) & (hitmask - 1);
+               n += hitmask;
+               nepochs += hitmask ^ 1;
+
+               ptr += msgsize;
+            }
+
+            // reference moved only once, batch cannot be longer than half of 46-bit wrap
+            if (nepochs > 0)
+               fConv.MoveRef(((uint64_t) epoch) << 14);
+
+            fBufferPos = ptr - (uint8_t*) fBuffer;
+            fEpoch = epoch;
+            batch.size = n;
+            batch.numepochs = nepochs;
+            batch.endsepoch = (n + nepochs > 0) && !ishit;
+         }
+
       public:
          Iterator(int fmt = base::formatNormal);
 
@@ -63,6 +140,8 @@ namespace nx {
 
          int GetVerifyResult() const { return fVerifyRes; }
 
+         unsigned nextHits(HitsBatch &batch);
+
          // can be used only inside buffer, not with board source
          inline bool last()
          {
@@ -111,6 +190,12 @@ namespace nx {
             return fConv.ToSeconds(getMsgStamp());
          }
 
+         /** Return message time in integer picoseconds */
+         inline base::PicoTime_t getMsgTimePs() const
+         {
+            return fConv.ToPicoSeconds(getMsgStamp());
+         }
+
          /** Method converts stamp value to double */
          inline double StampToTime(uint64_t stamp) const
          {
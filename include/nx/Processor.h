@@ -30,6 +30,7 @@ namespace nx {
       protected:
          nx::Iterator fIter1;  ///<! first iterator over all messages
          nx::Iterator fIter2;  ///<! second iterator over all messages
+         nx::HitsBatch fBatch; ///<! hits decoded in first scan
 
          base::H1handle fMsgsKind;   ///<! histogram with messages kinds
          base::H1handle fSysTypes;   ///<! histogram with system types
@@ -46,6 +47,8 @@ namespace nx {
 
          void AssignBufferTo(nx::Iterator& iter, const base::Buffer& buf);
 
+         unsigned ScanHitsBatch(const base::Buffer& buf, bool &first);
+
          // this constant identify to which extend NX time can be disordered
          virtual double MaximumDisorderTm() const { return fNXDisorderTm; }
 